@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2018 Karel Zak <karel.zak.007@gmail.com>
+ *
+ * This file may be redistributed under the terms of the
+ * GNU Lesser General Public License.
+ */
+
+/*
+ * Private bump allocator for short-lived data (generated reply values and
+ * strings). The memory is never released per object, the whole arena is
+ * reset at once. If the arena needs more chunks then all the chunks are
+ * replaced by one bigger chunk on reset, so usually reset only zeroizes
+ * the offset.
+ */
+#include "bexP.h"
+
+#define BEX_ARENA_MINSIZE	4096
+#define BEX_ARENA_ALIGN		16
+
+struct libbex_arena_chunk {
+	struct libbex_arena_chunk *next;
+	size_t	size;
+	size_t	used;
+	char	data[] __attribute__((aligned(BEX_ARENA_ALIGN)));
+};
+
+static struct libbex_arena_chunk *new_chunk(struct libbex_arena *ar, size_t size)
+{
+	struct libbex_arena_chunk *ch;
+
+	if (size < BEX_ARENA_MINSIZE)
+		size = BEX_ARENA_MINSIZE;
+
+	ch = malloc(sizeof(*ch) + size);
+	if (!ch)
+		return NULL;
+
+	DBG(ARY, bex_debugobj(ar, "arena: new chunk [size=%zu]", size));
+	ch->size = size;
+	ch->used = 0;
+	ch->next = ar->chunks;
+	ar->chunks = ch;
+	ar->total += size;
+	return ch;
+}
+
+void bex_init_arena(struct libbex_arena *ar)
+{
+	memset(ar, 0, sizeof(*ar));
+}
+
+void bex_deinit_arena(struct libbex_arena *ar)
+{
+	while (ar->chunks) {
+		struct libbex_arena_chunk *ch = ar->chunks;
+
+		ar->chunks = ch->next;
+		free(ch);
+	}
+	memset(ar, 0, sizeof(*ar));
+}
+
+/**
+ * bex_reset_arena:
+ * @ar: arena
+ *
+ * Forgets all allocated objects.
+ */
+void bex_reset_arena(struct libbex_arena *ar)
+{
+	size_t total = ar->total;
+
+	if (!ar->chunks)
+		return;
+	if (ar->chunks->next) {
+		/* replace the chunks by one chunk for the next time */
+		bex_deinit_arena(ar);
+		new_chunk(ar, total);
+		return;
+	}
+	ar->chunks->used = 0;
+}
+
+/**
+ * bex_arena_alloc:
+ * @ar: arena
+ * @size: number of bytes
+ *
+ * Returns: zeroized memory or NULL.
+ */
+void *bex_arena_alloc(struct libbex_arena *ar, size_t size)
+{
+	struct libbex_arena_chunk *ch = ar->chunks;
+	void *p;
+
+	size = (size + BEX_ARENA_ALIGN - 1) & ~((size_t) BEX_ARENA_ALIGN - 1);
+
+	if (!ch || ch->size - ch->used < size) {
+		ch = new_chunk(ar, ch ? ch->size * 2 + size : size);
+		if (!ch)
+			return NULL;
+	}
+
+	p = ch->data + ch->used;
+	ch->used += size;
+	memset(p, 0, size);
+	return p;
+}
+
+/**
+ * bex_arena_strndup:
+ * @ar: arena
+ * @str: string
+ * @n: length of the string
+ *
+ * Returns: zero terminated copy of @str or NULL.
+ */
+char *bex_arena_strndup(struct libbex_arena *ar, const char *str, size_t n)
+{
+	char *p = bex_arena_alloc(ar, n + 1);
+
+	if (p)
+		memcpy(p, str, n);
+	return p;
+}
@@ -1,11 +1,9 @@
 
 
-#include <ctype.h>
 #include <stdint.h>
 #include <inttypes.h>
 
 #include "bexP.h"
-#include "strutils.h"
 
 static void free_array(struct libbex_array *ar)
 {
@@ -18,6 +16,7 @@ static void free_array(struct libbex_array *ar)
 	for (i = 0; i < ar->nitems; i++)
 		bex_unref_value(ar->items[i]);
 
+	bex_deinit_arena(&ar->arena);
 	free(ar->items);
 	free(ar);
 }
@@ -43,6 +42,7 @@ struct libbex_array *bex_new_array(size_t sz)
 	if (!ar->items)
 		goto err;
 	ar->nalloc = sz;
+	bex_init_arena(&ar->arena);
 	return ar;
 err:
 	free_array(ar);
@@ -82,10 +82,15 @@ void bex_unref_array(struct libbex_array *ar)
  * @ar: array
  * @va: value
  *
+ * Generated values (see bex_value_set_generated()) are kept at the end of
+ * the array, other values are inserted before them.
+ *
  * Returns: 0 on success or negative number in case of error.
  */
 int bex_array_add(struct libbex_array *ar, struct libbex_value *va)
 {
+	size_t i;
+
 	if (!ar || !va)
 		return -EINVAL;
 
@@ -102,7 +107,15 @@ int bex_array_add(struct libbex_array *ar, struct libbex_value *va)
 	}
 
 	bex_ref_value(va);
-	ar->items[ar->nitems] = va;
+
+	if (va->generated)
+		ar->items[ar->nitems] = va;
+	else {
+		/* move generated tail */
+		for (i = ar->nitems; i > ar->nfixed; i--)
+			ar->items[i] = ar->items[i - 1];
+		ar->items[ar->nfixed++] = va;
+	}
 	ar->nitems++;
 
 	DBG(ARY, bex_debugobj(ar, " add '%s' [%p]", va->name, va));
@@ -130,6 +143,8 @@ int bex_array_remove(struct libbex_array *ar, struct libbex_value *va)
 
 	if (i == ar->nitems)
 		return -EINVAL;
+	if (i < ar->nfixed)
+		ar->nfixed--;
 
 	/* move */
 	for (; i < ar->nitems - 1; i++)
@@ -151,27 +166,91 @@ int bex_array_remove(struct libbex_array *ar, struct libbex_value *va)
  */
 void bex_reset_array(struct libbex_array *ar)
 {
-	size_t i = 0;
+	size_t i;
 
 	if (!ar)
 		return;
 
 	DBG(ARY, bex_debugobj(ar, " reseting [nitems=%zu]", ar->nitems));
 
-	do {
-		struct libbex_value *va = ar->items[i];
+	for (i = 0; i < ar->nfixed; i++)
+		bex_reset_value(ar->items[i]);
 
-		if (va->generated)
-			bex_array_remove(ar, va);
-		else {
-			bex_reset_value(va);
-			i++;
-		}
-	} while (i < ar->nitems);
+	/* the generated tail lives in the arena, just forget it */
+	if (!ar->use_arena) {
+		for (i = ar->nfixed; i < ar->nitems; i++)
+			bex_unref_value(ar->items[i]);
+	}
+	ar->nitems = ar->nfixed;
+
+	/* all generated values and strings are gone */
+	bex_reset_arena(&ar->arena);
 
 	DBG(ARY, bex_debugobj(ar, " reset done [nitems=%zu]", ar->nitems));
 }
 
+/*
+ * Generated values and string data are allocated in the array arena and
+ * deallocated at once by bex_reset_array(). Note that the values are
+ * valid only until the reset (bex_ref_value() does not help).
+ */
+void bex_array_enable_arena(struct libbex_array *ar, int enable)
+{
+	ar->use_arena = enable ? 1 : 0;
+}
+
+static int set_value_from_string(struct libbex_array *ar, struct libbex_value *va,
+				 const char *str, size_t sz)
+{
+	char *p;
+
+	if (!ar->use_arena || va->type != BEX_TYPE_STR)
+		return bex_value_set_from_string(va, str, sz);
+
+	/* reuse the previous string, the arena is released by reset only */
+	if (va->str_in_arena && strlen(va->data.str) >= sz) {
+		memcpy(va->data.str, str, sz);
+		va->data.str[sz] = '\0';
+		return 0;
+	}
+
+	p = bex_arena_strndup(&ar->arena, str, sz);
+	if (!p)
+		return -ENOMEM;
+
+	bex_reset_value(va);
+	va->data.str = p;
+	va->str_in_arena = 1;
+	return 0;
+}
+
+static struct libbex_value *new_generated_value(struct libbex_array *ar,
+					const char *name, size_t sz)
+{
+	struct libbex_value *va;
+
+	if (!ar->use_arena) {
+		char *vname = strndup(name, sz);
+
+		if (!vname)
+			return NULL;
+		va = __bex_new_value(vname);
+		if (!va)
+			free(vname);
+		return va;
+	}
+
+	va = bex_arena_alloc(&ar->arena, sizeof(*va));
+	if (!va)
+		return NULL;
+	va->name = bex_arena_strndup(&ar->arena, name, sz);
+	if (!va->name)
+		return NULL;
+	va->refcount = 1;
+	va->in_arena = 1;
+	return va;
+}
+
 /**
  * bex_array_is_empty:
  * @ar: array
@@ -206,6 +285,23 @@ struct libbex_value *bex_array_get(struct libbex_array *ar, const char *name)
 	return NULL;
 }
 
+/**
+ * bex_array_get_index:
+ * @ar: array
+ * @idx: value index
+ *
+ * The values are in the same order as added to the array, so for channels
+ * the index is the position of the field in the reply.
+ *
+ * Returns: value or NULL
+ */
+struct libbex_value *bex_array_get_index(struct libbex_array *ar, size_t idx)
+{
+	if (!ar || idx >= ar->nitems)
+		return NULL;
+	return ar->items[idx];
+}
+
 /**
  * bex_array_nget:
  * @ar: array
@@ -223,9 +319,10 @@ struct libbex_value *bex_array_nget(struct libbex_array *ar, const char *name, s
 		return NULL;
 
 	for (i = 0; i < ar->nitems; i++) {
-		if (strncmp(ar->items[i]->name, name, n) == 0) {
+		const char *x = ar->items[i]->name;
+
+		if (strncmp(x, name, n) == 0 && x[n] == '\0')
 			return ar->items[i];
-		}
 	}
 
 	return NULL;
@@ -259,6 +356,16 @@ int bex_array_to_stream(struct libbex_array *ar, FILE *stream)
 		case BEX_TYPE_FLOAT:
 			fprintf(stream, "\"%s\": %Lg", va->name, va->data.fl);
 			break;
+		case BEX_TYPE_DECIMAL:
+		{
+			char buf[64], fmt[16];
+
+			snprintf(fmt, sizeof(fmt), "%%.%uf", va->data.dec.scale);
+			bex_decimal_snprintf(buf, sizeof(buf), fmt,
+					va->data.dec.num, va->data.dec.scale);
+			fprintf(stream, "\"%s\": %s", va->name, buf);
+			break;
+		}
 		default:
 			break;
 		}
@@ -268,215 +375,117 @@ int bex_array_to_stream(struct libbex_array *ar, FILE *stream)
 }
 
 /*
- * returns next NAME and VALUE pair from { name=value, ... } string
+ * Fill array from object token @idx ({ "name": data, ... })
  */
-static int parse_next(char **optstr, char **name, size_t *namesz,
-				char **value, size_t *valsz)
+int bex_array_fill_from_tokens(struct libbex_array *ar, struct libbex_parser *ps, size_t idx)
 {
-	int open_quote = 0;
-	char *start = NULL, *stop = NULL, *p, *sep = NULL;
-	char *optstr0;
-
-	optstr0 = *optstr;
-
-	if (name)
-		*name = NULL;
-	if (namesz)
-		*namesz = 0;
-	if (value)
-		*value = NULL;
-	if (valsz)
-		*valsz = 0;
-
-	while (optstr0 && *optstr0 == ',')
-		optstr0++;
-
-	for (p = optstr0; p && *p; p++) {
-		if (!start && !stop && (isspace(*p) || *p == '{' || *p == '}'))
-			continue;
-		if (!start)
-			start = p;		/* beginning of the option item */
-		if (*p == '"')
-			open_quote ^= 1;	/* reverse the status */
-		if (open_quote)
-			continue;		/* still in quoted block */
-		if (!sep && p > start && *p == ':')
-			sep = p;		/* name and value separator */
-		if (*p == ',')
-			stop = p;		/* terminate the option item */
-		else if (*(p + 1) == '\0' || *(p + 1) == '}')
-			stop = p;		/* end of optstr */
-		if (!start || !stop)
-			continue;
-		if (stop <= start)
-			goto error;
-
-		*optstr = *stop ? stop + 1 : stop;
-
-		if (*start == '"')
-			start++;
-		if (*stop == '"')
-			stop--;
-
-		if (name)
-			*name = start;
-		if (namesz) {
-			char *end = sep - 1;
-			while (end > start && (*end == '"' || isspace(*end)))
-				--end;
-			*namesz = (end - start) + 1;
-		}
-
-		sep++;
-		while (sep < stop && (*sep == '"' || isspace(*sep)))
-			sep++;
-
-		while (stop > sep && (*stop == '"' || isspace(*stop) || *stop == ','))
-			stop--;
-		if (value)
-			*value = sep;
-		if (valsz)
-			*valsz = (stop - sep) + 1;
+	struct libbex_token *obj = bex_parser_get_token(ps, idx);
+	struct libbex_value *va = NULL;
+	size_t n, i;
+	int rc = 0;
 
-		return 0;
-	}
+	if (!ar || !obj || obj->type != BEX_TOKEN_OBJECT)
+		return -EINVAL;
 
-	return 1;				/* end of optstr */
-error:
-	DBG(ARY, bex_debug("failed to parse >>>%s<<<", *optstr));
-	return -1;
-}
+	DBG(ARY, bex_debugobj(ar, "filling from tokens"));
 
-/*
- * Fill array from { name: data, ... } string
- */
-int bex_array_fill_from_string(struct libbex_array *ar, const char *str)
-{
-	char *name, *value, *p = (char *) str;
-	size_t namesz, valsz;
-	struct libbex_value *va = NULL;
-	int rc;
+	for (n = 0, i = idx + 1; rc == 0 && n + 1 < obj->size; n += 2) {
+		struct libbex_token *key = &ps->toks[i];
+		struct libbex_token *data = &ps->toks[key->next];
 
-	DBG(ARY, bex_debugobj(ar, "filling from string"));
+		i = data->next;
+		if (key->type != BEX_TOKEN_STRING)
+			return -EINVAL;
 
-	while (parse_next(&p, &name, &namesz, &value, &valsz) == 0) {
-		va = bex_array_nget(ar, name, namesz);
+		va = bex_array_nget(ar, bex_token_ptr(ps, key), key->len);
 		if (!va) {
 			/* add value on the fly */
-			char *vname = strndup(name, namesz);
-
-			if (!vname)
-				goto err_gen;
-
-			va = __bex_new_value(vname);
+			va = new_generated_value(ar, bex_token_ptr(ps, key), key->len);
 			if (!va)
-				goto err_gen;
+				return -ENOMEM;
 
 			va->type = BEX_TYPE_STR;
-			if (bex_array_add(ar, va))
-				goto err_gen;
 			bex_value_set_generated(va, 1);
+			if (bex_array_add(ar, va)) {
+				bex_unref_value(va);
+				return -ENOMEM;
+			}
 			bex_unref_value(va);
 		}
 
-		rc = bex_value_set_from_string(va, value, valsz);
-		if (rc)
-			break;
+		rc = set_value_from_string(ar, va, bex_token_ptr(ps, data), data->len);
 	}
 
 	return rc;
-err_gen:
-	bex_unref_value(va);
-	return -ENOMEM;
 }
 
 /*
- * returns next VALUE  from [ value, ... ] string
+ * Fill array from { name: data, ... } string
  */
-static int parse_next_unnamed(char **optstr, char **value, size_t *valsz)
+int bex_array_fill_from_string(struct libbex_array *ar, const char *str)
 {
-	int open_quote = 0;
-	char *start = NULL, *stop = NULL, *p, *sep = NULL;
-	char *optstr0;
-
-	optstr0 = *optstr;
-
-	if (value)
-		*value = NULL;
-	if (valsz)
-		*valsz = 0;
-
-	while (optstr0 && *optstr0 == ',')
-		optstr0++;
-
-	for (p = optstr0; p && *p; p++) {
-		if (!start && !stop && (isspace(*p) || *p == '[' || *p == ']'))
-			continue;
-		if (!start)
-			start = p;		/* beginning of the option item */
-		if (*p == '"')
-			open_quote ^= 1;	/* reverse the status */
-		if (open_quote)
-			continue;		/* still in quoted block */
-		if (!stop && p > start && *p == ',')
-			stop = p;		/* terminate the option item */
-		else if (*(p + 1) == '\0' || *(p + 1) == ']')
-			stop = p;		/* end of optstr */
-		if (!start || !stop)
-			continue;
-		if (stop <= start)
-			goto error;
-
-		*optstr = *stop ? stop + 1 : stop;
-
-		if (*start == '"')
-			start++;
-		if (*stop == '"')
-			stop--;
-
-		if (value)
-			*value = start;
-		if (valsz)
-			*valsz = (stop - sep) + 1;
-		return 0;
-	}
+	struct libbex_parser ps = { .str = NULL };
+	int rc;
 
-	return 1;				/* end of optstr */
-error:
-	DBG(ARY, bex_debug("failed to parse >>>%s<<<", *optstr));
-	return -1;
-}
+	DBG(ARY, bex_debugobj(ar, "filling from string"));
 
+	rc = bex_parser_tokenize(&ps, str, strlen(str));
+	if (!rc)
+		rc = bex_array_fill_from_tokens(ar, &ps, 0);
 
-int bex_array_fill_unnamed_from_string(struct libbex_array *ar, const char *str, char **next)
+	bex_deinit_parser(&ps);
+	return rc;
+}
+
+/*
+ * Fill array from array token @idx ([ value, ... ]), the values are assigned
+ * to the array items by position.
+ */
+int bex_array_fill_unnamed_from_tokens(struct libbex_array *ar, struct libbex_parser *ps, size_t idx)
 {
-	char *p = (char *) str;
+	struct libbex_token *row = bex_parser_get_token(ps, idx);
+	size_t n, i;
 	int rc = 0;
-	size_t i;
 
-	if (bex_array_is_empty(ar))
+	if (bex_array_is_empty(ar) || !row || row->type != BEX_TOKEN_ARRAY)
 		return -EINVAL;
 
-	DBG(ARY, bex_debugobj(ar, "filling from unnamed string"));
+	DBG(ARY, bex_debugobj(ar, "filling from unnamed tokens"));
 
-	for (i = 0; i < ar->nitems; i++) {
-		struct libbex_value *va = ar->items[i];
-		char *value;
-		size_t valsz;
-
-		if (parse_next_unnamed(&p, &value, &valsz) != 0)
-			break;
+	for (n = 0, i = idx + 1; rc == 0 && n < ar->nitems && n < row->size; n++) {
+		struct libbex_value *va = ar->items[n];
+		struct libbex_token *data = &ps->toks[i];
 
-		DBG(ARY, bex_debugobj(ar, "  %s=%s", va->name, value));
-		rc = bex_value_set_from_string(va, value, valsz);
-		if (rc)
-			break;
+		DBG(ARY, bex_debugobj(ar, "  %s=%.*s", va->name,
+				(int) data->len, bex_token_ptr(ps, data)));
+		rc = set_value_from_string(ar, va, bex_token_ptr(ps, data), data->len);
+		i = data->next;
 	}
 
-	if (*p == ']' && next )
-		*next = p + 1;
-
 	DBG(ARY, bex_debugobj(ar, "done [rc=%d]", rc));
 	return rc;
 }
 
+/*
+ * Fill array from [ value, ... ] string, @next returns pointer behind the
+ * closing bracket.
+ */
+int bex_array_fill_unnamed_from_string(struct libbex_array *ar, const char *str, char **next)
+{
+	struct libbex_parser ps = { .str = NULL };
+	int rc;
+
+	if (bex_array_is_empty(ar))
+		return -EINVAL;
+
+	DBG(ARY, bex_debugobj(ar, "filling from unnamed string"));
+
+	rc = bex_parser_tokenize(&ps, str, strlen(str));
+	if (!rc)
+		rc = bex_array_fill_unnamed_from_tokens(ar, &ps, 0);
+	if (!rc && next)
+		*next = (char *) str + ps.end;
+
+	bex_deinit_parser(&ps);
+	return rc;
+}
@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2018 Karel Zak <karel.zak.007@gmail.com>
+ *
+ * This file may be redistributed under the terms of the
+ * GNU Lesser General Public License.
+ */
+
+/*
+ * Private bars builder -- aggregates trades to time, volume or tick bars.
+ * Every trade updates only the newest bar of every bars set, so the work per
+ * trade is O(1) for each interval. The bars are stored in the candles ring
+ * buffer, see candles.c.
+ */
+#include "bexP.h"
+
+struct libbex_barset *bex_new_barset(void)
+{
+	struct libbex_barset *bs = calloc(1, sizeof(*bs));
+
+	if (!bs)
+		return NULL;
+
+	DBG(CHAN, bex_debugobj(bs, "alloc bars"));
+	return bs;
+}
+
+void bex_free_barset(struct libbex_barset *bs)
+{
+	size_t i;
+
+	if (!bs)
+		return;
+
+	DBG(CHAN, bex_debugobj(bs, "free bars"));
+	for (i = 0; i < bs->nbars; i++)
+		bex_free_candles(bs->bars[i].cs);
+	free(bs->bars);
+	free(bs);
+}
+
+/* returns index of the new bars or <0 on error */
+int bex_barset_add(struct libbex_barset *bs, int type, long double size)
+{
+	struct libbex_bars *tmp, *b;
+
+	if (size <= 0)
+		return -EINVAL;
+
+	switch (type) {
+	case BEX_BARS_TIME:
+	case BEX_BARS_TICK:
+		if (size != (uint64_t) size)
+			return -EINVAL;
+		break;
+	case BEX_BARS_VOLUME:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	tmp = realloc(bs->bars, (bs->nbars + 1) * sizeof(struct libbex_bars));
+	if (!tmp)
+		return -ENOMEM;
+	bs->bars = tmp;
+
+	b = &bs->bars[bs->nbars];
+	memset(b, 0, sizeof(*b));
+	b->type = type;
+	b->size = size;
+	b->cs = bex_new_candles();
+	if (!b->cs)
+		return -ENOMEM;
+
+	DBG(CHAN, bex_debugobj(bs, "new bars [type=%d, size=%Lf]", type, size));
+	return bs->nbars++;
+}
+
+struct libbex_candles *bex_barset_get(struct libbex_barset *bs, size_t idx)
+{
+	return idx < bs->nbars ? bs->bars[idx].cs : NULL;
+}
+
+static void start_bar(struct libbex_bars *b, uint64_t mts, const struct libbex_trade *tr)
+{
+	struct libbex_candle *c = bex_candles_push(b->cs);
+
+	c->mts = mts;
+	c->open = c->close = c->high = c->low = tr->price;
+	b->acc = 0;
+}
+
+static void update_bars(struct libbex_bars *b, const struct libbex_trade *tr)
+{
+	struct libbex_candle *c = bex_candles_last(b->cs);
+	long double vol = tr->amount < 0 ? -tr->amount : tr->amount;
+
+	if (b->type == BEX_BARS_TIME) {
+		uint64_t size = (uint64_t) b->size;
+		uint64_t mts = tr->mts - tr->mts % size;
+
+		if (!c || mts > c->mts)
+			start_bar(b, mts, tr);
+		else if (mts < c->mts) {
+			DBG(CHAN, bex_debugobj(b, "ignore late trade %ju", (uintmax_t) tr->id));
+			return;
+		}
+	} else if (!c || b->acc >= b->size)
+		start_bar(b, tr->mts, tr);		/* the last bar is complete */
+
+	c = bex_candles_last(b->cs);
+	if (tr->price > c->high)
+		c->high = tr->price;
+	if (tr->price < c->low)
+		c->low = tr->price;
+	c->close = tr->price;
+	c->volume += vol;
+
+	b->acc += b->type == BEX_BARS_TICK ? 1 : vol;
+}
+
+int bex_barset_update(struct libbex_barset *bs, const struct libbex_trade *tr)
+{
+	size_t i;
+
+	for (i = 0; i < bs->nbars; i++)
+		update_bars(&bs->bars[i], tr);
+	return 0;
+}
+
+#ifdef TEST_PROGRAM_BARS
+#define NTRADES		5000
+
+static struct libbex_trade trades[NTRADES];
+
+static void init_trades(void)
+{
+	size_t i;
+
+	srand(42);
+	for (i = 0; i < NTRADES; i++) {
+		trades[i].id = i + 1;
+		trades[i].mts = (i ? trades[i - 1].mts : 1000000) + rand() % 3000;
+		trades[i].price = 100 + rand() % 50;
+		trades[i].amount = (rand() % 2 ? 1 : -1) * (1 + rand() % 4);
+	}
+}
+
+/* bar from trades [@first, @last) */
+static int check_bar(const struct libbex_candle *c, uint64_t mts,
+		     size_t first, size_t last)
+{
+	long double high = trades[first].price, low = trades[first].price, vol = 0;
+	size_t i;
+
+	for (i = first; i < last; i++) {
+		if (trades[i].price > high)
+			high = trades[i].price;
+		if (trades[i].price < low)
+			low = trades[i].price;
+		vol += trades[i].amount < 0 ? -trades[i].amount : trades[i].amount;
+	}
+	if (!c || c->mts != mts || c->open != trades[first].price ||
+	    c->close != trades[last - 1].price || c->high != high ||
+	    c->low != low || c->volume != vol) {
+		fprintf(stderr, "bar %ju: mismatch\n", (uintmax_t) mts);
+		return -1;
+	}
+	return 0;
+}
+
+static int test_bars_time(void)
+{
+	struct libbex_barset *bs = bex_new_barset();
+	struct libbex_candles *cs;
+	struct libbex_trade late;
+	size_t i, first, n;
+	uint64_t size = 60000;
+	int rc = EXIT_SUCCESS;
+
+	init_trades();
+	bex_barset_add(bs, BEX_BARS_TIME, size);
+	for (i = 0; i < NTRADES; i++)
+		bex_barset_update(bs, &trades[i]);
+
+	/* late trade is ignored */
+	late = trades[0];
+	late.price = 1000;
+	bex_barset_update(bs, &late);
+
+	cs = bex_barset_get(bs, 0);
+
+	/* from the newest bar */
+	n = 0;
+	for (i = NTRADES, first = NTRADES; i > 0 && rc == EXIT_SUCCESS; i = first) {
+		uint64_t mts = trades[i - 1].mts - trades[i - 1].mts % size;
+
+		while (first > 0 && trades[first - 1].mts >= mts)
+			first--;
+		if (check_bar(bex_candles_get(cs, n++), mts, first, i) != 0)
+			rc = EXIT_FAILURE;
+	}
+	if (rc == EXIT_SUCCESS && n != bex_candles_get_count(cs)) {
+		fprintf(stderr, "%zu bars, expected %zu\n",
+				bex_candles_get_count(cs), n);
+		rc = EXIT_FAILURE;
+	}
+
+	bex_free_barset(bs);
+	return rc;
+}
+
+/* more bars than the ring buffer size, the oldest are overwritten */
+static int test_bars_tick(void)
+{
+	struct libbex_barset *bs = bex_new_barset();
+	struct libbex_candles *cs;
+	size_t i, n, size = 3;
+	int rc = EXIT_SUCCESS;
+
+	init_trades();
+	bex_barset_add(bs, BEX_BARS_TICK, size);
+	for (i = 0; i < NTRADES; i++)
+		bex_barset_update(bs, &trades[i]);
+
+	cs = bex_barset_get(bs, 0);
+	if (bex_candles_get_count(cs) != min(cs->size,
+					     (NTRADES + size - 1) / size)) {
+		fprintf(stderr, "bad number of bars %zu\n", bex_candles_get_count(cs));
+		rc = EXIT_FAILURE;
+	}
+	for (n = 0; n < bex_candles_get_count(cs) && rc == EXIT_SUCCESS; n++) {
+		size_t first = ((NTRADES - 1) / size - n) * size;
+
+		if (check_bar(bex_candles_get(cs, n), trades[first].mts, first,
+			      min(first + size, (size_t) NTRADES)) != 0)
+			rc = EXIT_FAILURE;
+	}
+
+	bex_free_barset(bs);
+	return rc;
+}
+
+static int test_bars_volume(void)
+{
+	struct libbex_barset *bs = bex_new_barset();
+	struct libbex_candles *cs;
+	size_t i, first = 0, n;
+	long double size = 4.5, acc = 0;
+	int rc = EXIT_SUCCESS;
+
+	init_trades();
+	bex_barset_add(bs, BEX_BARS_VOLUME, size);
+	for (i = 0; i < NTRADES; i++)
+		bex_barset_update(bs, &trades[i]);
+
+	/* from the oldest bar still in the buffer */
+	cs = bex_barset_get(bs, 0);
+	n = 0;
+	for (i = 0; i < NTRADES; i++) {
+		acc += trades[i].amount < 0 ? -trades[i].amount : trades[i].amount;
+		if (acc >= size || i == NTRADES - 1) {
+			n++;
+			acc = 0;
+		}
+	}
+	if (bex_candles_get_count(cs) != min(cs->size, n)) {
+		fprintf(stderr, "bad number of bars %zu\n", bex_candles_get_count(cs));
+		rc = EXIT_FAILURE;
+	}
+
+	acc = 0;
+	for (i = 0; i < NTRADES && rc == EXIT_SUCCESS; i++) {
+		acc += trades[i].amount < 0 ? -trades[i].amount : trades[i].amount;
+		if (acc < size && i < NTRADES - 1)
+			continue;
+		if (--n < bex_candles_get_count(cs) &&
+		    check_bar(bex_candles_get(cs, n), trades[first].mts, first, i + 1) != 0)
+			rc = EXIT_FAILURE;
+		first = i + 1;
+		acc = 0;
+	}
+
+	bex_free_barset(bs);
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 2 && strcmp(argv[1], "--time") == 0)
+		return test_bars_time();
+	if (argc == 2 && strcmp(argv[1], "--tick") == 0)
+		return test_bars_tick();
+	if (argc == 2 && strcmp(argv[1], "--volume") == 0)
+		return test_bars_volume();
+	if (argc == 1)
+		return test_bars_time() == EXIT_SUCCESS &&
+		       test_bars_tick() == EXIT_SUCCESS &&
+		       test_bars_volume() == EXIT_SUCCESS ?
+				EXIT_SUCCESS : EXIT_FAILURE;
+
+	fprintf(stderr, "usage: %s [--time | --tick | --volume]\n", argv[0]);
+	exit(EXIT_FAILURE);
+}
+#endif /* TEST_PROGRAM_BARS */
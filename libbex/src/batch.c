@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2018 Karel Zak <karel.zak.007@gmail.com>
+ *
+ * This file may be redistributed under the terms of the
+ * GNU Lesser General Public License.
+ */
+
+/**
+ * SECTION: batch
+ * @title: Batch
+ * @short_description: all rows of the channel message
+ *
+ * The batch is a set of columns, one column for each channel reply value (in
+ * the same order as the values, so for example BEX_TRADE_PRICE is the
+ * column with trade prices). The column is a contiguous array of the
+ * values of the same type. The batch is valid only within the batch
+ * callback, see bex_channel_set_batch_callback().
+ */
+#include "bexP.h"
+
+#define BEX_BATCH_MINROWS	32
+
+struct libbex_batch *bex_new_batch(void)
+{
+	struct libbex_batch *ba = calloc(1, sizeof(*ba));
+
+	if (!ba)
+		return NULL;
+
+	DBG(CHAN, bex_debugobj(ba, "alloc batch"));
+	bex_init_arena(&ba->arena);
+	return ba;
+}
+
+static void free_columns(struct libbex_batch *ba)
+{
+	size_t i;
+
+	for (i = 0; i < ba->ncols; i++)
+		free(ba->cols[i].data);
+	free(ba->cols);
+	ba->cols = NULL;
+	ba->ncols = 0;
+	ba->nalloc = 0;
+}
+
+void bex_free_batch(struct libbex_batch *ba)
+{
+	if (!ba)
+		return;
+
+	DBG(CHAN, bex_debugobj(ba, "free batch"));
+	free_columns(ba);
+	bex_deinit_arena(&ba->arena);
+	free(ba);
+}
+
+/* the columns have to follow the reply definition */
+static int init_columns(struct libbex_batch *ba, struct libbex_array *ar)
+{
+	size_t i;
+
+	if (ba->ncols == ar->nitems) {
+		for (i = 0; i < ba->ncols; i++) {
+			if (ba->cols[i].type != ar->items[i]->type)
+				break;
+		}
+		if (i == ba->ncols)
+			return 0;
+	}
+
+	free_columns(ba);
+	ba->cols = calloc(ar->nitems, sizeof(struct libbex_column));
+	if (!ba->cols)
+		return -ENOMEM;
+
+	ba->ncols = ar->nitems;
+	for (i = 0; i < ba->ncols; i++)
+		ba->cols[i].type = ar->items[i]->type;
+	return 0;
+}
+
+static int resize_columns(struct libbex_batch *ba, size_t nrows)
+{
+	size_t i, newsz;
+
+	if (nrows <= ba->nalloc)
+		return 0;
+
+	newsz = ba->nalloc ? ba->nalloc : BEX_BATCH_MINROWS;
+	while (newsz < nrows)
+		newsz *= 2;
+
+	DBG(CHAN, bex_debugobj(ba, " resize batch %zu -> %zu", ba->nalloc, newsz));
+
+	for (i = 0; i < ba->ncols; i++) {
+		size_t sz = bex_value_type_size(ba->cols[i].type);
+		void *tmp = realloc(ba->cols[i].data, newsz * sz);
+
+		if (!tmp)
+			return -ENOMEM;
+		ba->cols[i].data = tmp;
+	}
+	ba->nalloc = newsz;
+	return 0;
+}
+
+/* copy value to the column */
+static int set_column_value(struct libbex_batch *ba, struct libbex_column *col,
+			    size_t row, struct libbex_value *va)
+{
+	switch (col->type) {
+	case BEX_TYPE_STR:
+	{
+		const char *str = va->data.str;
+		char *p = NULL;
+
+		if (str) {
+			p = bex_arena_strndup(&ba->arena, str, strlen(str));
+			if (!p)
+				return -ENOMEM;
+		}
+		((char **) col->data)[row] = p;
+		break;
+	}
+	case BEX_TYPE_U64:
+		((uint64_t *) col->data)[row] = va->data.u64;
+		break;
+	case BEX_TYPE_S64:
+		((int64_t *) col->data)[row] = va->data.s64;
+		break;
+	case BEX_TYPE_FLOAT:
+		((long double *) col->data)[row] = va->data.fl;
+		break;
+	case BEX_TYPE_DECIMAL:
+		((int64_t *) col->data)[row] = va->data.dec.num;
+		break;
+	}
+	return 0;
+}
+
+/*
+ * Prepares batch for @nrows rows of the channel reply @ar.
+ */
+int bex_batch_start(struct libbex_batch *ba, struct libbex_array *ar, size_t nrows)
+{
+	int rc;
+
+	if (!ba || bex_array_is_empty(ar))
+		return -EINVAL;
+
+	ba->nrows = 0;
+	bex_reset_arena(&ba->arena);
+
+	rc = init_columns(ba, ar);
+	if (!rc)
+		rc = resize_columns(ba, nrows);
+	return rc;
+}
+
+/*
+ * Copies the current values of the channel reply @ar to the next row.
+ */
+int bex_batch_add_row(struct libbex_batch *ba, struct libbex_array *ar)
+{
+	size_t i;
+	int rc;
+
+	if (ba->ncols != ar->nitems)
+		return -EINVAL;
+
+	rc = resize_columns(ba, ba->nrows + 1);
+	if (rc)
+		return rc;
+
+	for (i = 0; i < ba->ncols; i++) {
+		rc = set_column_value(ba, &ba->cols[i], ba->nrows, ar->items[i]);
+		if (rc)
+			return rc;
+	}
+	ba->nrows++;
+	return 0;
+}
+
+/**
+ * bex_batch_get_nrows:
+ * @ba: batch
+ *
+ * Returns: number of rows.
+ */
+size_t bex_batch_get_nrows(struct libbex_batch *ba)
+{
+	return ba ? ba->nrows : 0;
+}
+
+static void *get_column(struct libbex_batch *ba, size_t idx, int type)
+{
+	if (!ba || idx >= ba->ncols || ba->cols[idx].type != type)
+		return NULL;
+	return ba->cols[idx].data;
+}
+
+/**
+ * bex_batch_get_u64:
+ * @ba: batch
+ * @idx: column (reply value) index
+ *
+ * Returns: array of bex_batch_get_nrows() numbers or NULL if the column
+ * does not exist or it's not BEX_TYPE_U64.
+ */
+const uint64_t *bex_batch_get_u64(struct libbex_batch *ba, size_t idx)
+{
+	return get_column(ba, idx, BEX_TYPE_U64);
+}
+
+/**
+ * bex_batch_get_s64:
+ * @ba: batch
+ * @idx: column (reply value) index
+ *
+ * Returns: array of numbers or NULL if the column is not BEX_TYPE_S64.
+ */
+const int64_t *bex_batch_get_s64(struct libbex_batch *ba, size_t idx)
+{
+	return get_column(ba, idx, BEX_TYPE_S64);
+}
+
+/**
+ * bex_batch_get_float:
+ * @ba: batch
+ * @idx: column (reply value) index
+ *
+ * Returns: array of numbers or NULL if the column is not BEX_TYPE_FLOAT.
+ */
+const long double *bex_batch_get_float(struct libbex_batch *ba, size_t idx)
+{
+	return get_column(ba, idx, BEX_TYPE_FLOAT);
+}
+
+/**
+ * bex_batch_get_decimal:
+ * @ba: batch
+ * @idx: column (reply value) index
+ *
+ * The scale is the same for all rows, see bex_value_get_scale() for the
+ * reply value.
+ *
+ * Returns: array of mantissas or NULL if the column is not BEX_TYPE_DECIMAL.
+ */
+const int64_t *bex_batch_get_decimal(struct libbex_batch *ba, size_t idx)
+{
+	return get_column(ba, idx, BEX_TYPE_DECIMAL);
+}
+
+/**
+ * bex_batch_get_str:
+ * @ba: batch
+ * @idx: column (reply value) index
+ *
+ * Returns: array of strings or NULL if the column is not BEX_TYPE_STR.
+ */
+const char * const *bex_batch_get_str(struct libbex_batch *ba, size_t idx)
+{
+	return get_column(ba, idx, BEX_TYPE_STR);
+}
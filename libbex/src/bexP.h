@@ -6,7 +6,10 @@
 #include "debug.h"
 
 #include <stdio.h>
+#include <time.h>
 #include <sys/time.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "libbex.h"
 
@@ -21,6 +24,8 @@
 #define BEX_DEBUG_VAL		(1 << 5)
 #define BEX_DEBUG_EVENT		(1 << 6)
 #define BEX_DEBUG_CHAN		(1 << 7)
+#define BEX_DEBUG_PARSE		(1 << 8)
+#define BEX_DEBUG_BOOK		(1 << 9)
 
 #define BEX_DEBUG_ALL		0xFFFF
 
@@ -29,6 +34,15 @@ BEX_DEBUG_DECLARE_MASK(libbex);
 #define ON_DBG(m, x)	__BEX_DBG_CALL(libbex, BEX_DEBUG_, m, x)
 #define DBG_FLUSH	__BEX_DBG_FLUSH(libbex, BEX_DEBUG_)
 
+/* CLOCK_MONOTONIC in nanoseconds, see bex_channel_get_rx_time() */
+static inline uint64_t bex_get_monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 /*
  * Generic iterator
  */
@@ -56,11 +70,50 @@ struct libbex_iter {
 				(itr)->p->next : (itr)->p->prev; \
 	} while(0)
 
+/*
+ * Tokenizer
+ */
+enum {
+	BEX_TOKEN_OBJECT = 1,	/* { ... } */
+	BEX_TOKEN_ARRAY,	/* [ ... ] */
+	BEX_TOKEN_STRING,	/* "..." (span without quotes) */
+	BEX_TOKEN_PRIMITIVE	/* number, true, false or null */
+};
+
+struct libbex_token {
+	int		type;		/* BEX_TOKEN_* */
+	uint32_t	start;		/* offset of the first byte */
+	uint32_t	len;		/* length of the span */
+	uint32_t	next;		/* index of the next sibling token */
+	uint32_t	size;		/* number of children (object or array) */
+};
+
+#define BEX_PARSER_MAXDEPTH	32
+
+struct libbex_parser {
+	const char		*str;		/* tokenized data */
+	size_t			len;		/* size of the data */
+	size_t			end;		/* end of the first value */
+
+	struct libbex_token	*toks;
+	size_t			ntoks;		/* number of used tokens */
+	size_t			nalloc;		/* number of allocated tokens */
+
+	size_t			stack[BEX_PARSER_MAXDEPTH];
+	size_t			depth;
+
+	uint64_t		*bits;		/* structural characters bitmap */
+	size_t			nbits;		/* number of allocated words */
+};
+
+#define bex_token_ptr(_ps, _tk)	((_ps)->str + (_tk)->start)
+
 enum {
 	BEX_TYPE_STR = 1,
 	BEX_TYPE_U64,
 	BEX_TYPE_S64,
-	BEX_TYPE_FLOAT
+	BEX_TYPE_FLOAT,
+	BEX_TYPE_DECIMAL	/* fixed-point, see decimal.c */
 };
 
 struct libbex_value {
@@ -73,9 +126,25 @@ struct libbex_value {
 		uint64_t	u64;
 		int64_t		s64;
 		long double	fl;
+		struct {
+			int64_t		num;	/* mantissa */
+			unsigned int	scale;	/* number of decimal places */
+		} dec;
 	} data;
 
-	unsigned int	generated : 1;
+	unsigned int	generated : 1,
+			in_arena : 1,		/* struct and name allocated in arena */
+			str_in_arena : 1;	/* data.str allocated in arena */
+};
+
+/*
+ * Bump allocator, see arena.c
+ */
+struct libbex_arena_chunk;
+
+struct libbex_arena {
+	struct libbex_arena_chunk	*chunks;
+	size_t				total;	/* size of all chunks */
 };
 
 struct libbex_array {
@@ -83,12 +152,155 @@ struct libbex_array {
 
 	size_t	nitems;		/* number of items */
 	size_t	nalloc;		/* number of allocated items */
+	size_t	nfixed;		/* items before the generated tail */
 
 	struct libbex_value	**items;
+
+	struct libbex_arena	arena;		/* generated values and strings */
+	unsigned int		use_arena : 1;
 };
 
 #define BEX_CHANNEL_REPLY_TYPE_BUFSZ	32
 
+/*
+ * Compiled reply field, the value is copied to reply struct at @offset
+ */
+struct libbex_field {
+	struct libbex_value	*va;
+	size_t			offset;
+};
+
+/*
+ * Batch of the rows, the columns follow channel reply values
+ */
+struct libbex_column {
+	int	type;		/* BEX_TYPE_* */
+	void	*data;		/* array of the values */
+};
+
+struct libbex_batch {
+	size_t	nrows;
+	size_t	nalloc;		/* allocated rows */
+
+	struct libbex_column	*cols;
+	size_t			ncols;
+
+	struct libbex_arena	arena;	/* strings */
+};
+
+/*
+ * Private uint64_t -> pointer hash, see hash.c
+ */
+struct libbex_hash_entry {
+	uint64_t	key;
+	void		*data;		/* NULL for unused entry */
+};
+
+struct libbex_hash {
+	struct libbex_hash_entry	*ents;
+	size_t				size;	/* power of 2 */
+	size_t				count;
+};
+
+/*
+ * Order book, see book.c
+ */
+struct libbex_book_side {
+	struct libbex_book_level	*levels;	/* sorted, the best price is the last */
+	size_t				nlevels;
+	size_t				nalloc;
+	struct libbex_hash		prices;		/* price -> index + 1 (hint) */
+};
+
+/* "price:amount" of the level for the checksum, see bex_book_checksum() */
+#define BEX_BOOK_CHECKSUM_DEPTH	25
+
+struct libbex_book_cslevel {
+	int64_t		price;
+	int64_t		amount;
+	size_t		len;
+	char		str[64];
+};
+
+struct libbex_book {
+	struct libbex_book_side	sides[2];	/* BEX_BOOK_{BIDS,ASKS} */
+
+	struct libbex_book_cslevel cslevels[2][BEX_BOOK_CHECKSUM_DEPTH];
+	uint32_t		checksum;
+	unsigned int		cs_changed : 1;	/* top levels changed */
+};
+
+struct rawbook_node;
+struct rawbook_chunk;
+
+struct libbex_rawbook {
+	struct libbex_hash	orders;		/* order ID -> node */
+	struct libbex_book	*book;		/* aggregated levels */
+
+	struct rawbook_node	*free_nodes;
+	struct rawbook_chunk	*chunks;
+};
+
+/*
+ * Channel message in the threaded mode, see ring.c
+ */
+#define BEX_RING_SIZE		4096	/* messages per connection, power of 2 */
+#define BEX_RING_DATASZ		256	/* max. reply struct size */
+
+enum {
+	BEX_MSG_SNAPSHOT	= (1 << 0),	/* the row is part of snapshot */
+	BEX_MSG_SNAPSHOT_BEGIN	= (1 << 1),	/* the first row of snapshot */
+	BEX_MSG_NODATA		= (1 << 2),	/* empty snapshot */
+	BEX_MSG_RESYNC		= (1 << 3),	/* snapshot after reconnect */
+	BEX_MSG_CHECKSUM	= (1 << 4),	/* data is int32_t checksum */
+	BEX_MSG_GAP		= (1 << 5)	/* data is uint64_t expected seq, ch may be NULL */
+};
+
+struct libbex_ring_msg {
+	struct libbex_channel	*ch;
+	unsigned int		flags;		/* BEX_MSG_* */
+	uint64_t		seq;		/* BEX_CONF_SEQ_ALL */
+	uint64_t		mts;		/* BEX_CONF_TIMESTAMP */
+	uint64_t		rx_time;	/* bex_get_monotonic_ns() */
+	char			type[BEX_CHANNEL_REPLY_TYPE_BUFSZ];
+	unsigned char		data[] __attribute__((aligned(16)));	/* reply struct */
+};
+
+struct libbex_ring {
+	size_t		size;		/* power of 2 */
+	size_t		slotsz;
+	unsigned char	*slots;
+
+	/* on separate cache lines */
+	size_t		head __attribute__((aligned(64)));	/* producer */
+	size_t		tail __attribute__((aligned(64)));	/* consumer */
+};
+
+/*
+ * Candles ring buffer, see candles.c
+ */
+struct libbex_candles {
+	struct libbex_candle	*ring;
+	size_t			size;	/* power of 2 */
+	size_t			head;	/* the oldest candle */
+	size_t			count;
+};
+
+/*
+ * Bars built from trades, see bars.c
+ */
+struct libbex_bars {
+	int			type;	/* BEX_BARS_* */
+	long double		size;	/* ms, volume or number of trades */
+	long double		acc;	/* volume or trades in the newest bar */
+	struct libbex_candles	*cs;
+};
+
+struct libbex_barset {
+	struct libbex_bars	*bars;
+	size_t			nbars;
+};
+
 struct libbex_channel {
 	int	refcount;
 	char	*name;
@@ -100,6 +312,7 @@ struct libbex_channel {
 	struct timeval	last_update;
 
 	int	(*callback)(struct libbex_platform *, struct libbex_channel *);
+	int	(*batch_callback)(struct libbex_channel *, struct libbex_batch *);
 	int     (*verify)(struct libbex_channel *, struct libbex_event *);
 	void	*data;
 
@@ -107,20 +320,53 @@ struct libbex_channel {
 	struct libbex_array	*reply;
 	char			reply_type[BEX_CHANNEL_REPLY_TYPE_BUFSZ];
 
+	struct libbex_field	*fields;	/* reply schema */
+	size_t			nfields;
+	void			*reply_struct;
+	size_t			reply_struct_size;
+
+	struct libbex_batch	*batch;		/* for batch_callback */
+
+	/* channel type specific data (e.g. order book) */
+	void	*priv;
+	int	(*priv_snapshot)(struct libbex_channel *);	/* snapshot begin */
+	int	(*priv_update)(struct libbex_channel *);	/* for each row */
+	int	(*priv_checksum)(struct libbex_channel *, int32_t);	/* "cs" message */
+	void	(*priv_free)(void *);
+	uint64_t conf_flags;		/* required BEX_CONF_* */
+
 	char	*inbuff;
 	size_t	inbuffsiz;
 
+	struct libbex_conn	*conn;		/* assigned connection */
+	uint64_t		hash_id;	/* key in conn->channels_ids or 0 */
+	uint64_t		nmsgs;		/* received messages */
+	struct libbex_ring_msg	*rx_msg;	/* dispatched message (threaded mode) */
+	uint64_t		seq;		/* of the last message, BEX_CONF_SEQ_ALL */
+	uint64_t		mts;		/* of the last message, BEX_CONF_TIMESTAMP */
+	uint64_t		rx_time;	/* of the last message, bex_get_monotonic_ns() */
+	struct libbex_latency	*latency;	/* bex_channel_enable_latency_stats() */
+	ssize_t			mts_offset;	/* exchange time in reply struct or -1 */
+
 	struct list_head	channels;		/* platform events list */
 
-	unsigned int	subscribed : 1;
+	int		status;			/* BEX_CHANNEL_* */
+	unsigned int	resubscribe;		/* subscribe again when unsubscribed, platform lock */
+	unsigned int	reconnect;		/* subscribe again when reconnected, platform lock */
+	unsigned int	subscribed : 1,
+			snapshot : 1,		/* processing snapshot */
+			resync : 1,		/* the next snapshot is after reconnect */
+			synced : 1;		/* snapshot received, the next rows are updates */
 };
 
 struct libbex_event {
 	int	refcount;
 	char	*name;
+	uint64_t namehash;	/* bex_hash_string(name) */
 
 	int	(*callback)(struct libbex_platform *, struct libbex_event *);
 	void	*data;
+	uint64_t rx_time;	/* of the last reply, bex_get_monotonic_ns() */
 
 	struct libbex_array	*vals;
 	struct libbex_array	*reply;
@@ -134,6 +380,39 @@ struct libbex_symbol {
 	const char	*right;
 	const char	*amount;
 	const char	*price;
+
+	unsigned int	amount_scale;	/* decimal places for BEX_TYPE_DECIMAL */
+	unsigned int	price_scale;
+};
+
+/*
+ * Raw frames capture, see capture.c
+ */
+#define BEX_CAPTURE_MAGIC	"BEXCAP01"
+#define BEX_CAPTURE_SIZE	(64 * 1024 * 1024)	/* default segment size */
+
+struct libbex_capture_segment {
+	char		*name;
+	int		fd;
+	unsigned char	*map;
+	size_t		used;
+};
+
+struct libbex_capture {
+	char		*path;		/* segments are <path>.<N> */
+	unsigned int	segno;		/* the next segment number */
+	size_t		segsize;
+
+	pthread_mutex_t	lock;		/* connection threads and the capture thread */
+	pthread_cond_t	cond;		/* wakes up the capture thread */
+	pthread_cond_t	ready;		/* the spare segment is ready */
+	pthread_t	thread;		/* closes the full and opens the spare segment */
+
+	struct libbex_capture_segment	cur;	/* written segment */
+	struct libbex_capture_segment	spare;	/* the next segment, preallocated */
+	struct libbex_capture_segment	full;	/* to be closed by the thread */
+	int				error;	/* the spare segment cannot be opened */
+	unsigned int			stop : 1;
 };
 
 struct libbex_platform {
@@ -145,31 +424,257 @@ struct libbex_platform {
 	int	uri_port;
 	int	uri_ssl;
 
-	void	*wss;			/* connection */
-	unsigned int	connection_attempts;
-	unsigned int	reconnect_timeout;	/* ms */
+	struct libbex_conn	**conns;	/* connections, the first always exists */
+	size_t			nconns;
+	struct libbex_conn	*rx_conn;	/* the connection with received data */
+	unsigned int		max_channels;	/* per connection */
+
+	struct pollfd	*pollfds;		/* for wss_service_all() */
+	size_t		pollfdsz;
+
+	unsigned int	connection_attempts;	/* for bex_platform_connect() */
+	unsigned int	connect_timeout;	/* ms, one attempt */
+	unsigned int	reconnect_timeout;	/* ms, the first reconnect delay */
+	unsigned int	reconnect_max;		/* ms, max. delay (exponential backoff) */
+	uint64_t	flags;			/* bex_platform_set_flags() */
+	uint64_t	conf_flags;		/* BEX_CONF_* for all connections */
 	unsigned int	service_timeout;
 
+	struct libbex_capture	*capture;	/* bex_platform_set_capture() */
+	size_t			capture_size;	/* segment size */
+
+	int	(*poll_callback)(struct libbex_platform *, int, int, int);
+	int	(*subscribe_callback)(struct libbex_platform *, struct libbex_channel *, int);
+	int	(*connect_callback)(struct libbex_platform *, int, int);
+	int	(*gap_callback)(struct libbex_platform *, struct libbex_channel *, uint64_t, uint64_t);
+
+	pthread_mutex_t	lock;			/* events and channels in threaded mode */
+	pthread_mutex_t	rx_lock;		/* rx_cond */
+	pthread_cond_t	rx_cond;		/* queued message or event, see bex_platform_wakeup() */
+	unsigned int	rx_waiting;		/* the dispatcher sleeps on rx_cond */
+	unsigned int	threaded : 1;
+
 	struct list_head	events;
+	struct libbex_hash	events_names;	/* bex_hash_string(name) -> event */
 	struct list_head	channels;
+};
+
+/* default limit, Bitfinex allows 25 channels per connection */
+#define BEX_CONN_MAXCHANNELS	25
 
+/*
+ * Connection, the platform uses more connections to the same address if
+ * there is more channels than the exchange allows for one connection.
+ */
+struct libbex_conn {
+	struct libbex_platform	*pl;
+	unsigned int		idx;
+
+	void			*wss;		/* websocket, see wss.c */
+	size_t			nchannels;	/* assigned channels */
+	struct libbex_hash	channels_ids;	/* chanId -> channel, the IDs are per connection */
+
+	struct libbex_parser	parser;		/* received data tokenizer */
+
+	/* threaded mode, see bex_platform_start_threads() */
+	pthread_t		thread;
+	pthread_mutex_t		lock;		/* channels_ids and channels processing */
+	struct libbex_ring	*ring;		/* received messages */
+	unsigned int		stop;
+
+	/* reconnect, see bex_conn_lost() */
+	unsigned int		backoff;	/* the next reconnect delay (ms) */
+	struct timeval		next_connect;	/* don't connect before */
+	unsigned int		nreconnects;
+	unsigned int		nfailed;	/* failed attempts since last connect */
+	uint64_t		conf_sent;	/* requested by "conf" event */
+	uint64_t		conf_flags;	/* confirmed by the exchange */
+	uint64_t		seq;		/* the last received, BEX_CONF_SEQ_ALL */
+	unsigned int		ngaps;		/* missing sequence numbers */
+
+	/* received messages per BEX_CONN_LOAD_WINDOW, see bex_conn_count_msg() */
+	uint64_t		load_start;	/* current window start (ns) */
+	uint64_t		load_cur;	/* messages in the current window */
+	uint64_t		load_prev;	/* messages in the previous window */
+	unsigned int		lost : 1;	/* connection lost, resubscribe on connect */
 };
 
+static inline void bex_platform_lock(struct libbex_platform *pl)
+{
+	if (pl->threaded)
+		pthread_mutex_lock(&pl->lock);
+}
+
+static inline void bex_platform_unlock(struct libbex_platform *pl)
+{
+	if (pl->threaded)
+		pthread_mutex_unlock(&pl->lock);
+}
+
+static inline void bex_conn_lock(struct libbex_conn *conn)
+{
+	if (conn->pl->threaded)
+		pthread_mutex_lock(&conn->lock);
+}
+
+static inline void bex_conn_unlock(struct libbex_conn *conn)
+{
+	if (conn->pl->threaded)
+		pthread_mutex_unlock(&conn->lock);
+}
+
 /* value.c */
 extern struct libbex_value *__bex_new_value(char *name);
+extern size_t bex_value_type_size(int type);
+
+/* platform.c */
+extern int bex_platform_receive_buffer(struct libbex_platform *pl, const char *buf, size_t len);
+extern int bex_conn_receive_buffer(struct libbex_conn *conn, const char *buf, size_t len,
+				   uint64_t rx_time);
+extern struct libbex_event *bex_platform_get_event_by_span(struct libbex_platform *pl,
+					const char *name, size_t len);
+extern void bex_platform_wakeup(struct libbex_platform *pl);
+
+/* conn.c */
+extern struct libbex_conn *bex_new_conn(struct libbex_platform *pl);
+extern void bex_free_conn(struct libbex_conn *conn);
+extern int bex_conn_index_channel(struct libbex_conn *conn, struct libbex_channel *ch);
+extern void bex_conn_unindex_channel(struct libbex_conn *conn, struct libbex_channel *ch);
+extern void bex_conn_count_msg(struct libbex_conn *conn, uint64_t now);
+extern int bex_conn_assign_channel(struct libbex_conn *conn, struct libbex_channel *ch);
+extern struct libbex_channel *bex_conn_get_channel_by_id(struct libbex_conn *conn, uint64_t id);
+extern struct libbex_conn *bex_platform_assign_channel(struct libbex_platform *pl, struct libbex_channel *ch);
+extern void bex_platform_unassign_channel(struct libbex_platform *pl, struct libbex_channel *ch);
+extern int bex_platform_prepare_connections(struct libbex_platform *pl);
+extern void bex_conn_lost(struct libbex_conn *conn);
+extern void bex_conn_connected(struct libbex_conn *conn);
+extern void bex_conn_failed(struct libbex_conn *conn, int rc);
+extern int bex_conn_can_connect(struct libbex_conn *conn);
+extern unsigned int bex_conn_next_backoff(struct libbex_conn *conn);
+extern int bex_conn_start_thread(struct libbex_conn *conn);
+extern int bex_conn_stop_thread(struct libbex_conn *conn);
+extern struct libbex_ring_msg *bex_conn_reserve_msg(struct libbex_conn *conn);
+extern void bex_conn_commit_msg(struct libbex_conn *conn);
+
+/* ring.c */
+extern struct libbex_ring *bex_new_ring(size_t size);
+extern void bex_free_ring(struct libbex_ring *r);
+extern struct libbex_ring_msg *bex_ring_reserve(struct libbex_ring *r);
+extern void bex_ring_commit(struct libbex_ring *r);
+extern struct libbex_ring_msg *bex_ring_peek(struct libbex_ring *r);
+extern void bex_ring_release(struct libbex_ring *r);
 
 /* wss.c */
-extern int wss_is_connected(struct libbex_platform *pl);
-extern int wss_connect(struct libbex_platform *pl);
-extern int wss_disconnect(struct libbex_platform *pl);
-extern int wss_service(struct libbex_platform *pl);
-extern int wss_send(struct libbex_platform *pl, unsigned char *str, size_t sz);
+extern int wss_is_connected(struct libbex_conn *conn);
+extern int wss_connect(struct libbex_conn *conn);
+extern int wss_disconnect(struct libbex_conn *conn);
+extern int wss_service(struct libbex_conn *conn, int timeout);
+extern int wss_service_all(struct libbex_platform *pl, int timeout);
+extern int wss_send(struct libbex_conn *conn, unsigned char *str, size_t sz);
+extern void wss_cancel_service(struct libbex_conn *conn);
+extern int wss_get_pollfds(struct libbex_platform *pl, struct pollfd *fds, size_t nfds);
+extern int wss_service_fd(struct libbex_platform *pl, int fd, short revents);
+
+/* book.c */
+extern struct libbex_book *bex_new_book(void);
+extern void bex_free_book(struct libbex_book *bk);
+extern void bex_reset_book(struct libbex_book *bk);
+extern struct libbex_rawbook *bex_new_rawbook(void);
+extern void bex_free_rawbook(struct libbex_rawbook *rb);
+extern void bex_reset_rawbook(struct libbex_rawbook *rb);
+extern int bex_rawbook_update(struct libbex_rawbook *rb, uint64_t id, int64_t price, int64_t amount);
+extern const struct libbex_book_order *bex_rawbook_get_order(struct libbex_rawbook *rb, uint64_t id);
+extern uint32_t bex_book_checksum(struct libbex_book *bk);
+
+/* crc32.c */
+extern uint32_t bex_crc32(uint32_t crc, const void *buf, size_t len);
+
+/* capture.c */
+extern struct libbex_capture *bex_new_capture(const char *path, size_t segsize);
+extern void bex_free_capture(struct libbex_capture *cap);
+extern int bex_capture_write(struct libbex_capture *cap, unsigned int conn, int dir,
+			     uint64_t time, const void *data, size_t len);
+
+/* latency.c */
+#define BEX_LATENCY_NTYPES	(BEX_LATENCY_CALLBACK + 1)
+
+struct libbex_latency;
+
+extern struct libbex_latency *bex_new_latency(void);
+extern void bex_free_latency(struct libbex_latency *lt);
+extern void bex_reset_latency(struct libbex_latency *lt);
+extern void bex_latency_update(struct libbex_latency *lt, int type, uint64_t ns);
+extern void bex_latency_update_exchange(struct libbex_latency *lt, uint64_t mts, uint64_t rx_time);
+extern int bex_latency_get_stats(struct libbex_latency *lt, int type,
+				 struct libbex_latency_stats *st);
+
+/* candles.c */
+extern struct libbex_candles *bex_new_candles(void);
+extern void bex_free_candles(struct libbex_candles *cs);
+extern void bex_reset_candles(struct libbex_candles *cs);
+extern int bex_candles_update(struct libbex_candles *cs, const struct libbex_candle *c);
+extern struct libbex_candle *bex_candles_last(struct libbex_candles *cs);
+extern struct libbex_candle *bex_candles_push(struct libbex_candles *cs);
+
+/* bars.c */
+extern struct libbex_barset *bex_new_barset(void);
+extern void bex_free_barset(struct libbex_barset *bs);
+extern int bex_barset_add(struct libbex_barset *bs, int type, long double size);
+extern struct libbex_candles *bex_barset_get(struct libbex_barset *bs, size_t idx);
+extern int bex_barset_update(struct libbex_barset *bs, const struct libbex_trade *tr);
+
+/* batch.c */
+extern struct libbex_batch *bex_new_batch(void);
+extern void bex_free_batch(struct libbex_batch *ba);
+extern int bex_batch_start(struct libbex_batch *ba, struct libbex_array *ar, size_t nrows);
+extern int bex_batch_add_row(struct libbex_batch *ba, struct libbex_array *ar);
+
+/* arena.c */
+extern void bex_init_arena(struct libbex_arena *ar);
+extern void bex_deinit_arena(struct libbex_arena *ar);
+extern void bex_reset_arena(struct libbex_arena *ar);
+extern void *bex_arena_alloc(struct libbex_arena *ar, size_t size);
+extern char *bex_arena_strndup(struct libbex_arena *ar, const char *str, size_t n);
+
+/* hash.c */
+extern uint64_t bex_hash_string(const char *str, size_t len);
+extern void bex_init_hash(struct libbex_hash *h);
+extern void bex_deinit_hash(struct libbex_hash *h);
+extern void bex_reset_hash(struct libbex_hash *h);
+extern int bex_hash_insert(struct libbex_hash *h, uint64_t key, void *data);
+extern void *bex_hash_lookup(const struct libbex_hash *h, uint64_t key);
+extern void *bex_hash_remove(struct libbex_hash *h, uint64_t key);
+
+/* scan.c */
+extern int bex_scan_structurals(const char *str, size_t len, uint64_t *bits);
+
+/* parser.c */
+extern void bex_reset_parser(struct libbex_parser *ps);
+extern void bex_deinit_parser(struct libbex_parser *ps);
+extern int bex_parser_tokenize(struct libbex_parser *ps, const char *str, size_t len);
+extern struct libbex_token *bex_parser_get_token(struct libbex_parser *ps, size_t idx);
+extern ssize_t bex_parser_get_child(struct libbex_parser *ps, size_t idx, size_t n);
+extern ssize_t bex_parser_object_get(struct libbex_parser *ps, size_t idx, const char *key);
+extern int bex_token_streq(struct libbex_parser *ps, struct libbex_token *tk, const char *str);
+extern int bex_token_get_u64(struct libbex_parser *ps, struct libbex_token *tk, uint64_t *num);
+extern int bex_token_get_s64(struct libbex_parser *ps, struct libbex_token *tk, int64_t *num);
+
+/* array.c */
+extern void bex_array_enable_arena(struct libbex_array *ar, int enable);
+extern int bex_array_fill_from_tokens(struct libbex_array *ar, struct libbex_parser *ps, size_t idx);
+extern int bex_array_fill_unnamed_from_tokens(struct libbex_array *ar, struct libbex_parser *ps, size_t idx);
 
 /* event.c */
-extern int bex_is_event_string(const char *str, char **name);
-
-/* channel.h */
-extern int bex_is_channel_string(const char *str, uint64_t *id);
+extern int bex_event_update_reply_from_tokens(struct libbex_event *ev,
+				struct libbex_parser *ps, size_t idx);
+
+/* channel.c */
+extern int bex_channel_process(struct libbex_channel *ch, struct libbex_parser *ps);
+extern int bex_channel_parse_trailer(struct libbex_parser *ps, uint64_t flags,
+				     uint64_t *seq, uint64_t *mts);
+extern void bex_channel_set_status(struct libbex_channel *ch, int status);
+extern int bex_channel_dispatch(struct libbex_platform *pl, struct libbex_ring_msg *msg);
+extern int __bex_channel_add_reply_field(struct libbex_channel *ch, struct libbex_value *va, size_t offset);
 
 #endif /* _LIBBEX_PRIVATE_H */
 
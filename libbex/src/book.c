@@ -0,0 +1,836 @@
+/*
+ * Copyright (C) 2018 Karel Zak <karel.zak.007@gmail.com>
+ *
+ * This file may be redistributed under the terms of the
+ * GNU Lesser General Public License.
+ */
+
+/**
+ * SECTION: book
+ * @title: Order book
+ * @short_description: in-memory price-level book
+ *
+ * The book keeps price levels for bids and asks. Each side is a contiguous
+ * array sorted by price, the best price is at the end of the array, so the
+ * most frequent updates (near the top of the book) move only a few levels.
+ * The levels are also indexed by price. The index is only a hint, it is not
+ * updated for the levels moved by insert or remove. A moved level is found
+ * by binary search and its hint is fixed, so the update of an existing level
+ * is usually O(1) and never worse than O(log n).
+ *
+ * The prices and amounts are fixed-point numbers with BEX_BOOK_SCALE
+ * decimal places.
+ *
+ * The book checksum (CRC-32 of the top 25 levels) is verified against the
+ * exchange checksum frames. The formatted levels are cached, so only the
+ * changed levels are formatted again.
+ */
+#include "bexP.h"
+
+#define BEX_BOOK_MINLEVELS	32
+
+/* hash data cannot be NULL, so store index + 1 */
+#define idx_to_ptr(_i)		((void *) (uintptr_t) ((_i) + 1))
+#define ptr_to_idx(_p)		((size_t) (uintptr_t) (_p) - 1)
+
+struct libbex_book *bex_new_book(void)
+{
+	struct libbex_book *bk = calloc(1, sizeof(*bk));
+
+	if (!bk)
+		return NULL;
+
+	DBG(BOOK, bex_debugobj(bk, "alloc"));
+	bex_init_hash(&bk->sides[BEX_BOOK_BIDS].prices);
+	bex_init_hash(&bk->sides[BEX_BOOK_ASKS].prices);
+	return bk;
+}
+
+void bex_free_book(struct libbex_book *bk)
+{
+	size_t i;
+
+	if (!bk)
+		return;
+
+	DBG(BOOK, bex_debugobj(bk, "free"));
+	for (i = 0; i < ARRAY_SIZE(bk->sides); i++) {
+		free(bk->sides[i].levels);
+		bex_deinit_hash(&bk->sides[i].prices);
+	}
+	free(bk);
+}
+
+/* Removes all levels, the memory is kept for reuse. */
+void bex_reset_book(struct libbex_book *bk)
+{
+	size_t i;
+
+	DBG(BOOK, bex_debugobj(bk, "reset"));
+	for (i = 0; i < ARRAY_SIZE(bk->sides); i++) {
+		struct libbex_book_side *sd = &bk->sides[i];
+
+		sd->nlevels = 0;
+		bex_reset_hash(&sd->prices);
+	}
+	bk->cs_changed = 1;
+}
+
+/* is price @a worse than price @b on side @side */
+static inline int is_worse(int side, int64_t a, int64_t b)
+{
+	return side == BEX_BOOK_BIDS ? a < b : a > b;
+}
+
+/* returns position for the new price in the sorted array */
+static size_t find_position(struct libbex_book_side *sd, int side, int64_t price)
+{
+	size_t lo = 0, hi = sd->nlevels;
+
+	/* the best levels are at the end, so try it first */
+	if (!hi || is_worse(side, sd->levels[hi - 1].price, price))
+		return hi;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (is_worse(side, sd->levels[mid].price, price))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* returns index of the level with @price or -1 */
+static ssize_t lookup_level(struct libbex_book_side *sd, int side, int64_t price)
+{
+	void *p = bex_hash_lookup(&sd->prices, (uint64_t) price);
+	size_t i;
+
+	if (!p)
+		return -1;
+
+	i = ptr_to_idx(p);
+	if (i < sd->nlevels && sd->levels[i].price == price)
+		return i;
+
+	/* the level has been moved, fix the hint (failure is harmless) */
+	i = find_position(sd, side, price);
+	bex_hash_insert(&sd->prices, (uint64_t) price, idx_to_ptr(i));
+	return i;
+}
+
+/* the level at @pos is within the checksum depth */
+static inline void mark_changed(struct libbex_book *bk, struct libbex_book_side *sd, size_t pos)
+{
+	if (sd->nlevels - pos <= BEX_BOOK_CHECKSUM_DEPTH)
+		bk->cs_changed = 1;
+}
+
+static int insert_level(struct libbex_book *bk, struct libbex_book_side *sd, int side,
+			const struct libbex_book_level *lv)
+{
+	size_t pos;
+
+	if (sd->nlevels == sd->nalloc) {
+		size_t newsz = sd->nalloc ? sd->nalloc * 2 : BEX_BOOK_MINLEVELS;
+		void *tmp = realloc(sd->levels, newsz * sizeof(struct libbex_book_level));
+
+		if (!tmp)
+			return -ENOMEM;
+		sd->levels = tmp;
+		sd->nalloc = newsz;
+	}
+
+	pos = find_position(sd, side, lv->price);
+	if (pos < sd->nlevels)
+		memmove(&sd->levels[pos + 1], &sd->levels[pos],
+			(sd->nlevels - pos) * sizeof(struct libbex_book_level));
+	sd->levels[pos] = *lv;
+	sd->nlevels++;
+	mark_changed(bk, sd, pos);
+
+	return bex_hash_insert(&sd->prices, (uint64_t) lv->price, idx_to_ptr(pos));
+}
+
+static int remove_level(struct libbex_book *bk, struct libbex_book_side *sd, size_t pos)
+{
+	mark_changed(bk, sd, pos);
+	bex_hash_remove(&sd->prices, (uint64_t) sd->levels[pos].price);
+
+	if (pos + 1 < sd->nlevels)
+		memmove(&sd->levels[pos], &sd->levels[pos + 1],
+			(sd->nlevels - pos - 1) * sizeof(struct libbex_book_level));
+	sd->nlevels--;
+	return 0;
+}
+
+/**
+ * bex_book_set_level:
+ * @bk: book
+ * @side: BEX_BOOK_BIDS or BEX_BOOK_ASKS
+ * @lv: new level
+ *
+ * Adds or updates the level, the level with zero count is removed.
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_book_set_level(struct libbex_book *bk, int side,
+		       const struct libbex_book_level *lv)
+{
+	struct libbex_book_side *sd;
+	ssize_t i;
+
+	if (!bk || !lv || (side != BEX_BOOK_BIDS && side != BEX_BOOK_ASKS))
+		return -EINVAL;
+
+	sd = &bk->sides[side];
+	i = lookup_level(sd, side, lv->price);
+
+	if (!lv->count)
+		return i >= 0 ? remove_level(bk, sd, i) : 0;
+	if (i >= 0) {
+		sd->levels[i] = *lv;
+		mark_changed(bk, sd, i);
+		return 0;
+	}
+	return insert_level(bk, sd, side, lv);
+}
+
+/**
+ * bex_book_get_depth:
+ * @bk: book
+ * @side: BEX_BOOK_BIDS or BEX_BOOK_ASKS
+ *
+ * Returns: number of price levels.
+ */
+size_t bex_book_get_depth(struct libbex_book *bk, int side)
+{
+	if (!bk || (side != BEX_BOOK_BIDS && side != BEX_BOOK_ASKS))
+		return 0;
+	return bk->sides[side].nlevels;
+}
+
+/**
+ * bex_book_get_level:
+ * @bk: book
+ * @side: BEX_BOOK_BIDS or BEX_BOOK_ASKS
+ * @n: level number, 0 is the best price
+ *
+ * Returns: level or NULL.
+ */
+const struct libbex_book_level *bex_book_get_level(struct libbex_book *bk, int side, size_t n)
+{
+	struct libbex_book_side *sd;
+
+	if (!bk || (side != BEX_BOOK_BIDS && side != BEX_BOOK_ASKS))
+		return NULL;
+
+	sd = &bk->sides[side];
+	return n < sd->nlevels ? &sd->levels[sd->nlevels - 1 - n] : NULL;
+}
+
+/**
+ * bex_book_get_price_level:
+ * @bk: book
+ * @side: BEX_BOOK_BIDS or BEX_BOOK_ASKS
+ * @price: price (BEX_BOOK_SCALE)
+ *
+ * Returns: level or NULL.
+ */
+const struct libbex_book_level *bex_book_get_price_level(struct libbex_book *bk,
+						int side, int64_t price)
+{
+	struct libbex_book_side *sd;
+	ssize_t i;
+
+	if (!bk || (side != BEX_BOOK_BIDS && side != BEX_BOOK_ASKS))
+		return NULL;
+
+	sd = &bk->sides[side];
+	i = lookup_level(sd, side, price);
+	return i >= 0 ? &sd->levels[i] : NULL;
+}
+
+/*
+ * Formats the fixed-point number as the exchange (JavaScript) does: no
+ * trailing zeros, exponent for the numbers smaller than 1e-6.
+ */
+static size_t format_number(char *buf, int64_t x)
+{
+	uint64_t u = x < 0 ? -(uint64_t) x : (uint64_t) x;
+	char digits[24], *p = buf;
+	int exp = -BEX_BOOK_SCALE, n, i;
+
+	if (x < 0)
+		*p++ = '-';
+	if (u == 0) {
+		*p++ = '0';
+		return p - buf;
+	}
+	while (u % 10 == 0) {
+		u /= 10;
+		exp++;
+	}
+	n = snprintf(digits, sizeof(digits), "%ju", (uintmax_t) u);
+
+	if (exp >= 0) {				/* integer */
+		memcpy(p, digits, n);
+		p += n;
+		while (exp-- > 0)
+			*p++ = '0';
+	} else if (n + exp > 0) {		/* 123.45 */
+		memcpy(p, digits, n + exp);
+		p += n + exp;
+		*p++ = '.';
+		memcpy(p, digits + n + exp, -exp);
+		p += -exp;
+	} else if (n - 1 + exp >= -6) {		/* 0.00123 */
+		*p++ = '0';
+		*p++ = '.';
+		for (i = 0; i < -(n + exp); i++)
+			*p++ = '0';
+		memcpy(p, digits, n);
+		p += n;
+	} else {				/* 1.5e-7 */
+		*p++ = digits[0];
+		if (n > 1) {
+			*p++ = '.';
+			memcpy(p, digits + 1, n - 1);
+			p += n - 1;
+		}
+		p += sprintf(p, "e-%d", -(n - 1 + exp));
+	}
+	return p - buf;
+}
+
+/* returns "price:amount" of the level, the string is cached */
+static const struct libbex_book_cslevel *cslevel(struct libbex_book *bk, int side, size_t n)
+{
+	const struct libbex_book_level *lv = bex_book_get_level(bk, side, n);
+	struct libbex_book_cslevel *cs;
+
+	if (!lv)
+		return NULL;
+
+	cs = &bk->cslevels[side][n];
+	if (!cs->len || cs->price != lv->price || cs->amount != lv->amount) {
+		cs->price = lv->price;
+		cs->amount = lv->amount;
+		cs->len = format_number(cs->str, lv->price);
+		cs->str[cs->len++] = ':';
+		cs->len += format_number(cs->str + cs->len, lv->amount);
+	}
+	return cs;
+}
+
+/*
+ * CRC-32 of "bid:amount:ask:amount:..." for the top 25 levels, it's
+ * recalculated only if the top levels changed.
+ */
+uint32_t bex_book_checksum(struct libbex_book *bk)
+{
+	uint32_t crc = 0;
+	size_t n, len = 0;
+
+	if (!bk->cs_changed)
+		return bk->checksum;
+
+	for (n = 0; n < BEX_BOOK_CHECKSUM_DEPTH; n++) {
+		const struct libbex_book_cslevel *cs[2] = {
+			cslevel(bk, BEX_BOOK_BIDS, n),
+			cslevel(bk, BEX_BOOK_ASKS, n)
+		};
+		size_t i;
+
+		if (!cs[0] && !cs[1])
+			break;
+		for (i = 0; i < 2; i++) {
+			if (!cs[i])
+				continue;
+			if (len++)
+				crc = bex_crc32(crc, ":", 1);
+			crc = bex_crc32(crc, cs[i]->str, cs[i]->len);
+		}
+	}
+
+	DBG(BOOK, bex_debugobj(bk, "checksum %d", (int32_t) crc));
+	bk->checksum = crc;
+	bk->cs_changed = 0;
+	return crc;
+}
+
+/*
+ * Raw book -- individual orders indexed by order ID, the price levels are
+ * aggregated into the book. The order nodes are allocated in chunks and
+ * reused, so there is no allocation per update.
+ */
+#define BEX_RAWBOOK_CHUNKSIZ	1024
+
+struct rawbook_node {
+	struct libbex_book_order	order;
+	struct rawbook_node		*next;		/* free list */
+};
+
+struct rawbook_chunk {
+	struct rawbook_chunk	*next;
+	struct rawbook_node	nodes[BEX_RAWBOOK_CHUNKSIZ];
+};
+
+struct libbex_rawbook *bex_new_rawbook(void)
+{
+	struct libbex_rawbook *rb = calloc(1, sizeof(*rb));
+
+	if (!rb)
+		return NULL;
+
+	DBG(BOOK, bex_debugobj(rb, "alloc raw book"));
+	rb->book = bex_new_book();
+	if (!rb->book) {
+		free(rb);
+		return NULL;
+	}
+	bex_init_hash(&rb->orders);
+	return rb;
+}
+
+void bex_free_rawbook(struct libbex_rawbook *rb)
+{
+	if (!rb)
+		return;
+
+	DBG(BOOK, bex_debugobj(rb, "free raw book"));
+	while (rb->chunks) {
+		struct rawbook_chunk *ck = rb->chunks;
+
+		rb->chunks = ck->next;
+		free(ck);
+	}
+	bex_deinit_hash(&rb->orders);
+	bex_free_book(rb->book);
+	free(rb);
+}
+
+/* Removes all orders, the nodes are kept for reuse. */
+void bex_reset_rawbook(struct libbex_rawbook *rb)
+{
+	size_t i;
+
+	DBG(BOOK, bex_debugobj(rb, "reset raw book [orders=%zu]", rb->orders.count));
+	for (i = 0; i < rb->orders.size; i++) {
+		struct rawbook_node *nd = rb->orders.ents[i].data;
+
+		if (nd) {
+			nd->next = rb->free_nodes;
+			rb->free_nodes = nd;
+		}
+	}
+	bex_reset_hash(&rb->orders);
+	bex_reset_book(rb->book);
+}
+
+static struct rawbook_node *alloc_node(struct libbex_rawbook *rb)
+{
+	struct rawbook_node *nd;
+
+	if (!rb->free_nodes) {
+		struct rawbook_chunk *ck = malloc(sizeof(*ck));
+		size_t i;
+
+		if (!ck)
+			return NULL;
+
+		DBG(BOOK, bex_debugobj(rb, "new nodes chunk"));
+		ck->next = rb->chunks;
+		rb->chunks = ck;
+		for (i = 0; i < BEX_RAWBOOK_CHUNKSIZ; i++) {
+			ck->nodes[i].next = rb->free_nodes;
+			rb->free_nodes = &ck->nodes[i];
+		}
+	}
+
+	nd = rb->free_nodes;
+	rb->free_nodes = nd->next;
+	nd->next = NULL;
+	return nd;
+}
+
+static void free_node(struct libbex_rawbook *rb, struct rawbook_node *nd)
+{
+	nd->next = rb->free_nodes;
+	rb->free_nodes = nd;
+}
+
+/* adds (or removes for @sign < 0) the order to the aggregated level */
+static int aggregate(struct libbex_rawbook *rb, const struct libbex_book_order *o, int sign)
+{
+	int side = o->amount > 0 ? BEX_BOOK_BIDS : BEX_BOOK_ASKS;
+	const struct libbex_book_level *cur = bex_book_get_price_level(rb->book, side, o->price);
+	struct libbex_book_level lv = { .price = o->price };
+
+	if (cur)
+		lv = *cur;
+	if (sign > 0) {
+		lv.amount += o->amount;
+		lv.count++;
+	} else if (lv.count) {
+		lv.amount -= o->amount;
+		lv.count--;
+	}
+	return bex_book_set_level(rb->book, side, &lv);
+}
+
+/**
+ * bex_rawbook_update:
+ * @rb: raw book
+ * @id: order ID
+ * @price: price (BEX_BOOK_SCALE), zero to remove the order
+ * @amount: amount (BEX_BOOK_SCALE), negative for asks
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_rawbook_update(struct libbex_rawbook *rb, uint64_t id, int64_t price, int64_t amount)
+{
+	struct rawbook_node *nd;
+	int rc;
+
+	if (!price) {
+		nd = bex_hash_remove(&rb->orders, id);
+		if (!nd)
+			return 0;
+		rc = aggregate(rb, &nd->order, -1);
+		free_node(rb, nd);
+		return rc;
+	}
+
+	nd = bex_hash_lookup(&rb->orders, id);
+	if (nd) {
+		rc = aggregate(rb, &nd->order, -1);
+		if (rc)
+			return rc;
+	} else {
+		nd = alloc_node(rb);
+		if (!nd)
+			return -ENOMEM;
+		rc = bex_hash_insert(&rb->orders, id, nd);
+		if (rc) {
+			free_node(rb, nd);
+			return rc;
+		}
+		nd->order.id = id;
+	}
+
+	nd->order.price = price;
+	nd->order.amount = amount;
+	return aggregate(rb, &nd->order, 1);
+}
+
+/**
+ * bex_rawbook_get_order:
+ * @rb: raw book
+ * @id: order ID
+ *
+ * Returns: order or NULL.
+ */
+const struct libbex_book_order *bex_rawbook_get_order(struct libbex_rawbook *rb, uint64_t id)
+{
+	struct rawbook_node *nd = bex_hash_lookup(&rb->orders, id);
+
+	return nd ? &nd->order : NULL;
+}
+
+#ifdef TEST_PROGRAM_BOOK
+#define NPRICES		512
+#define PRICE(_t)	((int64_t) (100000 + (_t)) * 1000000)	/* 1000.00 + t/100 */
+
+/* reference book, level @t of the side has price PRICE(t) */
+static struct libbex_book_level model[2][NPRICES];
+
+/* n-th best tick of the side in the model or -1 */
+static int model_tick(int side, size_t n)
+{
+	int i;
+
+	for (i = 0; i < NPRICES; i++) {
+		int t = side == BEX_BOOK_BIDS ? NPRICES - 1 - i : i;
+
+		if (model[side][t].count && n-- == 0)
+			return t;
+	}
+	return -1;
+}
+
+/* plain formatter, good enough for the numbers >= 1e-6 */
+static size_t ref_format(char *buf, int64_t x)
+{
+	uint64_t u = x < 0 ? -(uint64_t) x : (uint64_t) x;
+	uint64_t frac = u % 100000000;
+	size_t n = sprintf(buf, "%s%ju", x < 0 ? "-" : "", (uintmax_t) (u / 100000000));
+
+	if (frac) {
+		n += sprintf(buf + n, ".%08ju", (uintmax_t) frac);
+		while (buf[n - 1] == '0')
+			n--;
+	}
+	buf[n] = '\0';
+	return n;
+}
+
+static uint32_t model_checksum(void)
+{
+	char buf[2 * BEX_BOOK_CHECKSUM_DEPTH * 64];
+	size_t n, len = 0;
+	int side;
+
+	for (n = 0; n < BEX_BOOK_CHECKSUM_DEPTH; n++) {
+		for (side = 0; side < 2; side++) {
+			int t = model_tick(side, n);
+
+			if (t < 0)
+				continue;
+			if (len)
+				buf[len++] = ':';
+			len += ref_format(buf + len, PRICE(t));
+			buf[len++] = ':';
+			len += ref_format(buf + len, model[side][t].amount);
+		}
+	}
+	return bex_crc32(0, buf, len);
+}
+
+static int check_book(struct libbex_book *bk)
+{
+	int side, t;
+
+	for (side = 0; side < 2; side++) {
+		size_t n, depth = 0;
+
+		for (t = 0; t < NPRICES; t++) {
+			const struct libbex_book_level *lv =
+				bex_book_get_price_level(bk, side, PRICE(t));
+
+			if (!model[side][t].count) {
+				if (lv) {
+					fprintf(stderr, "%d/%d: removed level found\n", side, t);
+					return -1;
+				}
+				continue;
+			}
+			depth++;
+			if (!lv || memcmp(lv, &model[side][t], sizeof(*lv)) != 0) {
+				fprintf(stderr, "%d/%d: price lookup mismatch\n", side, t);
+				return -1;
+			}
+		}
+		if (bex_book_get_depth(bk, side) != depth) {
+			fprintf(stderr, "%d: depth %zu, expected %zu\n", side,
+				bex_book_get_depth(bk, side), depth);
+			return -1;
+		}
+		for (n = 0; n < depth; n++) {
+			const struct libbex_book_level *lv = bex_book_get_level(bk, side, n);
+
+			t = model_tick(side, n);
+			if (!lv || memcmp(lv, &model[side][t], sizeof(*lv)) != 0) {
+				fprintf(stderr, "%d: level %zu mismatch\n", side, n);
+				return -1;
+			}
+		}
+		if (bex_book_get_level(bk, side, depth)) {
+			fprintf(stderr, "%d: level behind the depth\n", side);
+			return -1;
+		}
+	}
+	if (bex_book_checksum(bk) != model_checksum()) {
+		fprintf(stderr, "checksum mismatch\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* random inserts, updates and deletes */
+static int test_book_levels(void)
+{
+	struct libbex_book *bk = bex_new_book();
+	int i, rc = EXIT_SUCCESS;
+
+	memset(model, 0, sizeof(model));
+	srand(42);
+
+	for (i = 0; i < 50000 && rc == EXIT_SUCCESS; i++) {
+		int side = rand() % 2, t = rand() % NPRICES;
+		struct libbex_book_level lv = {
+			.price = PRICE(t),
+			.count = rand() % 4,
+			.amount = (int64_t) (1 + rand() % 100000) * 10000
+		};
+
+		/* the top of the book is updated more often */
+		if (i % 2 && model_tick(side, 0) >= 0)
+			lv.price = PRICE(t = model_tick(side, rand() % 8 ? 0 : 1));
+		if (side == BEX_BOOK_ASKS)
+			lv.amount = -lv.amount;
+
+		if (bex_book_set_level(bk, side, &lv) != 0)
+			rc = EXIT_FAILURE;
+		if (lv.count)
+			model[side][t] = lv;
+		else
+			memset(&model[side][t], 0, sizeof(lv));
+
+		if ((i % 97 == 0 || i < 1000) && check_book(bk) != 0)
+			rc = EXIT_FAILURE;
+	}
+	if (rc == EXIT_SUCCESS && check_book(bk) != 0)
+		rc = EXIT_FAILURE;
+
+	bex_reset_book(bk);
+	memset(model, 0, sizeof(model));
+	if (rc == EXIT_SUCCESS && check_book(bk) != 0)
+		rc = EXIT_FAILURE;
+
+	bex_free_book(bk);
+	return rc;
+}
+
+/* exchange number format and the CRC-32 of the top levels */
+static int test_book_checksum(void)
+{
+	static const struct {
+		int side;
+		struct libbex_book_level lv;
+		const char *str;
+	} levels[] = {
+		{ BEX_BOOK_BIDS, { 654510000000, 250000000, 1 }, "6545.1:2.5" },
+		{ BEX_BOOK_BIDS, { 654500000000, 15,        2 }, "6545:1.5e-7" },
+		{ BEX_BOOK_ASKS, { 654520000000, -100000000, 1 }, "6545.2:-1" },
+		{ BEX_BOOK_ASKS, { 654600000000, -100,      3 }, "6546:-0.000001" },
+	};
+	struct libbex_book *bk = bex_new_book();
+	struct libbex_book_level lv;
+	uint32_t crc;
+	size_t i;
+	int rc = EXIT_SUCCESS;
+
+	for (i = 0; i < ARRAY_SIZE(levels); i++)
+		bex_book_set_level(bk, levels[i].side, &levels[i].lv);
+
+	for (i = 0; i < ARRAY_SIZE(levels); i++) {
+		const struct libbex_book_cslevel *cs = cslevel(bk, levels[i].side, i % 2);
+
+		if (!cs || strcmp(cs->str, levels[i].str) != 0) {
+			fprintf(stderr, "level %zu: got '%s', expected '%s'\n",
+				i, cs ? cs->str : "", levels[i].str);
+			rc = EXIT_FAILURE;
+		}
+	}
+
+	/* zlib.crc32(b"6545.1:2.5:6545.2:-1:6545:1.5e-7:6546:-0.000001") */
+	crc = bex_book_checksum(bk);
+	if (crc != 0xa4386d40) {
+		fprintf(stderr, "checksum %08x, expected a4386d40\n", crc);
+		rc = EXIT_FAILURE;
+	}
+
+	/* the cached strings have to follow the changes */
+	lv = levels[0].lv;
+	lv.amount = 300000000;
+	bex_book_set_level(bk, BEX_BOOK_BIDS, &lv);
+	if (bex_book_checksum(bk) == crc) {
+		fprintf(stderr, "checksum not updated\n");
+		rc = EXIT_FAILURE;
+	}
+	lv.amount = levels[0].lv.amount;
+	bex_book_set_level(bk, BEX_BOOK_BIDS, &lv);
+	if (bex_book_checksum(bk) != crc) {
+		fprintf(stderr, "checksum not restored\n");
+		rc = EXIT_FAILURE;
+	}
+
+	bex_free_book(bk);
+	return rc;
+}
+
+/* random orders, the aggregated levels have to match the orders */
+static int test_rawbook(void)
+{
+	static struct libbex_book_order orders[2048];
+	struct libbex_rawbook *rb = bex_new_rawbook();
+	int i, rc = EXIT_SUCCESS;
+
+	memset(orders, 0, sizeof(orders));
+	srand(42);
+
+	for (i = 0; i < 50000 && rc == EXIT_SUCCESS; i++) {
+		size_t id = rand() % ARRAY_SIZE(orders);
+		int64_t price = rand() % 5 ? PRICE(rand() % 64) : 0;
+		int64_t amount = (int64_t) (1 + rand() % 1000) * 10000;
+
+		/* bids below asks */
+		if (price && price >= PRICE(32))
+			amount = -amount;
+
+		if (bex_rawbook_update(rb, id + 1, price, amount) != 0)
+			rc = EXIT_FAILURE;
+		orders[id].id = price ? id + 1 : 0;
+		orders[id].price = price;
+		orders[id].amount = price ? amount : 0;
+
+		if (i % 101 == 0) {
+			size_t n;
+			int t;
+
+			memset(model, 0, sizeof(model));
+			for (n = 0; n < ARRAY_SIZE(orders); n++) {
+				const struct libbex_book_order *o =
+					bex_rawbook_get_order(rb, n + 1);
+				int side = orders[n].amount > 0 ? BEX_BOOK_BIDS : BEX_BOOK_ASKS;
+
+				if (!orders[n].price) {
+					if (o)
+						rc = EXIT_FAILURE;
+					continue;
+				}
+				if (!o || memcmp(o, &orders[n], sizeof(*o)) != 0) {
+					fprintf(stderr, "order %zu mismatch\n", n + 1);
+					rc = EXIT_FAILURE;
+				}
+				t = orders[n].price / 1000000 - 100000;
+				model[side][t].price = orders[n].price;
+				model[side][t].amount += orders[n].amount;
+				model[side][t].count++;
+			}
+			if (check_book(rb->book) != 0)
+				rc = EXIT_FAILURE;
+		}
+	}
+
+	bex_reset_rawbook(rb);
+	memset(model, 0, sizeof(model));
+	if (rc == EXIT_SUCCESS && (check_book(rb->book) != 0 ||
+				   bex_rawbook_get_order(rb, 1)))
+		rc = EXIT_FAILURE;
+
+	bex_free_rawbook(rb);
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 2 && strcmp(argv[1], "--levels") == 0)
+		return test_book_levels();
+	if (argc == 2 && strcmp(argv[1], "--checksum") == 0)
+		return test_book_checksum();
+	if (argc == 2 && strcmp(argv[1], "--rawbook") == 0)
+		return test_rawbook();
+	if (argc == 1)
+		return test_book_levels() == EXIT_SUCCESS &&
+		       test_book_checksum() == EXIT_SUCCESS &&
+		       test_rawbook() == EXIT_SUCCESS ?
+				EXIT_SUCCESS : EXIT_FAILURE;
+
+	fprintf(stderr, "usage: %s [--levels | --checksum | --rawbook]\n", argv[0]);
+	exit(EXIT_FAILURE);
+}
+#endif /* TEST_PROGRAM_BOOK */
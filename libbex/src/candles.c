@@ -0,0 +1,341 @@
+/*
+ * Copyright (C) 2018 Karel Zak <karel.zak.007@gmail.com>
+ *
+ * This file may be redistributed under the terms of the
+ * GNU Lesser General Public License.
+ */
+
+/**
+ * SECTION: candles
+ * @title: Candles
+ * @short_description: history of candles
+ *
+ * The candles are stored in a fixed-size ring buffer sorted by time. The
+ * candles are updated in place, the oldest candle is overwritten by a new
+ * candle if the buffer is full. An older candle missing in the buffer is
+ * inserted in order. The candle number 0 is always the newest candle.
+ */
+#include "bexP.h"
+
+#define BEX_CANDLES_SIZE	1024	/* must be power of 2 */
+
+struct libbex_candles *bex_new_candles(void)
+{
+	struct libbex_candles *cs = calloc(1, sizeof(*cs));
+
+	if (!cs)
+		return NULL;
+
+	cs->ring = calloc(BEX_CANDLES_SIZE, sizeof(struct libbex_candle));
+	if (!cs->ring) {
+		free(cs);
+		return NULL;
+	}
+	cs->size = BEX_CANDLES_SIZE;
+
+	DBG(CHAN, bex_debugobj(cs, "alloc candles"));
+	return cs;
+}
+
+void bex_free_candles(struct libbex_candles *cs)
+{
+	if (!cs)
+		return;
+
+	DBG(CHAN, bex_debugobj(cs, "free candles"));
+	free(cs->ring);
+	free(cs);
+}
+
+void bex_reset_candles(struct libbex_candles *cs)
+{
+	cs->head = 0;
+	cs->count = 0;
+}
+
+/* returns ring index of the candle @n (0 is the oldest) */
+static inline size_t ring_index(struct libbex_candles *cs, size_t n)
+{
+	return (cs->head + n) & (cs->size - 1);
+}
+
+/* returns the newest candle */
+struct libbex_candle *bex_candles_last(struct libbex_candles *cs)
+{
+	return cs->count ? &cs->ring[ring_index(cs, cs->count - 1)] : NULL;
+}
+
+/* adds a new zeroized newest candle, the oldest is overwritten if full */
+struct libbex_candle *bex_candles_push(struct libbex_candles *cs)
+{
+	struct libbex_candle *c;
+
+	if (cs->count == cs->size)
+		cs->head = ring_index(cs, 1);
+	else
+		cs->count++;
+
+	c = &cs->ring[ring_index(cs, cs->count - 1)];
+	memset(c, 0, sizeof(*c));
+	return c;
+}
+
+/* returns the oldest candle with mts >= @mts or cs->count */
+static size_t find_candle(struct libbex_candles *cs, uint64_t mts)
+{
+	size_t lo = 0, hi = cs->count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (cs->ring[ring_index(cs, mid)].mts < mts)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Adds or updates the candle. The new candles are usually added to the end
+ * (updates), or to the begin (snapshot is sorted from the newest).
+ */
+int bex_candles_update(struct libbex_candles *cs, const struct libbex_candle *c)
+{
+	struct libbex_candle *last;
+	size_t i, n;
+
+	if (!cs->count) {
+		cs->ring[cs->head] = *c;
+		cs->count = 1;
+		return 0;
+	}
+
+	last = &cs->ring[ring_index(cs, cs->count - 1)];
+	if (c->mts == last->mts) {
+		*last = *c;
+		return 0;
+	}
+
+	/* new candle, overwrite the oldest if necessary */
+	if (c->mts > last->mts) {
+		*bex_candles_push(cs) = *c;
+		return 0;
+	}
+
+	/* older candle */
+	n = find_candle(cs, c->mts);
+	if (n < cs->count && cs->ring[ring_index(cs, n)].mts == c->mts) {
+		cs->ring[ring_index(cs, n)] = *c;
+		return 0;
+	}
+	if (cs->count == cs->size) {
+		if (n == 0) {
+			DBG(CHAN, bex_debugobj(cs, "ignore too old candle %ju",
+						(uintmax_t) c->mts));
+			return 0;
+		}
+		/* evict the oldest */
+		cs->head = ring_index(cs, 1);
+		cs->count--;
+		n--;
+	}
+
+	/* insert to the gap, move the shorter part of the buffer */
+	if (n < cs->count - n) {
+		cs->head = ring_index(cs, cs->size - 1);
+		for (i = 0; i < n; i++)
+			cs->ring[ring_index(cs, i)] = cs->ring[ring_index(cs, i + 1)];
+	} else {
+		for (i = cs->count; i > n; i--)
+			cs->ring[ring_index(cs, i)] = cs->ring[ring_index(cs, i - 1)];
+	}
+	cs->count++;
+	cs->ring[ring_index(cs, n)] = *c;
+	return 0;
+}
+
+/**
+ * bex_candles_get_count:
+ * @cs: candles
+ *
+ * Returns: number of candles.
+ */
+size_t bex_candles_get_count(struct libbex_candles *cs)
+{
+	return cs ? cs->count : 0;
+}
+
+/**
+ * bex_candles_get:
+ * @cs: candles
+ * @n: candle number, 0 is the newest candle
+ *
+ * The candle is valid until the next channel update.
+ *
+ * Returns: candle or NULL.
+ */
+const struct libbex_candle *bex_candles_get(struct libbex_candles *cs, size_t n)
+{
+	if (!cs || n >= cs->count)
+		return NULL;
+	return &cs->ring[ring_index(cs, cs->count - 1 - n)];
+}
+
+/**
+ * bex_candles_get_spans:
+ * @cs: candles
+ * @n: number of the newest candles
+ * @a: returns the first (older) part
+ * @na: returns number of candles in @a
+ * @b: returns the second (newer) part or NULL
+ * @nb: returns number of candles in @b
+ *
+ * Returns the last @n candles without copying. The ring buffer is contiguous
+ * only until the end of the buffer, so the candles are returned in two parts,
+ * both are sorted from the oldest.
+ *
+ * Returns: number of candles (@na + @nb).
+ */
+size_t bex_candles_get_spans(struct libbex_candles *cs, size_t n,
+			     const struct libbex_candle **a, size_t *na,
+			     const struct libbex_candle **b, size_t *nb)
+{
+	size_t first;
+
+	if (!cs || !a || !na || !b || !nb)
+		return 0;
+	if (n > cs->count)
+		n = cs->count;
+
+	first = ring_index(cs, cs->count - n);
+	*a = n ? &cs->ring[first] : NULL;
+	*na = min(n, cs->size - first);
+	*b = *na < n ? cs->ring : NULL;
+	*nb = n - *na;
+	return n;
+}
+
+#ifdef TEST_PROGRAM_CANDLES
+#define NSLOTS		(3 * BEX_CANDLES_SIZE)
+#define SLOT_MTS(_k)	((uint64_t) ((_k) + 1) * 60000)
+
+/* reference: the last close for every minute or 0 */
+static long double model[NSLOTS];
+
+/* the buffer has to contain the newest cs->size candles of the model */
+static int check_candles(struct libbex_candles *cs)
+{
+	const struct libbex_candle *a, *b;
+	size_t n = 0, na, nb;
+	int k;
+
+	for (k = NSLOTS - 1; k >= 0 && n < cs->size; k--) {
+		const struct libbex_candle *c;
+
+		if (!model[k])
+			continue;
+		c = bex_candles_get(cs, n);
+		if (!c || c->mts != SLOT_MTS(k) || c->close != model[k]) {
+			fprintf(stderr, "candle %zu: mismatch\n", n);
+			return -1;
+		}
+		n++;
+	}
+	if (bex_candles_get_count(cs) != n || bex_candles_get(cs, n)) {
+		fprintf(stderr, "count %zu, expected %zu\n",
+				bex_candles_get_count(cs), n);
+		return -1;
+	}
+
+	/* spans are sorted from the oldest */
+	if (bex_candles_get_spans(cs, n, &a, &na, &b, &nb) != n || na + nb != n) {
+		fprintf(stderr, "bad spans\n");
+		return -1;
+	}
+	for (k = 0; (size_t) k < n; k++) {
+		const struct libbex_candle *c = (size_t) k < na ? &a[k] : &b[k - na];
+
+		if (c != bex_candles_get(cs, n - 1 - k)) {
+			fprintf(stderr, "span candle %d mismatch\n", k);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int update_candle(struct libbex_candles *cs, int k, long double close)
+{
+	struct libbex_candle c = { .mts = SLOT_MTS(k), .close = close };
+
+	/* too old candles are ignored, but they are not in the newest anyway */
+	model[k] = close;
+	return bex_candles_update(cs, &c);
+}
+
+/* the newest candles, the oldest are overwritten */
+static int test_candles_ring(void)
+{
+	struct libbex_candles *cs = bex_new_candles();
+	int k, rc = EXIT_SUCCESS;
+
+	memset(model, 0, sizeof(model));
+
+	for (k = 0; k < NSLOTS && rc == EXIT_SUCCESS; k++) {
+		if (update_candle(cs, k, k + 1) != 0 || check_candles(cs) != 0)
+			rc = EXIT_FAILURE;
+		/* update of the newest candle */
+		if (update_candle(cs, k, k + 0.5) != 0 || check_candles(cs) != 0)
+			rc = EXIT_FAILURE;
+	}
+
+	/* update of an older candle, the buffer wraps around */
+	k = NSLOTS - BEX_CANDLES_SIZE / 2;
+	if (rc == EXIT_SUCCESS && (update_candle(cs, k, 42) != 0 || check_candles(cs) != 0))
+		rc = EXIT_FAILURE;
+
+	bex_reset_candles(cs);
+	memset(model, 0, sizeof(model));
+	if (rc == EXIT_SUCCESS && check_candles(cs) != 0)
+		rc = EXIT_FAILURE;
+
+	bex_free_candles(cs);
+	return rc;
+}
+
+/* candles in random order, the older candles fill the gaps */
+static int test_candles_gaps(void)
+{
+	struct libbex_candles *cs = bex_new_candles();
+	int i, rc = EXIT_SUCCESS;
+
+	memset(model, 0, sizeof(model));
+	srand(42);
+
+	for (i = 0; i < 20000 && rc == EXIT_SUCCESS; i++) {
+		/* first only a part of the buffer, then more than the buffer */
+		int k = rand() % (i < 5000 ? BEX_CANDLES_SIZE / 2 : NSLOTS);
+
+		if (update_candle(cs, k, i + 1) != 0 || check_candles(cs) != 0)
+			rc = EXIT_FAILURE;
+	}
+
+	bex_free_candles(cs);
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 2 && strcmp(argv[1], "--ring") == 0)
+		return test_candles_ring();
+	if (argc == 2 && strcmp(argv[1], "--gaps") == 0)
+		return test_candles_gaps();
+	if (argc == 1)
+		return test_candles_ring() == EXIT_SUCCESS &&
+		       test_candles_gaps() == EXIT_SUCCESS ?
+				EXIT_SUCCESS : EXIT_FAILURE;
+
+	fprintf(stderr, "usage: %s [--ring | --gaps]\n", argv[0]);
+	exit(EXIT_FAILURE);
+}
+#endif /* TEST_PROGRAM_CANDLES */
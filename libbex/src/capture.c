@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2018 Karel Zak <karel.zak.007@gmail.com>
+ *
+ * This file may be redistributed under the terms of the
+ * GNU Lesser General Public License.
+ */
+
+/*
+ * Private capture of the raw frames, see bex_platform_set_capture().
+ *
+ * The segment file is preallocated and mapped, the frames are copied from
+ * the receive (or send) buffer to the mapping. There is no syscall in the
+ * write path, the full segment is closed and the next segment is opened
+ * and preallocated in advance by the capture thread. The record length is
+ * written as the last, the records with zero length (the not used end of
+ * the segment) are not complete.
+ */
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "bexP.h"
+
+#define BEX_CAPTURE_ALIGN(x)	(((x) + 7) & ~((size_t) 7))
+
+static int open_segment(struct libbex_capture *cap, struct libbex_capture_segment *seg)
+{
+	struct libbex_capture_header *hdr;
+	struct timespec rt;
+	size_t off, pagesz = (size_t) sysconf(_SC_PAGESIZE);
+	char *name = NULL;
+	int fd = -1, rc;
+
+	/* never overwrite the previous captures */
+	do {
+		free(name);
+		if (asprintf(&name, "%s.%u", cap->path, cap->segno++) < 0)
+			return -ENOMEM;
+		fd = open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	} while (fd < 0 && errno == EEXIST);
+
+	if (fd < 0) {
+		rc = -errno;
+		goto err;
+	}
+
+	/* don't get SIGBUS on full filesystem */
+	rc = -posix_fallocate(fd, 0, cap->segsize);
+	if (rc)
+		goto err;
+
+	seg->map = mmap(NULL, cap->segsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (seg->map == MAP_FAILED) {
+		seg->map = NULL;
+		rc = -errno;
+		goto err;
+	}
+
+	/*
+	 * Prefault the pages for writing, so the receive path does not take
+	 * page faults. MAP_POPULATE is not enough, it maps the shared pages
+	 * read-only and the first write still faults.
+	 */
+	for (off = 0; off < cap->segsize; off += pagesz)
+		((volatile char *) seg->map)[off] = 0;
+
+	clock_gettime(CLOCK_REALTIME, &rt);
+
+	hdr = (struct libbex_capture_header *) seg->map;
+	memcpy(hdr->magic, BEX_CAPTURE_MAGIC, sizeof(hdr->magic));
+	hdr->clock_offset = (int64_t) ((uint64_t) rt.tv_sec * 1000000000ULL + rt.tv_nsec)
+			  - (int64_t) bex_get_monotonic_ns();
+
+	seg->name = name;
+	seg->fd = fd;
+	seg->used = sizeof(*hdr);
+
+	DBG(PLAT, bex_debugobj(cap, "opened %s", name));
+	return 0;
+err:
+	DBG(PLAT, bex_debugobj(cap, "failed to open %s [rc=%d]", name, rc));
+	if (fd >= 0) {
+		close(fd);
+		unlink(name);
+	}
+	free(name);
+	return rc;
+}
+
+/* truncates the segment to the used size, the not used segment is removed */
+static void close_segment(struct libbex_capture *cap, struct libbex_capture_segment *seg,
+			  int used)
+{
+	if (!seg->map)
+		return;
+
+	munmap(seg->map, cap->segsize);
+	if (!used)
+		unlink(seg->name);
+	else if (ftruncate(seg->fd, seg->used) != 0)
+		DBG(PLAT, bex_debugobj(cap, "failed to truncate %s", seg->name));
+	close(seg->fd);
+	free(seg->name);
+
+	memset(seg, 0, sizeof(*seg));
+	seg->fd = -1;
+}
+
+/* closes the full segment and opens the spare segment */
+static void *capture_thread(void *data)
+{
+	struct libbex_capture *cap = (struct libbex_capture *) data;
+
+	pthread_mutex_lock(&cap->lock);
+	while (!cap->stop) {
+		struct libbex_capture_segment full = cap->full, spare = { .fd = -1 };
+		int prepare = !cap->spare.map && !cap->error, rc = 0;
+
+		if (!full.map && !prepare) {
+			pthread_cond_wait(&cap->cond, &cap->lock);
+			continue;
+		}
+		memset(&cap->full, 0, sizeof(cap->full));
+		cap->full.fd = -1;
+		pthread_mutex_unlock(&cap->lock);
+
+		close_segment(cap, &full, 1);
+		if (prepare)
+			rc = open_segment(cap, &spare);
+
+		pthread_mutex_lock(&cap->lock);
+		if (prepare) {
+			if (rc)
+				cap->error = rc;	/* don't try it again */
+			else
+				cap->spare = spare;
+			pthread_cond_broadcast(&cap->ready);
+		}
+	}
+	pthread_mutex_unlock(&cap->lock);
+	return NULL;
+}
+
+/*
+ * Replaces the full segment by the spare segment. The writer waits only if the
+ * data are faster than the capture thread.
+ */
+static int next_segment(struct libbex_capture *cap)
+{
+	while (!cap->spare.map && !cap->error)
+		pthread_cond_wait(&cap->ready, &cap->lock);
+	if (!cap->spare.map)
+		return cap->error;
+
+	cap->full = cap->cur;
+	cap->cur = cap->spare;
+	memset(&cap->spare, 0, sizeof(cap->spare));
+	cap->spare.fd = -1;
+
+	pthread_cond_signal(&cap->cond);
+	return 0;
+}
+
+struct libbex_capture *bex_new_capture(const char *path, size_t segsize)
+{
+	struct libbex_capture *cap = calloc(1, sizeof(*cap));
+	int rc;
+
+	if (!cap) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	cap->cur.fd = cap->spare.fd = cap->full.fd = -1;
+	cap->segsize = segsize;
+	pthread_mutex_init(&cap->lock, NULL);
+	pthread_cond_init(&cap->cond, NULL);
+	pthread_cond_init(&cap->ready, NULL);
+
+	cap->path = strdup(path);
+	if (!cap->path) {
+		rc = -ENOMEM;
+		goto err;
+	}
+
+	/* the first segment synchronously, the errors are reported to the caller */
+	rc = open_segment(cap, &cap->cur);
+	if (rc)
+		goto err;
+
+	rc = -pthread_create(&cap->thread, NULL, capture_thread, cap);
+	if (rc)
+		goto err;
+	return cap;
+err:
+	close_segment(cap, &cap->cur, 0);
+	pthread_cond_destroy(&cap->ready);
+	pthread_cond_destroy(&cap->cond);
+	pthread_mutex_destroy(&cap->lock);
+	free(cap->path);
+	free(cap);
+	errno = -rc;
+	return NULL;
+}
+
+void bex_free_capture(struct libbex_capture *cap)
+{
+	if (!cap)
+		return;
+
+	pthread_mutex_lock(&cap->lock);
+	cap->stop = 1;
+	pthread_cond_signal(&cap->cond);
+	pthread_mutex_unlock(&cap->lock);
+	pthread_join(cap->thread, NULL);
+
+	close_segment(cap, &cap->full, 1);
+	close_segment(cap, &cap->cur, 1);
+	close_segment(cap, &cap->spare, 0);
+
+	pthread_cond_destroy(&cap->ready);
+	pthread_cond_destroy(&cap->cond);
+	pthread_mutex_destroy(&cap->lock);
+	free(cap->path);
+	free(cap);
+}
+
+/**
+ * bex_capture_write:
+ * @cap: capture
+ * @conn: connection index
+ * @dir: BEX_CAPTURE_{RX,TX}
+ * @time: bex_get_monotonic_ns()
+ * @data: frame
+ * @len: frame length
+ *
+ * Appends the frame to the current segment, the full segment is replaced by
+ * the spare segment prepared by the capture thread. The error of the spare
+ * segment is returned for all the next frames which don't fit the segment.
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_capture_write(struct libbex_capture *cap, unsigned int conn, int dir,
+		      uint64_t time, const void *data, size_t len)
+{
+	struct libbex_capture_record *rec;
+	size_t sz = sizeof(*rec) + BEX_CAPTURE_ALIGN(len);
+	int rc = 0;
+
+	if (sz > cap->segsize - sizeof(struct libbex_capture_header) || len > UINT32_MAX)
+		return -E2BIG;
+
+	pthread_mutex_lock(&cap->lock);
+	if (cap->cur.used + sz > cap->segsize) {
+		rc = next_segment(cap);
+		if (rc)
+			goto done;
+	}
+
+	rec = (struct libbex_capture_record *) (cap->cur.map + cap->cur.used);
+	memcpy(rec + 1, data, len);
+	rec->conn = conn;
+	rec->dir = dir;
+	rec->time = time;
+	__atomic_store_n(&rec->len, (uint32_t) len, __ATOMIC_RELEASE);
+
+	cap->cur.used += sz;
+done:
+	pthread_mutex_unlock(&cap->lock);
+	return rc;
+}
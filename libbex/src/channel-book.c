@@ -0,0 +1,287 @@
+#include <stddef.h>
+
+#include "bexP.h"
+
+static int is_book_event(struct libbex_channel *ch, struct libbex_event *ev)
+{
+	static const char *keys[] = { "prec", "freq", "len" };
+	struct libbex_array *ar = bex_event_get_replies(ev);
+	struct libbex_value *va, *req;
+	size_t i;
+
+	if (!ar)
+		return 0;
+
+	/* check channel family */
+	va = bex_array_get(ar, "channel");
+	if (!va || strcmp(bex_value_get_str(va), "book") != 0)
+		return 0;
+
+	/* check symbol */
+	va = bex_array_get(ar, "symbol");
+	if (!va || strcmp(bex_value_get_str(va), bex_channel_get_symbolname(ch)) != 0)
+		return 0;
+
+	/* more books for the same symbol are possible */
+	for (i = 0; i < ARRAY_SIZE(keys); i++) {
+		va = bex_array_get(ar, keys[i]);
+		req = bex_array_get(bex_event_get_values(ch->subscribe), keys[i]);
+		if (va && req && bex_value_get_str(va)
+		    && strcmp(bex_value_get_str(va), bex_value_get_str(req)) != 0)
+			return 0;
+	}
+
+	DBG(CHAN, bex_debugobj(ch, "book event detected"));
+	return 1;
+}
+
+static int book_snapshot(struct libbex_channel *ch)
+{
+	bex_reset_book(ch->priv);
+	return 0;
+}
+
+/* [PRICE, COUNT, AMOUNT] */
+static int book_update(struct libbex_channel *ch)
+{
+	const struct libbex_book_entry *en = bex_channel_get_reply_struct(ch);
+	struct libbex_book_level lv = {
+		.price = en->price,
+		.amount = en->amount,
+		.count = en->count
+	};
+	/* zero count removes the level, then amount is 1 for bids and -1 for asks */
+	int side = lv.amount > 0 ? BEX_BOOK_BIDS : BEX_BOOK_ASKS;
+
+	return bex_book_set_level(ch->priv, side, &lv);
+}
+
+/* [CHANNEL_ID, "cs", CHECKSUM] */
+static int book_checksum(struct libbex_channel *ch, int32_t cs)
+{
+	int32_t x = (int32_t) bex_book_checksum(ch->priv);
+
+	if (x != cs) {
+		DBG(CHAN, bex_debugobj(ch, "checksum mismatch [%d, expected %d]", x, cs));
+		return -EBADMSG;
+	}
+	return 0;
+}
+
+static void book_free(void *data)
+{
+	bex_free_book(data);
+}
+
+static int rawbook_snapshot(struct libbex_channel *ch)
+{
+	bex_reset_rawbook(ch->priv);
+	return 0;
+}
+
+/* [ORDER_ID, PRICE, AMOUNT] */
+static int rawbook_update(struct libbex_channel *ch)
+{
+	const struct libbex_rawbook_entry *en = bex_channel_get_reply_struct(ch);
+
+	return bex_rawbook_update(ch->priv, en->id, en->price, en->amount);
+}
+
+static void rawbook_free(void *data)
+{
+	bex_free_rawbook(data);
+}
+
+static struct libbex_event *new_subscribe_event(const char *symbol, const char *prec,
+						const char *freq, unsigned int len)
+{
+	struct libbex_event *ev;
+	char buf[16];
+
+	ev = bex_new_event("subscribe");
+	if (!ev)
+		return NULL;
+
+	bex_event_add_value(ev, bex_new_value_str("channel", "book"));
+	bex_event_add_value(ev, bex_new_value_str("symbol", symbol));
+	bex_event_add_value(ev, bex_new_value_str("prec", prec));
+	if (freq)
+		bex_event_add_value(ev, bex_new_value_str("freq", freq));
+	if (len) {
+		snprintf(buf, sizeof(buf), "%u", len);
+		bex_event_add_value(ev, bex_new_value_str("len", buf));
+	}
+	return ev;
+}
+
+/**
+ * bex_new_book_channel:
+ * @symbol: trading pair (e.g. "tBTCUSD")
+ * @prec: precision "P0" .. "P4" or NULL for "P0"
+ * @freq: frequency "F0" (realtime) or "F1" (every 2 seconds) or NULL for "F0"
+ * @len: number of price points (25 or 100) or 0 for default
+ *
+ * The channel keeps the book, see bex_channel_get_book(). The reply callback
+ * is called for each changed level (see struct libbex_book_entry), the book
+ * is already updated when the callback is called.
+ *
+ * The platform enables the exchange checksums for the book channels, the
+ * book is verified on every checksum message and the channel is subscribed
+ * again if the book does not match (the new snapshot is resync, see
+ * bex_channel_is_resync()).
+ *
+ * Returns: new channel or NULL.
+ */
+struct libbex_channel *bex_new_book_channel(const char *symbol, const char *prec,
+					    const char *freq, unsigned int len)
+{
+	struct libbex_channel *ch = NULL;
+	struct libbex_event *ev;
+	char name[64];
+
+	if (!symbol)
+		return NULL;
+	if (!prec)
+		prec = "P0";
+	if (!freq)
+		freq = "F0";
+
+	/* subscribe event definition */
+	ev = new_subscribe_event(symbol, prec, freq, len);
+	if (!ev)
+		goto err;
+
+	snprintf(name, sizeof(name), "book:%s:%s", symbol, prec);
+	ch = bex_new_channel(name);
+	if (!ch)
+		goto err;
+
+	bex_channel_set_subscribe_event(ch, ev);
+	bex_unref_event(ev);
+	ev = NULL;
+
+	bex_channel_set_verify_callback(ch, is_book_event);
+	bex_channel_set_symbolname(ch, symbol);
+
+	/* reply definition, BEX_BOOK_* order */
+	if (bex_channel_set_reply_struct(ch, sizeof(struct libbex_book_entry)) != 0)
+		goto err;
+	__bex_channel_add_reply_field(ch, bex_new_value_decimal("PRICE", 0, BEX_BOOK_SCALE),
+				offsetof(struct libbex_book_entry, price));
+	__bex_channel_add_reply_field(ch, bex_new_value_u64("COUNT", 0),
+				offsetof(struct libbex_book_entry, count));
+	__bex_channel_add_reply_field(ch, bex_new_value_decimal("AMOUNT", 0, BEX_BOOK_SCALE),
+				offsetof(struct libbex_book_entry, amount));
+
+	/* the book */
+	ch->priv = bex_new_book();
+	if (!ch->priv)
+		goto err;
+	ch->priv_snapshot = book_snapshot;
+	ch->priv_update = book_update;
+	ch->priv_checksum = book_checksum;
+	ch->priv_free = book_free;
+	ch->conf_flags = BEX_CONF_OB_CHECKSUM;
+
+	return ch;
+err:
+	bex_unref_event(ev);
+	bex_unref_channel(ch);
+	return NULL;
+}
+
+/**
+ * bex_new_rawbook_channel:
+ * @symbol: trading pair (e.g. "tBTCUSD")
+ * @len: number of price points (25 or 100) or 0 for default
+ *
+ * Raw book ("R0" precision) with individual orders. The channel keeps the
+ * orders (see bex_channel_get_book_order()) as well as the price levels
+ * aggregated from the orders (see bex_channel_get_book()). The reply callback
+ * is called for each changed order (see struct libbex_rawbook_entry), the
+ * book is already updated when the callback is called.
+ *
+ * Returns: new channel or NULL.
+ */
+struct libbex_channel *bex_new_rawbook_channel(const char *symbol, unsigned int len)
+{
+	struct libbex_channel *ch = NULL;
+	struct libbex_event *ev;
+	char name[64];
+
+	if (!symbol)
+		return NULL;
+
+	/* subscribe event definition */
+	ev = new_subscribe_event(symbol, "R0", NULL, len);
+	if (!ev)
+		goto err;
+
+	snprintf(name, sizeof(name), "book:%s:R0", symbol);
+	ch = bex_new_channel(name);
+	if (!ch)
+		goto err;
+
+	bex_channel_set_subscribe_event(ch, ev);
+	bex_unref_event(ev);
+	ev = NULL;
+
+	bex_channel_set_verify_callback(ch, is_book_event);
+	bex_channel_set_symbolname(ch, symbol);
+
+	/* reply definition, BEX_RAWBOOK_* order */
+	if (bex_channel_set_reply_struct(ch, sizeof(struct libbex_rawbook_entry)) != 0)
+		goto err;
+	__bex_channel_add_reply_field(ch, bex_new_value_u64("ORDER_ID", 0),
+				offsetof(struct libbex_rawbook_entry, id));
+	__bex_channel_add_reply_field(ch, bex_new_value_decimal("PRICE", 0, BEX_BOOK_SCALE),
+				offsetof(struct libbex_rawbook_entry, price));
+	__bex_channel_add_reply_field(ch, bex_new_value_decimal("AMOUNT", 0, BEX_BOOK_SCALE),
+				offsetof(struct libbex_rawbook_entry, amount));
+
+	/* the orders and the aggregated book */
+	ch->priv = bex_new_rawbook();
+	if (!ch->priv)
+		goto err;
+	ch->priv_snapshot = rawbook_snapshot;
+	ch->priv_update = rawbook_update;
+	ch->priv_free = rawbook_free;
+
+	return ch;
+err:
+	bex_unref_event(ev);
+	bex_unref_channel(ch);
+	return NULL;
+}
+
+/**
+ * bex_channel_get_book:
+ * @ch: book or raw book channel
+ *
+ * Returns: book or NULL if the channel is not book channel.
+ */
+struct libbex_book *bex_channel_get_book(struct libbex_channel *ch)
+{
+	if (!ch)
+		return NULL;
+	if (ch->priv_update == book_update)
+		return ch->priv;
+	if (ch->priv_update == rawbook_update)
+		return ((struct libbex_rawbook *) ch->priv)->book;
+	return NULL;
+}
+
+/**
+ * bex_channel_get_book_order:
+ * @ch: raw book channel
+ * @id: order ID
+ *
+ * Returns: order or NULL.
+ */
+const struct libbex_book_order *bex_channel_get_book_order(struct libbex_channel *ch,
+						uint64_t id)
+{
+	if (!ch || ch->priv_update != rawbook_update)
+		return NULL;
+	return bex_rawbook_get_order(ch->priv, id);
+}
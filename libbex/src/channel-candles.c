@@ -0,0 +1,128 @@
+#include <stddef.h>
+
+#include "bexP.h"
+
+static int is_candles_event(struct libbex_channel *ch, struct libbex_event *ev)
+{
+	struct libbex_array *ar = bex_event_get_replies(ev);
+	struct libbex_value *va, *key;
+
+	if (!ar)
+		return 0;
+
+	/* check channel family */
+	va = bex_array_get(ar, "channel");
+	if (!va || strcmp(bex_value_get_str(va), "candles") != 0)
+		return 0;
+
+	/* check key, it contains time frame and symbol */
+	va = bex_array_get(ar, "key");
+	key = bex_array_get(bex_event_get_values(ch->subscribe), "key");
+	if (!va || !key || !bex_value_get_str(va)
+	    || strcmp(bex_value_get_str(va), bex_value_get_str(key)) != 0)
+		return 0;
+
+	DBG(CHAN, bex_debugobj(ch, "candles event detected"));
+	return 1;
+}
+
+static int candles_snapshot(struct libbex_channel *ch)
+{
+	bex_reset_candles(ch->priv);
+	return 0;
+}
+
+/* [MTS, OPEN, CLOSE, HIGH, LOW, VOLUME] */
+static int candles_update(struct libbex_channel *ch)
+{
+	return bex_candles_update(ch->priv, bex_channel_get_reply_struct(ch));
+}
+
+static void candles_free(void *data)
+{
+	bex_free_candles(data);
+}
+
+/**
+ * bex_new_candles_channel:
+ * @key: candles key (e.g. "trade:1m:tBTCUSD")
+ *
+ * The channel keeps history of the candles, see bex_channel_get_candles().
+ * The reply callback is called for each changed candle (see struct
+ * libbex_candle), the history is already updated when the callback is called.
+ *
+ * Returns: new channel or NULL.
+ */
+struct libbex_channel *bex_new_candles_channel(const char *key)
+{
+	struct libbex_channel *ch = NULL;
+	struct libbex_event *ev;
+	const char *symbol;
+	char name[64];
+
+	if (!key)
+		return NULL;
+
+	/* the symbol is the last part of the key */
+	symbol = strrchr(key, ':');
+	if (!symbol || !*(symbol + 1))
+		return NULL;
+	symbol++;
+
+	/* subscribe event definition */
+	ev = bex_new_event("subscribe");
+	if (!ev)
+		goto err;
+
+	bex_event_add_value(ev, bex_new_value_str("channel", "candles"));
+	bex_event_add_value(ev, bex_new_value_str("key", key));
+
+	snprintf(name, sizeof(name), "candles:%s", key);
+	ch = bex_new_channel(name);
+	if (!ch)
+		goto err;
+
+	bex_channel_set_subscribe_event(ch, ev);
+	bex_unref_event(ev);
+	ev = NULL;
+
+	bex_channel_set_verify_callback(ch, is_candles_event);
+	bex_channel_set_symbolname(ch, symbol);
+
+	/* reply definition, BEX_CANDLE_* order */
+	if (bex_channel_set_reply_struct(ch, sizeof(struct libbex_candle)) != 0)
+		goto err;
+	__bex_channel_add_reply_field(ch, bex_new_value_u64("MTS", 0), offsetof(struct libbex_candle, mts));
+	__bex_channel_add_reply_field(ch, bex_new_value_float("OPEN", 0), offsetof(struct libbex_candle, open));
+	__bex_channel_add_reply_field(ch, bex_new_value_float("CLOSE", 0), offsetof(struct libbex_candle, close));
+	__bex_channel_add_reply_field(ch, bex_new_value_float("HIGH", 0), offsetof(struct libbex_candle, high));
+	__bex_channel_add_reply_field(ch, bex_new_value_float("LOW", 0), offsetof(struct libbex_candle, low));
+	__bex_channel_add_reply_field(ch, bex_new_value_float("VOLUME", 0), offsetof(struct libbex_candle, volume));
+
+	/* the history */
+	ch->priv = bex_new_candles();
+	if (!ch->priv)
+		goto err;
+	ch->priv_snapshot = candles_snapshot;
+	ch->priv_update = candles_update;
+	ch->priv_free = candles_free;
+
+	return ch;
+err:
+	bex_unref_event(ev);
+	bex_unref_channel(ch);
+	return NULL;
+}
+
+/**
+ * bex_channel_get_candles:
+ * @ch: candles channel
+ *
+ * Returns: candles or NULL if the channel is not candles channel.
+ */
+struct libbex_candles *bex_channel_get_candles(struct libbex_channel *ch)
+{
+	if (!ch || ch->priv_update != candles_update)
+		return NULL;
+	return ch->priv;
+}
@@ -1,4 +1,6 @@
 
+#include <stddef.h>
+
 #include "bexP.h"
 
 static int is_ticker_event(struct libbex_channel *ch, struct libbex_event *ev)
@@ -52,17 +54,19 @@ struct libbex_channel *bex_new_ticker_channel(const char *symbol)
 	bex_channel_set_verify_callback(ch, is_ticker_event);
 	bex_channel_set_symbolname(ch, symbol);
 
-	/* reply definition */
-	bex_channel_add_reply(ch, bex_new_value_float("BID", 0));
-	bex_channel_add_reply(ch, bex_new_value_float("BID_SIZE", 0));
-	bex_channel_add_reply(ch, bex_new_value_float("ASK", 0));
-	bex_channel_add_reply(ch, bex_new_value_float("ASK_SIZE", 0));
-	bex_channel_add_reply(ch, bex_new_value_float("DAILY_CHANGE", 0));
-	bex_channel_add_reply(ch, bex_new_value_float("DAILY_CHANGE_PERC", 0));
-	bex_channel_add_reply(ch, bex_new_value_float("LAST_PRICE", 0));
-	bex_channel_add_reply(ch, bex_new_value_float("VOLUME", 0));
-	bex_channel_add_reply(ch, bex_new_value_float("HIGH", 0));
-	bex_channel_add_reply(ch, bex_new_value_float("LOW", 0));
+	/* reply definition, BEX_TICKER_* order */
+	if (bex_channel_set_reply_struct(ch, sizeof(struct libbex_ticker)) != 0)
+		goto err;
+	__bex_channel_add_reply_field(ch, bex_new_value_float("BID", 0), offsetof(struct libbex_ticker, bid));
+	__bex_channel_add_reply_field(ch, bex_new_value_float("BID_SIZE", 0), offsetof(struct libbex_ticker, bid_size));
+	__bex_channel_add_reply_field(ch, bex_new_value_float("ASK", 0), offsetof(struct libbex_ticker, ask));
+	__bex_channel_add_reply_field(ch, bex_new_value_float("ASK_SIZE", 0), offsetof(struct libbex_ticker, ask_size));
+	__bex_channel_add_reply_field(ch, bex_new_value_float("DAILY_CHANGE", 0), offsetof(struct libbex_ticker, daily_change));
+	__bex_channel_add_reply_field(ch, bex_new_value_float("DAILY_CHANGE_PERC", 0), offsetof(struct libbex_ticker, daily_change_perc));
+	__bex_channel_add_reply_field(ch, bex_new_value_float("LAST_PRICE", 0), offsetof(struct libbex_ticker, last_price));
+	__bex_channel_add_reply_field(ch, bex_new_value_float("VOLUME", 0), offsetof(struct libbex_ticker, volume));
+	__bex_channel_add_reply_field(ch, bex_new_value_float("HIGH", 0), offsetof(struct libbex_ticker, high));
+	__bex_channel_add_reply_field(ch, bex_new_value_float("LOW", 0), offsetof(struct libbex_ticker, low));
 
 	return ch;
 err:
@@ -1,4 +1,6 @@
 
+#include <stddef.h>
+
 #include "bexP.h"
 
 static int is_trades_event(struct libbex_channel *ch, struct libbex_event *ev)
@@ -52,11 +54,14 @@ struct libbex_channel *bex_new_trades_channel(const char *symbol)
 	bex_channel_set_verify_callback(ch, is_trades_event);
 	bex_channel_set_symbolname(ch, symbol);
 
-	/* reply definition */
-	bex_channel_add_reply(ch, bex_new_value_u64("ID", 0));
-	bex_channel_add_reply(ch, bex_new_value_u64("MTS", 0));
-	bex_channel_add_reply(ch, bex_new_value_float("AMOUNT", 0));
-	bex_channel_add_reply(ch, bex_new_value_float("PRICE", 0));
+	/* reply definition, BEX_TRADE_* order */
+	if (bex_channel_set_reply_struct(ch, sizeof(struct libbex_trade)) != 0)
+		goto err;
+	__bex_channel_add_reply_field(ch, bex_new_value_u64("ID", 0), offsetof(struct libbex_trade, id));
+	__bex_channel_add_reply_field(ch, bex_new_value_u64("MTS", 0), offsetof(struct libbex_trade, mts));
+	ch->mts_offset = offsetof(struct libbex_trade, mts);
+	__bex_channel_add_reply_field(ch, bex_new_value_float("AMOUNT", 0), offsetof(struct libbex_trade, amount));
+	__bex_channel_add_reply_field(ch, bex_new_value_float("PRICE", 0), offsetof(struct libbex_trade, price));
 
 	return ch;
 err:
@@ -64,3 +69,65 @@ err:
 	bex_unref_channel(ch);
 	return NULL;
 }
+
+static int bars_update(struct libbex_channel *ch)
+{
+	const char *type = bex_channel_get_reply_type(ch);
+
+	/* the snapshot is history (newest first) and "tu" repeats "te" */
+	if (bex_channel_is_snapshot(ch) || (type && strcmp(type, "tu") == 0))
+		return 0;
+	return bex_barset_update(ch->priv, bex_channel_get_reply_struct(ch));
+}
+
+static void bars_free(void *data)
+{
+	bex_free_barset(data);
+}
+
+/**
+ * bex_channel_add_bars:
+ * @ch: trades channel
+ * @type: BEX_BARS_TIME, BEX_BARS_VOLUME or BEX_BARS_TICK
+ * @size: bar size (milliseconds, amount or number of trades)
+ *
+ * Builds bars from the trades, for example 1 second bars:
+ *
+ *   bex_channel_add_bars(ch, BEX_BARS_TIME, 1000);
+ *
+ * More bars may be added to the same channel. The bars are updated before the
+ * reply callback is called, the trades from the snapshot are ignored. The
+ * bars are stored as candles, see bex_channel_get_bars().
+ *
+ * Returns: bars index or <0 on error.
+ */
+int bex_channel_add_bars(struct libbex_channel *ch, int type, long double size)
+{
+	if (!ch || ch->verify != is_trades_event)
+		return -EINVAL;
+
+	if (!ch->priv) {
+		ch->priv = bex_new_barset();
+		if (!ch->priv)
+			return -ENOMEM;
+		ch->priv_update = bars_update;
+		ch->priv_free = bars_free;
+	}
+	return bex_barset_add(ch->priv, type, size);
+}
+
+/**
+ * bex_channel_get_bars:
+ * @ch: trades channel
+ * @idx: bars index (see bex_channel_add_bars())
+ *
+ * The newest candle is the incomplete (current) bar.
+ *
+ * Returns: candles or NULL.
+ */
+struct libbex_candles *bex_channel_get_bars(struct libbex_channel *ch, size_t idx)
+{
+	if (!ch || ch->priv_update != bars_update)
+		return NULL;
+	return bex_barset_get(ch->priv, idx);
+}
@@ -1,6 +1,5 @@
 
 #include "bexP.h"
-#include "strutils.h"
 
 static void free_channel(struct libbex_channel *ch)
 {
@@ -10,6 +9,12 @@ static void free_channel(struct libbex_channel *ch)
 	DBG(CHAN, bex_debugobj(ch, "free [name=%s]", ch->name));
 	bex_unref_event(ch->subscribe);
 	bex_unref_array(ch->reply);
+	bex_free_batch(ch->batch);
+	bex_free_latency(ch->latency);
+	if (ch->priv_free)
+		ch->priv_free(ch->priv);
+	free(ch->fields);
+	free(ch->reply_struct);
 	free(ch->name);
 	free(ch->symbolname);
 	free(ch->inbuff);
@@ -39,6 +44,7 @@ struct libbex_channel *bex_new_channel(const char *name)
 	if (!ch->name)
 		goto err;
 	INIT_LIST_HEAD(&ch->channels);
+	ch->mts_offset = -1;
 	return ch;
 err:
 	free_channel(ch);
@@ -98,11 +104,15 @@ int bex_channel_set_subscribe_event(struct libbex_channel *ch, struct libbex_eve
  * bex_channel_get_replies
  * @ch: channel
  *
- * Returns: values list
+ * The values are overwritten by the connection thread in the threaded mode
+ * (see bex_platform_start_threads()), use bex_channel_get_reply_struct()
+ * there.
+ *
+ * Returns: values list or NULL in the threaded mode.
  */
 struct libbex_array *bex_channel_get_replies(struct libbex_channel *ch)
 {
-	if (!ch)
+	if (!ch || ch->rx_msg || (ch->conn && ch->conn->pl->threaded))
 		return NULL;
 	return ch->reply;
 }
@@ -123,6 +133,185 @@ int bex_channel_set_reply_callback(struct libbex_channel *ch,
 	return 0;
 }
 
+/**
+ * bex_channel_is_snapshot
+ * @ch: channel
+ *
+ * Returns: 1 if the reply callback is called for a row of the snapshot.
+ */
+int bex_channel_is_snapshot(struct libbex_channel *ch)
+{
+	if (ch && ch->rx_msg)
+		return ch->rx_msg->flags & BEX_MSG_SNAPSHOT ? 1 : 0;
+	return ch && ch->snapshot ? 1 : 0;
+}
+
+/**
+ * bex_channel_is_resync
+ * @ch: channel
+ *
+ * The connection has been lost and the channel has been subscribed again,
+ * the snapshot replaces the data received before the connection has been
+ * lost (some updates are missing).
+ *
+ * Returns: 1 if the reply callback is called for a row of the first snapshot
+ * after reconnect.
+ */
+int bex_channel_is_resync(struct libbex_channel *ch)
+{
+	if (ch && ch->rx_msg)
+		return ch->rx_msg->flags & BEX_MSG_RESYNC ? 1 : 0;
+	return ch && ch->snapshot && ch->resync ? 1 : 0;
+}
+
+/**
+ * bex_channel_get_seq
+ * @ch: channel
+ *
+ * The exchange adds sequence number to the channel messages if
+ * BEX_CONF_SEQ_ALL is enabled, see bex_platform_set_flags(). The numbers
+ * are per connection (shared by all the channels of the connection).
+ *
+ * Returns: sequence number of the message processed by the reply callback or 0.
+ */
+uint64_t bex_channel_get_seq(struct libbex_channel *ch)
+{
+	if (ch && ch->rx_msg)
+		return ch->rx_msg->seq;
+	return ch ? ch->seq : 0;
+}
+
+/**
+ * bex_channel_get_timestamp
+ * @ch: channel
+ *
+ * The exchange adds timestamp to the channel messages if BEX_CONF_TIMESTAMP
+ * is enabled, see bex_platform_set_flags().
+ *
+ * Returns: server timestamp (milliseconds since Epoch) of the message
+ * processed by the reply callback or 0.
+ */
+uint64_t bex_channel_get_timestamp(struct libbex_channel *ch)
+{
+	if (ch && ch->rx_msg)
+		return ch->rx_msg->mts;
+	return ch ? ch->mts : 0;
+}
+
+/**
+ * bex_channel_get_rx_time
+ * @ch: channel
+ *
+ * The message is stamped when received from the socket, before the message
+ * is parsed. Compare with clock_gettime(CLOCK_MONOTONIC) to measure the
+ * processing latency.
+ *
+ * Returns: CLOCK_MONOTONIC time in nanoseconds of the message processed by
+ * the reply callback or 0.
+ */
+uint64_t bex_channel_get_rx_time(struct libbex_channel *ch)
+{
+	if (ch && ch->rx_msg)
+		return ch->rx_msg->rx_time;
+	return ch ? ch->rx_time : 0;
+}
+
+/**
+ * bex_channel_enable_latency_stats
+ * @ch: channel
+ * @enable: 1 or 0
+ *
+ * Enables latency histograms for the channel, see
+ * bex_channel_get_latency_stats(). The histograms are reset when enabled.
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_channel_enable_latency_stats(struct libbex_channel *ch, int enable)
+{
+	if (!ch)
+		return -EINVAL;
+
+	if (!enable) {
+		bex_free_latency(ch->latency);
+		ch->latency = NULL;
+	} else if (!ch->latency) {
+		ch->latency = bex_new_latency();
+		if (!ch->latency)
+			return -ENOMEM;
+	} else
+		bex_reset_latency(ch->latency);
+	return 0;
+}
+
+/**
+ * bex_channel_reset_latency_stats
+ * @ch: channel
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_channel_reset_latency_stats(struct libbex_channel *ch)
+{
+	if (!ch || !ch->latency)
+		return -EINVAL;
+	bex_reset_latency(ch->latency);
+	return 0;
+}
+
+/**
+ * bex_channel_get_latency_stats
+ * @ch: channel
+ * @type: BEX_LATENCY_{EXCHANGE,DISPATCH,CALLBACK}
+ * @st: returns statistic
+ *
+ * BEX_LATENCY_EXCHANGE is time between the exchange timestamp and the
+ * message receive (see bex_channel_get_rx_time()). The exchange timestamp
+ * is BEX_CONF_TIMESTAMP (see bex_platform_set_flags()) or the row
+ * timestamp of the trades updates; the snapshots are not counted. The
+ * latency depends on the local clock synchronization.
+ *
+ * BEX_LATENCY_DISPATCH is time between the message receive and the reply
+ * (or batch) callback, BEX_LATENCY_CALLBACK is duration of the callback.
+ *
+ * The percentiles are approximated by the histogram buckets, the relative
+ * error is less than 7%.
+ *
+ * Returns: 0 on success, <0 on error (e.g. not enabled by
+ * bex_channel_enable_latency_stats()).
+ */
+int bex_channel_get_latency_stats(struct libbex_channel *ch, int type,
+				  struct libbex_latency_stats *st)
+{
+	if (!ch || !ch->latency || !st)
+		return -EINVAL;
+	return bex_latency_get_stats(ch->latency, type, st);
+}
+
+/**
+ * bex_channel_set_batch_callback
+ * @ch: channel
+ * @fn: callback function
+ *
+ * The batch callback is called once for all rows of the received message
+ * (e.g. trades snapshot) rather than the reply callback for each row. The
+ * rows are available as columns, see bex_batch_get_u64() and friends. Use
+ * NULL @fn to go back to the reply callback.
+ *
+ * Returns: 0 or <0 on error
+ */
+int bex_channel_set_batch_callback(struct libbex_channel *ch,
+		int (*fn)(struct libbex_channel *, struct libbex_batch *))
+{
+	if (!ch)
+		return -EINVAL;
+	if (fn && !ch->batch) {
+		ch->batch = bex_new_batch();
+		if (!ch->batch)
+			return -ENOMEM;
+	}
+	ch->batch_callback = fn;
+	return 0;
+}
+
 /**
  * bex_channel_set_verify_callback
  * @ch: channel
@@ -207,15 +396,154 @@ int bex_channel_add_reply(struct libbex_channel *ch, struct libbex_value *va)
  */
 int bex_channel_remove_reply(struct libbex_channel *ch, struct libbex_value *va)
 {
+	size_t i;
+
 	if (!va || !ch)
 		return -EINVAL;
 	if (!ch->reply)
 		return 0;
 
 	DBG(CHAN, bex_debugobj(ch, "remove reply %s [%p]", va->name, va));
+
+	for (i = 0; i < ch->nfields; i++) {
+		if (ch->fields[i].va != va)
+			continue;
+		memmove(&ch->fields[i], &ch->fields[i + 1],
+			(ch->nfields - i - 1) * sizeof(struct libbex_field));
+		ch->nfields--;
+		break;
+	}
 	return bex_array_remove(ch->reply, va);
 }
 
+/**
+ * bex_channel_set_reply_struct:
+ * @ch: channel
+ * @size: size of the struct
+ *
+ * Allocates struct for the reply, the fields added by
+ * bex_channel_add_reply_field() are stored to the struct for each received
+ * row, so callbacks don't have to search for the values by name.
+ *
+ * Returns: 0 on success or negative number in case of error.
+ */
+int bex_channel_set_reply_struct(struct libbex_channel *ch, size_t size)
+{
+	void *tmp;
+
+	if (!ch || !size)
+		return -EINVAL;
+
+	tmp = calloc(1, size);
+	if (!tmp)
+		return -ENOMEM;
+
+	free(ch->reply_struct);
+	ch->reply_struct = tmp;
+	ch->reply_struct_size = size;
+
+	DBG(CHAN, bex_debugobj(ch, "set reply struct [size=%zu]", size));
+	return 0;
+}
+
+/**
+ * bex_channel_get_reply_struct:
+ * @ch: channel
+ *
+ * In the threaded mode (see bex_platform_start_threads()) the struct is a copy
+ * queued by the connection thread and it's valid only within the callback.
+ *
+ * Returns: reply struct (e.g. struct libbex_trade) or NULL.
+ */
+void *bex_channel_get_reply_struct(struct libbex_channel *ch)
+{
+	if (ch && ch->rx_msg)
+		return ch->rx_msg->flags & BEX_MSG_NODATA ? NULL : ch->rx_msg->data;
+	return ch ? ch->reply_struct : NULL;
+}
+
+/**
+ * bex_channel_add_reply_field:
+ * @ch: channel
+ * @va: value
+ * @offset: offset of the field in reply struct
+ *
+ * Adds @va to the channel reply (see bex_channel_add_reply()) and to the
+ * reply schema. The struct field type has to follow the value type:
+ * uint64_t for BEX_TYPE_U64, int64_t for BEX_TYPE_S64 and BEX_TYPE_DECIMAL
+ * (mantissa), long double for BEX_TYPE_FLOAT and const char * for
+ * BEX_TYPE_STR. The string pointer is valid until the next update.
+ *
+ * The reply struct has to be defined by bex_channel_set_reply_struct()
+ * before.
+ *
+ * Returns: 0 on success or negative number in case of error.
+ */
+int bex_channel_add_reply_field(struct libbex_channel *ch, struct libbex_value *va, size_t offset)
+{
+	struct libbex_field *tmp;
+	int rc;
+
+	if (!va || !ch || !ch->reply_struct)
+		return -EINVAL;
+	if (offset + bex_value_type_size(va->type) > ch->reply_struct_size)
+		return -ERANGE;
+
+	tmp = realloc(ch->fields, (ch->nfields + 1) * sizeof(struct libbex_field));
+	if (!tmp)
+		return -ENOMEM;
+	ch->fields = tmp;
+
+	rc = bex_channel_add_reply(ch, va);
+	if (rc)
+		return rc;
+
+	ch->fields[ch->nfields].va = va;
+	ch->fields[ch->nfields].offset = offset;
+	ch->nfields++;
+	return 0;
+}
+
+/* Like bex_channel_add_reply_field(), but the @va reference is moved to
+ * the channel, so it's possible to use bex_new_value_*() as argument. */
+int __bex_channel_add_reply_field(struct libbex_channel *ch, struct libbex_value *va, size_t offset)
+{
+	int rc = bex_channel_add_reply_field(ch, va, offset);
+
+	bex_unref_value(va);
+	return rc;
+}
+
+/* copy values to the reply struct */
+static void fill_reply_struct(struct libbex_channel *ch)
+{
+	char *st = ch->reply_struct;
+	size_t i;
+
+	for (i = 0; i < ch->nfields; i++) {
+		struct libbex_value *va = ch->fields[i].va;
+		char *p = st + ch->fields[i].offset;
+
+		switch (va->type) {
+		case BEX_TYPE_STR:
+			*(const char **) p = va->data.str;
+			break;
+		case BEX_TYPE_U64:
+			*(uint64_t *) p = va->data.u64;
+			break;
+		case BEX_TYPE_S64:
+			*(int64_t *) p = va->data.s64;
+			break;
+		case BEX_TYPE_FLOAT:
+			*(long double *) p = va->data.fl;
+			break;
+		case BEX_TYPE_DECIMAL:
+			*(int64_t *) p = va->data.dec.num;
+			break;
+		}
+	}
+}
+
 /**
  * bex_channel_update_reply:
  * @ch: channel
@@ -245,12 +573,36 @@ int bex_channel_set_subscribed(struct libbex_channel *ch, int x)
 	if (!ch)
 		return -EINVAL;
 	ch->subscribed = x;
+	ch->synced = 0;
+	ch->status = x ? BEX_CHANNEL_SUBSCRIBED : BEX_CHANNEL_UNSUBSCRIBED;
 
 	DBG(CHAN, bex_debugobj(ch, "change %s subscribed status to %s",
 			ch->name, ch->subscribed ? "TRUE" : "FALSE"));
 	return 0;
 }
 
+void bex_channel_set_status(struct libbex_channel *ch, int status)
+{
+	DBG(CHAN, bex_debugobj(ch, "change %s status %d -> %d", ch->name, ch->status, status));
+	ch->status = status;
+	ch->subscribed = status == BEX_CHANNEL_SUBSCRIBED;
+	ch->synced = 0;
+}
+
+/**
+ * bex_channel_get_status:
+ * @ch: channel
+ *
+ * The status is updated asynchronously when the platform receives replies
+ * for the subscribe requests, see bex_platform_request_subscribe().
+ *
+ * Returns: BEX_CHANNEL_{UNSUBSCRIBED,SUBSCRIBING,SUBSCRIBED,FAILED}
+ */
+int bex_channel_get_status(struct libbex_channel *ch)
+{
+	return ch ? ch->status : BEX_CHANNEL_UNSUBSCRIBED;
+}
+
 /**
  * bex_channel_is_subscribed:
  * @ch: channel
@@ -262,11 +614,27 @@ int bex_channel_is_subscribed(struct libbex_channel *ch)
 	return ch && ch->subscribed ? 1 : 0;
 }
 
+/**
+ * bex_channel_get_connection:
+ * @ch: channel
+ *
+ * Returns: index of the platform connection used by the channel or -1.
+ */
+int bex_channel_get_connection(struct libbex_channel *ch)
+{
+	return ch && ch->conn ? (int) ch->conn->idx : -1;
+}
+
 /**
  * bex_channel_set_id:
  * @ch: channel
  * @id: identifier
  *
+ * The ID of the channel added to the platform is maintained by the platform
+ * (subscribe and unsubscribe replies). The ID set by this function is not
+ * used to look up the received messages until the channel is subscribed
+ * again.
+ *
  * Returns: 0 on success or negative number in case of error.
  */
 int bex_channel_set_id(struct libbex_channel *ch, uint64_t id)
@@ -348,40 +716,26 @@ const struct libbex_symbol *bex_channel_get_symbol(struct libbex_channel *ch)
  */
 const char *bex_channel_get_reply_type(struct libbex_channel *ch)
 {
+	if (ch && ch->rx_msg)
+		return *ch->rx_msg->type ? ch->rx_msg->type : NULL;
 	return ch && *ch->reply_type ? ch->reply_type : NULL;
 }
 
-int bex_is_channel_string(const char *str, uint64_t *id)
-{
-	const char *p = (char *) str;
-	char *end;
-
-	p = skip_space(p);
-	if (*p != '[')
-		return 0;
-
-	p = skip_space(++p);
-	errno = 0;
-	*id = strtoumax(p, &end, 10);
-	if (errno || p == end)
-		return 0;
-
-	p = end;
-	p = skip_space(p);
-	if (*p != ',')
-		return 0;
-
-	return 1;
-}
-
 /**
  * bex_channel_update_inbuff:
  * @ch: channel
  * @str: input data
  *
- * Copy @str to channel input buffer.
+ * Copy @str to channel input buffer. The platform processes received data
+ * directly from the receive buffer, the channel input buffer is for
+ * applications which want to defer the processing, see bex_channel_wakeup().
  *
- * Returns: 0 on success or negative number in case of error.
+ * The buffer is not locked, the update and the processing have to be called
+ * by the same thread. It's not supported in the threaded mode, the channel
+ * data are processed by the connection thread there.
+ *
+ * Returns: 0 on success, -EBUSY in the threaded mode or negative number in
+ * case of error.
  */
 int bex_channel_update_inbuff(struct libbex_channel *ch, const char *str)
 {
@@ -390,12 +744,12 @@ int bex_channel_update_inbuff(struct libbex_channel *ch, const char *str)
 
 	if (!ch)
 		return -EINVAL;
+	if (ch->conn && ch->conn->pl->threaded)
+		return -EBUSY;
 
 	DBG(CHAN, bex_debugobj(ch, "update inbuff"));
 	len = strlen(str);
 
-	/* TODO: muttex lock */
-
 	if (ch->inbuffsiz < len) {
 		size_t newsz = ((len + 512) >> 9) << 9;		/* align */
 		void *tmp = realloc(ch->inbuff, newsz);
@@ -409,120 +763,372 @@ int bex_channel_update_inbuff(struct libbex_channel *ch, const char *str)
 	}
 
 	memcpy(ch->inbuff, str, len + 1);
+	ch->rx_time = bex_get_monotonic_ns();
 	rc = 0;
-	/* TODO: unlock */
 
 done:
 	return rc;
 }
 
 
-/* [ data ...],[ data ...], ... */
-static int process_data(struct libbex_channel *ch, const char *str)
+/*
+ * Threaded mode; copies the rows to the connection ring, the callbacks are
+ * called later by bex_platform_dispatch().
+ */
+static int queue_rows(struct libbex_channel *ch, struct libbex_parser *ps,
+		      size_t idx, size_t nrows)
 {
-	const char *p = str;
+	struct libbex_conn *conn = ch->conn;
+	size_t n;
 	int rc = 0;
 
-	DBG(CHAN, bex_debugobj(ch, "processing data..."));
+	if (ch->reply_struct_size > BEX_RING_DATASZ)
+		return -E2BIG;
 
-	while (rc == 0 && p && *p == '[') {
-		char *next = NULL;
+	for (n = 0; n < nrows || (n == 0 && ch->snapshot); n++) {
+		struct libbex_ring_msg *msg;
 
-		/* read one "[..data..]" segment from @p */
-		rc = bex_array_fill_unnamed_from_string(ch->reply, p, &next);
-		if (rc || !next)
-			break;
+		if (n < nrows) {
+			rc = bex_array_fill_unnamed_from_tokens(ch->reply, ps, idx);
+			if (rc)
+				break;
+			if (ch->nfields)
+				fill_reply_struct(ch);
+			idx = ps->toks[idx].next;
+		}
 
-		p = skip_space(next);		/* ,[ */
-		if (*p == ',')
-			p = skip_space(p + 1);
+		msg = bex_conn_reserve_msg(conn);
+		if (!msg)
+			return -ECANCELED;
+
+		msg->ch = ch;
+		msg->flags = 0;
+		msg->seq = ch->seq;
+		msg->mts = ch->mts;
+		msg->rx_time = ch->rx_time;
+		if (ch->snapshot)
+			msg->flags |= BEX_MSG_SNAPSHOT | (n == 0 ? BEX_MSG_SNAPSHOT_BEGIN : 0);
+		if (ch->snapshot && ch->resync)
+			msg->flags |= BEX_MSG_RESYNC;
+		if (n >= nrows)
+			msg->flags |= BEX_MSG_NODATA;
+		memcpy(msg->type, ch->reply_type, sizeof(msg->type));
+		memcpy(msg->data, ch->reply_struct, ch->reply_struct_size);
+		bex_conn_commit_msg(conn);
+	}
+	return rc;
+}
 
-		if (ch->callback)
-			rc = ch->callback(NULL, ch);
+/*
+ * "cs" message; the data are verified by the channel (e.g. order book), the
+ * channel is subscribed again if the data are corrupted.
+ */
+static int checksum_done(struct libbex_channel *ch, int rc)
+{
+	if (rc == -EBADMSG && ch->conn) {
+		DBG(CHAN, bex_debugobj(ch, "checksum mismatch, resync"));
+		return bex_platform_resync_channel(ch->conn->pl, ch);
 	}
+	return rc;
+}
 
-	DBG(CHAN, bex_debugobj(ch, "processing data done [rc=%d]", rc));
+static int process_checksum(struct libbex_channel *ch, struct libbex_parser *ps, size_t idx)
+{
+	struct libbex_conn *conn = ch->conn;
+	int64_t cs;
+
+	if (bex_token_get_s64(ps, &ps->toks[idx], &cs) != 0)
+		return -EINVAL;
+
+	if (conn && conn->ring) {
+		struct libbex_ring_msg *msg = bex_conn_reserve_msg(conn);
+
+		if (!msg)
+			return -ECANCELED;
+		msg->ch = ch;
+		msg->flags = BEX_MSG_CHECKSUM;
+		msg->seq = ch->seq;
+		msg->mts = ch->mts;
+		msg->rx_time = ch->rx_time;
+		*msg->type = '\0';
+		*(int32_t *) msg->data = (int32_t) cs;
+		bex_conn_commit_msg(conn);
+		return 0;
+	}
+
+	return checksum_done(ch, ch->priv_checksum(ch, (int32_t) cs));
+}
+
+/*
+ * The row time is the execution time, the "tu" (and "ftu") rows repeat it
+ * later, so only the executed rows are usable for the exchange latency.
+ */
+static inline int is_executed(struct libbex_channel *ch)
+{
+	const char *type = bex_channel_get_reply_type(ch);
+
+	return type && (strcmp(type, "te") == 0 || strcmp(type, "fte") == 0);
+}
+
+/*
+ * Calls the reply (or batch) callback and updates the latency histograms,
+ * see bex_channel_get_latency_stats().
+ */
+static int call_callback(struct libbex_platform *pl, struct libbex_channel *ch, int batch)
+{
+	struct libbex_latency *lt = ch->latency;
+	uint64_t start, rx, mts;
+	int rc;
+
+	if (!lt)
+		return batch ? ch->batch_callback(ch, ch->batch) : ch->callback(pl, ch);
+
+	start = bex_get_monotonic_ns();
+	rx = bex_channel_get_rx_time(ch);
+
+	if (!bex_channel_is_snapshot(ch)) {
+		mts = bex_channel_get_timestamp(ch);
+		if (!mts && ch->mts_offset >= 0 && ch->nfields && is_executed(ch))
+			mts = *(uint64_t *) ((char *) bex_channel_get_reply_struct(ch)
+						+ ch->mts_offset);
+		if (mts && rx)
+			bex_latency_update_exchange(lt, mts, rx);
+	}
+	if (rx && rx <= start)
+		bex_latency_update(lt, BEX_LATENCY_DISPATCH, start - rx);
+
+	rc = batch ? ch->batch_callback(ch, ch->batch) : ch->callback(pl, ch);
+
+	bex_latency_update(lt, BEX_LATENCY_CALLBACK, bex_get_monotonic_ns() - start);
 	return rc;
 }
 
-/* "type", [ */
-static int process_message_type(struct libbex_channel *ch, const char **str0)
+/**
+ * bex_channel_dispatch:
+ * @pl: platform
+ * @msg: message from the connection ring
+ *
+ * Calls the channel callbacks for the message queued by queue_rows().
+ */
+int bex_channel_dispatch(struct libbex_platform *pl, struct libbex_ring_msg *msg)
 {
-	const char *str = *str0, *p;
-	size_t len;
+	struct libbex_channel *ch = msg->ch;
+	int rc = 0;
 
-	if (*str != '"')
+	if (msg->flags & BEX_MSG_CHECKSUM)
+		return checksum_done(ch, ch->priv_checksum(ch, *(int32_t *) msg->data));
+
+	ch->rx_msg = msg;
+
+	if ((msg->flags & BEX_MSG_SNAPSHOT_BEGIN) && ch->priv_snapshot)
+		rc = ch->priv_snapshot(ch);
+	if (!rc && !(msg->flags & BEX_MSG_NODATA)) {
+		if (ch->priv_update)
+			rc = ch->priv_update(ch);
+		if (!rc && ch->callback)
+			rc = call_callback(pl, ch, 0);
+	}
+
+	ch->rx_msg = NULL;
+	return rc;
+}
+
+/* [ data ...] or [[ data ...],[ data ...], ... ] */
+static int process_data(struct libbex_channel *ch, struct libbex_parser *ps, size_t idx)
+{
+	struct libbex_token *tk = &ps->toks[idx];
+	size_t n, nrows = 1;
+	int rc = 0;
+
+	DBG(CHAN, bex_debugobj(ch, "processing data..."));
+
+	/* snapshot or bulk update (BEX_CONF_BULK_UPDATES); array of the rows */
+	if (tk->size && ps->toks[idx + 1].type == BEX_TOKEN_ARRAY) {
+		nrows = tk->size;
+		if (!ch->synced || !ch->conn
+		    || !(ch->conn->conf_flags & BEX_CONF_BULK_UPDATES))
+			ch->snapshot = 1;
+		idx++;
+	} else if (!tk->size) {
+		nrows = 0;		/* empty snapshot */
+		ch->snapshot = 1;
+	}
+
+	if (ch->conn && ch->conn->ring) {
+		rc = queue_rows(ch, ps, idx, nrows);
+		goto done;
+	}
+	if (ch->snapshot && ch->priv_snapshot) {
+		rc = ch->priv_snapshot(ch);
+		if (rc)
+			goto done;
+	}
+	if (ch->batch_callback) {
+		rc = bex_batch_start(ch->batch, ch->reply, nrows);
+		if (rc)
+			goto done;
+	}
+
+	for (n = 0; rc == 0 && n < nrows; n++) {
+		rc = bex_array_fill_unnamed_from_tokens(ch->reply, ps, idx);
+		if (rc)
+			break;
+		if (ch->nfields)
+			fill_reply_struct(ch);
+		if (ch->priv_update) {
+			rc = ch->priv_update(ch);
+			if (rc)
+				break;
+		}
+		if (ch->batch_callback)
+			rc = bex_batch_add_row(ch->batch, ch->reply);
+		else if (ch->callback)
+			rc = call_callback(NULL, ch, 0);
+		idx = ps->toks[idx].next;
+	}
+
+	if (!rc && ch->batch_callback)
+		rc = call_callback(NULL, ch, 1);
+done:
+	if (ch->snapshot) {
+		ch->resync = 0;
+		ch->synced = 1;
+	}
+	ch->snapshot = 0;
+	DBG(CHAN, bex_debugobj(ch, "processing data done [rc=%d]", rc));
+	return rc;
+}
+
+/* "type" */
+static int process_message_type(struct libbex_channel *ch, struct libbex_parser *ps,
+				struct libbex_token *tk)
+{
+	if (tk->len > BEX_CHANNEL_REPLY_TYPE_BUFSZ - 1)
 		return -EINVAL;
 
-	str++;
-	p = strchr(str, '"');
-	if (!p)
+	memcpy(ch->reply_type, bex_token_ptr(ps, tk), tk->len);
+	ch->reply_type[tk->len] = '\0';
+	return 0;
+}
+
+/*
+ * [CHANNEL_ID, ["type",] DATA, SEQ, MTS]; the trailing fields are added by the
+ * exchange for BEX_CONF_SEQ_ALL and BEX_CONF_TIMESTAMP (the heartbeat has no
+ * DATA). The fields are ignored by bex_channel_process(), the unused or
+ * missing numbers are zero.
+ */
+int bex_channel_parse_trailer(struct libbex_parser *ps, uint64_t flags,
+			      uint64_t *seq, uint64_t *mts)
+{
+	ssize_t idx;
+	size_t n = 2;
+
+	*seq = *mts = 0;
+	if (!(flags & (BEX_CONF_SEQ_ALL | BEX_CONF_TIMESTAMP)))
+		return 0;
+
+	idx = bex_parser_get_child(ps, 0, 1);
+	if (idx < 0)
 		return -EINVAL;
+	if (ps->toks[idx].type == BEX_TOKEN_STRING
+	    && !bex_token_streq(ps, &ps->toks[idx], "hb"))
+		n++;			/* "type", DATA */
+
+	if (flags & BEX_CONF_SEQ_ALL) {
+		idx = bex_parser_get_child(ps, 0, n++);
+		if (idx >= 0 && bex_token_get_u64(ps, &ps->toks[idx], seq) != 0)
+			return -EINVAL;
+	}
+	if (flags & BEX_CONF_TIMESTAMP) {
+		idx = bex_parser_get_child(ps, 0, n);
+		if (idx >= 0 && bex_token_get_u64(ps, &ps->toks[idx], mts) != 0)
+			return -EINVAL;
+	}
+	return 0;
+}
 
-	len = p - str;
-	if (len > BEX_CHANNEL_REPLY_TYPE_BUFSZ - 1)
+/*
+ * Process already tokenized channel message, the first token is [CHANNEL_ID, ...]
+ */
+int bex_channel_process(struct libbex_channel *ch, struct libbex_parser *ps)
+{
+	struct libbex_token *tk;
+	ssize_t idx;
+	int rc = 0;
+
+	if (!ch || !ps)
 		return -EINVAL;
 
-	memcpy(ch->reply_type, str, len);
-	ch->reply_type[len] = '\0';
+	DBG(CHAN, bex_debugobj(ch, "process channel %s data", ch->name));
 
-	p = skip_space(p + 1);
-	if (*p == ',')
-		p = skip_space(p + 1);
+	*ch->reply_type = '\0';
 
-	*str0 = p;
-	return 0;
+	idx = bex_parser_get_child(ps, 0, 1);		/* [CHANNEL_ID,  */
+	if (idx < 0)
+		goto done;
+
+	tk = &ps->toks[idx];
+	if (tk->type == BEX_TOKEN_STRING) {
+		if (bex_token_streq(ps, tk, "hb")) {		/* "hb"] */
+			bex_channel_update_heartbeat(ch);
+			goto done;
+		}
+		rc = process_message_type(ch, ps, tk);	/* "tu" ("te", "ws", ...) */
+		if (rc)
+			goto done;
+
+		idx = tk->next;
+		if ((size_t) idx >= ps->ntoks)
+			goto done;
+		tk = &ps->toks[idx];
+	}
+
+	if (tk->type == BEX_TOKEN_ARRAY)
+		rc = process_data(ch, ps, idx);
+	else if (tk->type == BEX_TOKEN_PRIMITIVE && ch->priv_checksum
+		 && strcmp(ch->reply_type, "cs") == 0)
+		rc = process_checksum(ch, ps, idx);
+done:
+	DBG(CHAN, bex_debugobj(ch, "process data done [rc=%d]", rc));
+	return rc;
 }
 
 /**
  * bex_channel_wakeup:
  * @ch: channel
  *
- * Process channel inbuff, call callback, etc.
+ * Process channel inbuff, call callback, etc. Not supported in the threaded
+ * mode, see bex_channel_update_inbuff().
  *
- * Returns: 0 on success or negative number in case of error.
+ * Returns: 0 on success, -EBUSY in the threaded mode or negative number in
+ * case of error.
  */
 int bex_channel_wakeup(struct libbex_channel *ch)
 {
-	const char *p;
+	struct libbex_parser ps = { .str = NULL };
 	int rc = 0;
 
 	if (!ch)
 		return -EINVAL;
+	if (ch->conn && ch->conn->pl->threaded)
+		return -EBUSY;
 
 	DBG(CHAN, bex_debugobj(ch, "wakeup channel %s", ch->name));
 
 	if (!ch->inbuff || !*ch->inbuff)
 		goto done;
 
-	*ch->reply_type = '\0';
-
-	p = strchr(ch->inbuff, ',');		/* [CHANNEL_ID,  */
-	if (!p)
-		goto done;
-
-	p = skip_space(p + 1);
-
-	switch (*p) {
-	case '"':
-		if (strncmp(p, "\"hb\"", 4) == 0) {		/* "hb"] */
-			p = skip_space(p + 4);
-			if (*p == ']')
-				bex_channel_update_heartbeat(ch);
-			break;
-		} else {						/* "tu" ("te", "ws", ...) */
-			rc = process_message_type(ch, &p);
-			if (rc)
-				goto done;
-		}
-		/* fallthrough */
-	case '[':
-		rc = process_data(ch, p);
-		break;
+	rc = bex_parser_tokenize(&ps, ch->inbuff, strlen(ch->inbuff));
+	if (!rc) {
+		bex_channel_parse_trailer(&ps, ch->conn ? ch->conn->conf_flags : 0,
+					  &ch->seq, &ch->mts);
+		rc = bex_channel_process(ch, &ps);
 	}
 
+	bex_deinit_parser(&ps);
 done:
 	DBG(CHAN, bex_debugobj(ch, "wakeup data done [rc=%d]", rc));
-	*ch->inbuff = '\0';
+	if (ch->inbuff)
+		*ch->inbuff = '\0';
 	return rc;
 }
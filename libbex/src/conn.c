@@ -0,0 +1,418 @@
+/*
+ * Copyright (C) 2018 Karel Zak <karel.zak.007@gmail.com>
+ *
+ * This file may be redistributed under the terms of the
+ * GNU Lesser General Public License.
+ */
+
+/*
+ * Private pool of the platform connections. Every connection has own
+ * websocket and own channel IDs (chanId is unique only within the
+ * connection). The channels are assigned to the connections on subscribe,
+ * the connection with a free slot and with the lowest load (recent rate of
+ * the received messages, then number of the channels) is used.
+ *
+ * The lost connection is reconnected by wss_service() with exponential
+ * backoff, the channels of the connection are resubscribed (all requests
+ * at once) and the next snapshots of the subscribed channels are marked as
+ * resync, see bex_channel_is_resync().
+ *
+ * In the threaded mode every connection has own thread, the received channel
+ * messages are parsed by the thread and queued to the connection ring, see
+ * bex_platform_dispatch().
+ */
+#include "bexP.h"
+
+struct libbex_conn *bex_new_conn(struct libbex_platform *pl)
+{
+	struct libbex_conn *conn, **tmp;
+
+	tmp = realloc(pl->conns, (pl->nconns + 1) * sizeof(struct libbex_conn *));
+	if (!tmp)
+		return NULL;
+	pl->conns = tmp;
+
+	conn = calloc(1, sizeof(*conn));
+	if (!conn)
+		return NULL;
+
+	conn->pl = pl;
+	conn->idx = pl->nconns;
+	bex_init_hash(&conn->channels_ids);
+	pthread_mutex_init(&conn->lock, NULL);
+	pl->conns[pl->nconns++] = conn;
+
+	DBG(PLAT, bex_debugobj(conn, "alloc connection #%u", conn->idx));
+	return conn;
+}
+
+void bex_free_conn(struct libbex_conn *conn)
+{
+	if (!conn)
+		return;
+
+	DBG(PLAT, bex_debugobj(conn, "free connection #%u", conn->idx));
+	bex_conn_stop_thread(conn);
+	bex_free_ring(conn->ring);
+	if (conn->wss)
+		wss_disconnect(conn);
+	bex_deinit_hash(&conn->channels_ids);
+	bex_deinit_parser(&conn->parser);
+	pthread_mutex_destroy(&conn->lock);
+	free(conn);
+}
+
+/*
+ * Adds @ch to chanId hash, ID 0 is "unsubscribed" and it's not indexed. The
+ * key is kept in the channel, so the entry is removed even if the ID has been
+ * modified by bex_channel_set_id() after add.
+ */
+int bex_conn_index_channel(struct libbex_conn *conn, struct libbex_channel *ch)
+{
+	int rc;
+
+	if (!ch->id)
+		return 0;
+	DBG(PLAT, bex_debugobj(conn, "#%u: index channel %s [id=%ju]",
+				conn->idx, ch->name, ch->id));
+	bex_conn_lock(conn);
+	rc = bex_hash_insert(&conn->channels_ids, ch->id, ch);
+	if (!rc)
+		ch->hash_id = ch->id;
+	bex_conn_unlock(conn);
+	return rc;
+}
+
+void bex_conn_unindex_channel(struct libbex_conn *conn, struct libbex_channel *ch)
+{
+	bex_conn_lock(conn);
+	/* don't remove another channel with the same ID */
+	if (ch->hash_id && bex_hash_lookup(&conn->channels_ids, ch->hash_id) == ch)
+		bex_hash_remove(&conn->channels_ids, ch->hash_id);
+	ch->hash_id = 0;
+	bex_conn_unlock(conn);
+}
+
+struct libbex_channel *bex_conn_get_channel_by_id(struct libbex_conn *conn, uint64_t id)
+{
+	struct libbex_channel *ch = bex_hash_lookup(&conn->channels_ids, id);
+
+	/* ID modified by bex_channel_set_id() after add */
+	if (ch && ch->id != id)
+		return NULL;
+	return ch;
+}
+
+/* Assigns @ch to the @conn, the not assigned channels use the first connection */
+int bex_conn_assign_channel(struct libbex_conn *conn, struct libbex_channel *ch)
+{
+	struct libbex_platform *pl = conn->pl;
+
+	if (ch->conn == conn)
+		return 0;
+
+	bex_conn_unindex_channel(ch->conn ? ch->conn : pl->conns[0], ch);
+	if (ch->conn)
+		ch->conn->nchannels--;
+
+	DBG(PLAT, bex_debugobj(conn, "#%u: assign channel %s", conn->idx, ch->name));
+	ch->conn = conn;
+	conn->nchannels++;
+	return bex_conn_index_channel(conn, ch);
+}
+
+void bex_platform_unassign_channel(struct libbex_platform *pl, struct libbex_channel *ch)
+{
+	if (!ch->conn)
+		return;
+
+	DBG(PLAT, bex_debugobj(pl, "#%u: unassign channel %s", ch->conn->idx, ch->name));
+	bex_conn_unindex_channel(ch->conn, ch);
+	ch->conn->nchannels--;
+	ch->conn = NULL;
+}
+
+/* the connection load is the number of the messages within a sliding window */
+#define BEX_CONN_LOAD_WINDOW	(10ULL * 1000000000ULL)	/* ns */
+
+static void conn_load_roll(struct libbex_conn *conn, uint64_t now)
+{
+	uint64_t n;
+
+	if (now < conn->load_start + BEX_CONN_LOAD_WINDOW)
+		return;
+	n = (now - conn->load_start) / BEX_CONN_LOAD_WINDOW;
+	conn->load_prev = n == 1 ? conn->load_cur : 0;
+	conn->load_cur = 0;
+	conn->load_start += n * BEX_CONN_LOAD_WINDOW;
+}
+
+/* Counts a received message, @now is bex_get_monotonic_ns() */
+void bex_conn_count_msg(struct libbex_conn *conn, uint64_t now)
+{
+	conn_load_roll(conn, now);
+	conn->load_cur++;
+}
+
+/*
+ * Returns number of the messages received within the last window, the
+ * previous window is weighted by the part still covered by the window.
+ */
+static uint64_t conn_load(struct libbex_conn *conn)
+{
+	uint64_t now = bex_get_monotonic_ns(), left, load;
+
+	bex_conn_lock(conn);
+	conn_load_roll(conn, now);
+	left = (conn->load_start + BEX_CONN_LOAD_WINDOW - now) / 1000000;
+	load = conn->load_cur + conn->load_prev * left / (BEX_CONN_LOAD_WINDOW / 1000000);
+	bex_conn_unlock(conn);
+	return load;
+}
+
+/*
+ * Returns connection for the channel, a new connection is allocated if all
+ * the connections are full.
+ */
+struct libbex_conn *bex_platform_assign_channel(struct libbex_platform *pl,
+						struct libbex_channel *ch)
+{
+	struct libbex_conn *best = NULL;
+	uint64_t best_load = 0;
+	size_t i;
+
+	if (ch->conn)
+		return ch->conn;
+
+	for (i = 0; i < pl->nconns; i++) {
+		struct libbex_conn *conn = pl->conns[i];
+		uint64_t load;
+
+		if (conn->nchannels >= pl->max_channels)
+			continue;
+
+		load = conn_load(conn);
+		if (!best || load < best_load
+		    || (load == best_load && conn->nchannels < best->nchannels)) {
+			best = conn;
+			best_load = load;
+		}
+	}
+
+	if (!best)
+		best = bex_new_conn(pl);
+	if (!best || bex_conn_assign_channel(best, ch) != 0)
+		return NULL;
+	return best;
+}
+
+/*
+ * Allocates connections for all the channels, so the channels are spread
+ * over the connections rather than fill the first connection.
+ */
+int bex_platform_prepare_connections(struct libbex_platform *pl)
+{
+	struct libbex_channel *ch;
+	struct libbex_iter itr;
+	size_t nchannels = 0, needed;
+
+	bex_reset_iter(&itr, BEX_ITER_FORWARD);
+	while (bex_platform_next_channel(pl, &itr, &ch) == 0) {
+		if (ch->conn || (ch->subscribe && !bex_channel_is_subscribed(ch)))
+			nchannels++;
+	}
+
+	needed = (nchannels + pl->max_channels - 1) / pl->max_channels;
+
+	DBG(PLAT, bex_debugobj(pl, "%zu channels, %zu connections needed",
+				nchannels, needed));
+
+	while (pl->nconns < needed) {
+		if (!bex_new_conn(pl))
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+/*
+ * Called by wss.c when established connection is closed. The chanIds are
+ * invalid now, the channels stay assigned to the connection and they are
+ * subscribed again by bex_conn_connected(). Only the channels with already
+ * received data are marked as resync, the pending requests are simply sent
+ * again.
+ */
+void bex_conn_lost(struct libbex_conn *conn)
+{
+	struct libbex_platform *pl = conn->pl;
+	struct libbex_channel *ch;
+	struct libbex_iter itr;
+
+	DBG(PLAT, bex_debugobj(conn, "#%u: connection lost", conn->idx));
+
+	bex_platform_lock(pl);
+	bex_reset_iter(&itr, BEX_ITER_FORWARD);
+	while (bex_platform_next_channel(pl, &itr, &ch) == 0) {
+		if (ch->conn != conn)
+			continue;
+		if (ch->status != BEX_CHANNEL_SUBSCRIBED
+		    && ch->status != BEX_CHANNEL_SUBSCRIBING)
+			continue;
+		if (ch->status == BEX_CHANNEL_SUBSCRIBED)
+			ch->resync = 1;
+		bex_conn_unindex_channel(conn, ch);
+		bex_channel_set_id(ch, 0);
+		bex_channel_set_status(ch, BEX_CHANNEL_UNSUBSCRIBED);
+		ch->resubscribe = 0;
+		ch->reconnect = 1;
+	}
+	bex_platform_unlock(pl);
+
+	conn->lost = 1;
+	conn->conf_sent = 0;			/* per websocket */
+	conn->conf_flags = 0;
+	conn->seq = 0;
+	conn->backoff = 0;			/* the first attempt immediately */
+	timerclear(&conn->next_connect);
+
+	if (pl->connect_callback)
+		pl->connect_callback(pl, conn->idx, -ECONNRESET);
+}
+
+/* Called by wss.c when connected, resubscribes channels of the lost connection */
+void bex_conn_connected(struct libbex_conn *conn)
+{
+	struct libbex_platform *pl = conn->pl;
+	struct libbex_channel *ch;
+	struct libbex_iter itr;
+
+	conn->backoff = 0;
+	conn->nfailed = 0;
+	timerclear(&conn->next_connect);
+
+	if (pl->connect_callback)
+		pl->connect_callback(pl, conn->idx, 0);
+	if (!conn->lost)
+		return;
+
+	conn->lost = 0;
+	conn->nreconnects++;
+	DBG(PLAT, bex_debugobj(conn, "#%u: reconnected, resubscribing", conn->idx));
+
+	bex_platform_lock(pl);
+	bex_reset_iter(&itr, BEX_ITER_FORWARD);
+	while (bex_platform_next_channel(pl, &itr, &ch) == 0) {
+		if (ch->conn == conn && ch->reconnect
+		    && ch->status == BEX_CHANNEL_UNSUBSCRIBED)
+			bex_platform_request_subscribe(pl, ch);
+	}
+	bex_platform_unlock(pl);
+}
+
+/* Called by wss.c when the connection attempt failed, @rc is negative errno */
+void bex_conn_failed(struct libbex_conn *conn, int rc)
+{
+	struct libbex_platform *pl = conn->pl;
+
+	DBG(PLAT, bex_debugobj(conn, "#%u: connect failed [rc=%d]", conn->idx, rc));
+	conn->nfailed++;
+	bex_conn_next_backoff(conn);
+
+	if (pl->connect_callback)
+		pl->connect_callback(pl, conn->idx, rc);
+}
+
+/* returns 1 if the reconnect delay is over */
+int bex_conn_can_connect(struct libbex_conn *conn)
+{
+	struct timeval now;
+
+	if (!timerisset(&conn->next_connect))
+		return 1;
+	gettimeofday(&now, NULL);
+	return !timercmp(&now, &conn->next_connect, <);
+}
+
+/* returns delay (ms) before the next connect attempt, the next delay is doubled */
+unsigned int bex_conn_next_backoff(struct libbex_conn *conn)
+{
+	struct libbex_platform *pl = conn->pl;
+	unsigned int ms = conn->backoff ? conn->backoff : pl->reconnect_timeout;
+	struct timeval now, delay = { .tv_sec = ms / 1000, .tv_usec = (ms % 1000) * 1000 };
+
+	conn->backoff = ms >= pl->reconnect_max / 2 ? pl->reconnect_max : ms * 2;
+
+	gettimeofday(&now, NULL);
+	timeradd(&now, &delay, &conn->next_connect);
+
+	DBG(PLAT, bex_debugobj(conn, "#%u: reconnect in %u ms", conn->idx, ms));
+	return ms;
+}
+
+/* threaded mode; waits for free slot in the ring, NULL if the thread is stopped */
+struct libbex_ring_msg *bex_conn_reserve_msg(struct libbex_conn *conn)
+{
+	struct libbex_ring_msg *msg;
+
+	/* the ring is full, wait for the dispatcher */
+	while (!(msg = bex_ring_reserve(conn->ring))) {
+		if (__atomic_load_n(&conn->stop, __ATOMIC_ACQUIRE))
+			return NULL;
+		sched_yield();
+	}
+	return msg;
+}
+
+/* threaded mode; publishes the reserved message and wakes up the dispatcher */
+void bex_conn_commit_msg(struct libbex_conn *conn)
+{
+	bex_ring_commit(conn->ring);
+	bex_platform_wakeup(conn->pl);
+}
+
+static void *conn_thread(void *data)
+{
+	struct libbex_conn *conn = (struct libbex_conn *) data;
+
+	DBG(PLAT, bex_debugobj(conn, "#%u: thread started", conn->idx));
+	while (!__atomic_load_n(&conn->stop, __ATOMIC_ACQUIRE))
+		wss_service(conn, conn->pl->service_timeout);
+
+	DBG(PLAT, bex_debugobj(conn, "#%u: thread stopped", conn->idx));
+	return NULL;
+}
+
+/* starts thread for connected connection */
+int bex_conn_start_thread(struct libbex_conn *conn)
+{
+	int rc;
+
+	if (conn->ring)
+		return 0;		/* already running */
+	if (!conn->wss)
+		return -ENOTCONN;
+
+	conn->ring = bex_new_ring(BEX_RING_SIZE);
+	if (!conn->ring)
+		return -ENOMEM;
+
+	conn->stop = 0;
+	rc = pthread_create(&conn->thread, NULL, conn_thread, conn);
+	if (rc) {
+		bex_free_ring(conn->ring);
+		conn->ring = NULL;
+		return -rc;
+	}
+	return 0;
+}
+
+/* stops the thread, the ring with not dispatched messages is kept */
+int bex_conn_stop_thread(struct libbex_conn *conn)
+{
+	if (!conn->ring || conn->stop)
+		return 0;
+
+	__atomic_store_n(&conn->stop, 1, __ATOMIC_RELEASE);
+	wss_cancel_service(conn);
+	pthread_join(conn->thread, NULL);
+	return 0;
+}
@@ -0,0 +1,454 @@
+/*
+ * Copyright (C) 2018 Karel Zak <karel.zak.007@gmail.com>
+ *
+ * This file may be redistributed under the terms of the
+ * GNU Lesser General Public License.
+ */
+
+/**
+ * SECTION: decimal
+ * @title: Decimal numbers
+ * @short_description: locale independent parser for prices and amounts
+ *
+ * The exchange sends prices and amounts as decimal numbers (e.g. "6543.2",
+ * "-0.00125" or "1e-8"). The parser converts the string to the exact
+ * fixed-point representation: integer mantissa and number of decimal
+ * places (scale), the value is mantissa * 10^-scale.
+ */
+#include <ctype.h>
+
+#include "bexP.h"
+
+static const int64_t pow10_i64[] = {
+	1LL,
+	10LL,
+	100LL,
+	1000LL,
+	10000LL,
+	100000LL,
+	1000000LL,
+	10000000LL,
+	100000000LL,
+	1000000000LL,
+	10000000000LL,
+	100000000000LL,
+	1000000000000LL,
+	10000000000000LL,
+	100000000000000LL,
+	1000000000000000LL,
+	10000000000000000LL,
+	100000000000000000LL,
+	1000000000000000000LL
+};
+
+/* all the numbers are exactly representable */
+static const long double pow10_ld[] = {
+	1e0L,  1e1L,  1e2L,  1e3L,  1e4L,  1e5L,  1e6L,  1e7L,  1e8L,  1e9L,
+	1e10L, 1e11L, 1e12L, 1e13L, 1e14L, 1e15L, 1e16L, 1e17L, 1e18L
+};
+
+static const double pow10_d[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,
+	1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18
+};
+
+/* multiply @x by 10^@n, returns 0 on success or -ERANGE on overflow */
+static int mul_pow10(uint64_t *x, unsigned int n)
+{
+	if (n > BEX_DECIMAL_MAXSCALE)
+		return *x ? -ERANGE : 0;
+	if (*x > UINT64_MAX / (uint64_t) pow10_i64[n])
+		return -ERANGE;
+	*x *= pow10_i64[n];
+	return 0;
+}
+
+/**
+ * bex_parse_decimal:
+ * @str: number
+ * @sz: size of the @str (does not have to be zero terminated)
+ * @num: returns mantissa
+ * @scale: returns number of decimal places
+ *
+ * Converts decimal number string to fixed-point number. Trailing zeros in
+ * the fractional part are ignored, so "1.500" is 15 with scale 1. The
+ * function does not use locale and does not modify errno.
+ *
+ * Returns: 0 on success, -EINVAL if @str is not a number, -ERANGE if the
+ * number cannot be represented by 64-bit mantissa and scale <= BEX_DECIMAL_MAXSCALE.
+ */
+int bex_parse_decimal(const char *str, size_t sz, int64_t *num, unsigned int *scale)
+{
+	const char *p = str, *end = str + sz;
+	uint64_t x = 0;
+	unsigned int zeros = 0, ndigits = 0;
+	int neg = 0, dot = 0, sc = 0;
+
+	if (p < end && (*p == '-' || *p == '+'))
+		neg = *p++ == '-';
+
+	for (; p < end; p++) {
+		unsigned int d = (unsigned char) *p - '0';
+
+		if (d > 9) {
+			if (*p == '.' && !dot) {
+				dot = 1;
+				continue;
+			}
+			break;
+		}
+		ndigits++;
+
+		/* postpone zeros in fractional part, they may be trailing */
+		if (dot) {
+			sc++;
+			if (d == 0) {
+				zeros++;
+				continue;
+			}
+		}
+		if (mul_pow10(&x, zeros + 1) != 0 || x > UINT64_MAX - d)
+			return -ERANGE;
+		x += d;
+		zeros = 0;
+	}
+	if (!ndigits)
+		return -EINVAL;
+
+	sc -= zeros;				/* ignore trailing zeros */
+
+	/* exponent */
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		int eneg = 0, e = 0;
+
+		if (++p < end && (*p == '-' || *p == '+'))
+			eneg = *p++ == '-';
+		if (p == end)
+			return -EINVAL;
+		for (; p < end; p++) {
+			unsigned int d = (unsigned char) *p - '0';
+
+			if (d > 9)
+				break;
+			if (e < 10000)
+				e = e * 10 + d;
+		}
+		sc += eneg ? e : -e;
+	}
+	if (p != end)
+		return -EINVAL;
+
+	if (x == 0)
+		sc = 0;
+	else if (sc < 0) {
+		if (mul_pow10(&x, -sc) != 0)
+			return -ERANGE;
+		sc = 0;
+	}
+	if (sc > BEX_DECIMAL_MAXSCALE)
+		return -ERANGE;
+	if (x > (uint64_t) INT64_MAX)
+		return -ERANGE;
+
+	*num = neg ? -(int64_t) x : (int64_t) x;
+	*scale = sc;
+	return 0;
+}
+
+/**
+ * bex_decimal_to_float:
+ * @num: mantissa
+ * @scale: number of decimal places
+ *
+ * Returns: @num * 10^-@scale as long double
+ */
+long double bex_decimal_to_float(int64_t num, unsigned int scale)
+{
+	if (scale > BEX_DECIMAL_MAXSCALE)
+		return 0;
+	return (long double) num / pow10_ld[scale];
+}
+
+/**
+ * bex_decimal_to_double:
+ * @num: mantissa
+ * @scale: number of decimal places
+ *
+ * The result is correctly rounded for mantissas up to 2^53.
+ *
+ * Returns: @num * 10^-@scale as double
+ */
+double bex_decimal_to_double(int64_t num, unsigned int scale)
+{
+	if (scale > BEX_DECIMAL_MAXSCALE)
+		return 0;
+	return (double) num / pow10_d[scale];
+}
+
+/**
+ * bex_decimal_rescale:
+ * @num: mantissa
+ * @from: current number of decimal places
+ * @to: requested number of decimal places
+ *
+ * Converts @num to another scale, the lost digits are rounded half away
+ * from zero.
+ *
+ * Returns: 0 on success, -ERANGE on overflow.
+ */
+int bex_decimal_rescale(int64_t *num, unsigned int from, unsigned int to)
+{
+	uint64_t x, d, r;
+	int neg = *num < 0;
+
+	if (from > BEX_DECIMAL_MAXSCALE || to > BEX_DECIMAL_MAXSCALE)
+		return -ERANGE;
+	if (from == to)
+		return 0;
+
+	x = neg ? -(uint64_t) *num : (uint64_t) *num;
+
+	if (to > from) {
+		if (mul_pow10(&x, to - from) != 0 || x > (uint64_t) INT64_MAX)
+			return -ERANGE;
+	} else {
+		d = pow10_i64[from - to];
+		r = x % d;
+		x /= d;
+		if (r >= d - r)
+			x++;
+	}
+
+	*num = neg ? -(int64_t) x : (int64_t) x;
+	return 0;
+}
+
+/**
+ * bex_decimal_snprintf:
+ * @buf: output buffer
+ * @sz: size of the buffer
+ * @fmt: printf-like format with one floating point conversion
+ * @num: mantissa
+ * @scale: number of decimal places
+ *
+ * Prints fixed-point number without conversion to binary floating point.
+ * The @fmt is the same format as used for long double, for example
+ * bex_symbol_get_price_format(), the conversion supports '+', '-', ' ' and
+ * '0' flags, width and precision ("%+7.02Lf").
+ *
+ * Returns: number of characters (without terminating zero) which would
+ * have been written for enough space or <0 on error.
+ */
+int bex_decimal_snprintf(char *buf, size_t sz, const char *fmt,
+			 int64_t num, unsigned int scale)
+{
+	char digits[64], *d = digits;
+	const char *p;
+	size_t len = 0, ndigits;
+	unsigned int width = 0, prec = 6, i;
+	int fl_plus = 0, fl_space = 0, fl_left = 0, fl_zero = 0, done = 0;
+	uint64_t x, ip, fp;
+
+	if (!fmt || scale > BEX_DECIMAL_MAXSCALE)
+		return -EINVAL;
+
+#define out_char(_c) do { \
+		if (len + 1 < sz) \
+			buf[len] = (_c); \
+		len++; \
+	} while (0)
+
+	for (p = fmt; *p; p++) {
+		if (*p != '%' || *(p + 1) == '%') {
+			if (*p == '%')
+				p++;
+			out_char(*p);
+			continue;
+		}
+		if (done)
+			return -EINVAL;	/* only one conversion supported */
+
+		for (p++; *p && strchr("+- 0#", *p); p++) {
+			fl_plus |= *p == '+';
+			fl_space |= *p == ' ';
+			fl_left |= *p == '-';
+			fl_zero |= *p == '0';
+		}
+		for (; isdigit((unsigned char) *p); p++)
+			width = width * 10 + (*p - '0');
+		if (*p == '.') {
+			for (prec = 0, p++; isdigit((unsigned char) *p); p++)
+				prec = prec * 10 + (*p - '0');
+		}
+		while (*p == 'L' || *p == 'l')
+			p++;
+		if (*p != 'f' && *p != 'F')
+			return -EINVAL;
+		if (prec > 32)
+			prec = 32;
+
+		/* round to the requested precision */
+		x = num < 0 ? -(uint64_t) num : (uint64_t) num;
+		if (prec < scale) {
+			uint64_t dv = pow10_i64[scale - prec], r = x % dv;
+
+			x /= dv;
+			if (r >= dv - r)
+				x++;
+			ip = prec ? x / pow10_i64[prec] : x;
+			fp = prec ? x % pow10_i64[prec] : 0;
+			ndigits = prec;
+		} else {
+			ip = x / pow10_i64[scale];
+			fp = x % pow10_i64[scale];
+			ndigits = scale;
+		}
+
+		/* sign, integer part, fractional part */
+		if (num < 0)
+			*d++ = '-';
+		else if (fl_plus)
+			*d++ = '+';
+		else if (fl_space)
+			*d++ = ' ';
+		d += sprintf(d, "%ju", ip);
+		if (prec) {
+			*d++ = '.';
+			if (ndigits)
+				d += sprintf(d, "%0*ju", (int) ndigits, fp);
+			for (i = ndigits; i < prec; i++)
+				*d++ = '0';
+		}
+		*d = '\0';
+
+		ndigits = d - digits;
+		if (!fl_left && width > ndigits) {
+			size_t sign = fl_zero && !isdigit((unsigned char) *digits) ? 1 : 0;
+
+			if (sign)
+				out_char(*digits);
+			for (i = ndigits; i < width; i++)
+				out_char(fl_zero ? '0' : ' ');
+			for (i = sign; i < ndigits; i++)
+				out_char(digits[i]);
+		} else {
+			for (i = 0; i < ndigits; i++)
+				out_char(digits[i]);
+			for (; i < width; i++)
+				out_char(' ');
+		}
+		done = 1;
+	}
+#undef out_char
+
+	if (sz)
+		buf[len < sz ? len : sz - 1] = '\0';
+	return len;
+}
+
+#ifdef TEST_PROGRAM_DECIMAL
+static int test_decimal_snprintf(void)
+{
+	static const struct {
+		const char *fmt;
+		int64_t num;
+		unsigned int scale;
+		const char *res;
+	} tests[] = {
+		{ "%.2Lf",    5,     0, "5.00" },
+		{ "%.0Lf",    5,     0, "5" },
+		{ "%Lf",      5,     0, "5.000000" },
+		{ "%.04Lf",   65432, 1, "6543.2000" },
+		{ "%+7.02Lf", -125,  5, "  -0.00" },
+		{ "%+6.0Lf",  15,    1, "    +2" },
+		{ "x%08.1fy", -15,   1, "x-00001.5y" },
+	};
+	char buf[64];
+	size_t i;
+	int rc = EXIT_SUCCESS;
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++) {
+		bex_decimal_snprintf(buf, sizeof(buf), tests[i].fmt,
+				     tests[i].num, tests[i].scale);
+		if (strcmp(buf, tests[i].res) != 0) {
+			fprintf(stderr, "'%s' %jd/%u: got '%s', expected '%s'\n",
+				tests[i].fmt, (intmax_t) tests[i].num,
+				tests[i].scale, buf, tests[i].res);
+			rc = EXIT_FAILURE;
+		}
+	}
+	return rc;
+}
+
+static int test_decimal_parse(void)
+{
+	static const struct {
+		const char *str;
+		int rc;
+		int64_t num;
+		unsigned int scale;
+	} tests[] = {
+		{ "0",        0, 0,   0 },
+		{ "-0",       0, 0,   0 },
+		{ "+1.5",     0, 15,  1 },
+		{ "-1.5",     0, -15, 1 },
+		{ "007.50",   0, 75,  1 },
+		{ "0.000100", 0, 1,   4 },
+		{ "100",      0, 100, 0 },
+		{ "1.",       0, 1,   0 },
+		{ "1e2",      0, 100, 0 },
+		{ "1.5e-3",   0, 15,  4 },
+		{ "0.1000000000000000000000", 0, 1, 1 },
+		{ "0.000000000000000001",     0, 1, 18 },
+		{ "0.0000000000000000001",    -ERANGE, 0, 0 },
+		{ "1.0000000000000000001",    -ERANGE, 0, 0 },
+		{ "9223372036854775807",  0, INT64_MAX, 0 },
+		{ "-9223372036854775807", 0, -INT64_MAX, 0 },
+		{ "9223372036854775808",  -ERANGE, 0, 0 },
+		{ "99999999999999999999", -ERANGE, 0, 0 },
+		{ "1e19",     -ERANGE, 0, 0 },
+		{ "",         -EINVAL, 0, 0 },
+		{ "-",        -EINVAL, 0, 0 },
+		{ ".",        -EINVAL, 0, 0 },
+		{ "abc",      -EINVAL, 0, 0 },
+		{ "12a",      -EINVAL, 0, 0 },
+		{ "1.2.3",    -EINVAL, 0, 0 },
+		{ "1e",       -EINVAL, 0, 0 },
+		{ " 1",       -EINVAL, 0, 0 },
+	};
+	size_t i;
+	int rc = EXIT_SUCCESS;
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++) {
+		int64_t num = 0;
+		unsigned int scale = 0;
+		int r = bex_parse_decimal(tests[i].str, strlen(tests[i].str),
+					  &num, &scale);
+
+		if (r != tests[i].rc ||
+		    (r == 0 && (num != tests[i].num || scale != tests[i].scale))) {
+			fprintf(stderr, "'%s': got %d %jd/%u, expected %d %jd/%u\n",
+				tests[i].str, r, (intmax_t) num, scale,
+				tests[i].rc, (intmax_t) tests[i].num,
+				tests[i].scale);
+			rc = EXIT_FAILURE;
+		}
+	}
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 2 && strcmp(argv[1], "--snprintf") == 0)
+		return test_decimal_snprintf();
+	if (argc == 2 && strcmp(argv[1], "--parse") == 0)
+		return test_decimal_parse();
+	if (argc == 1)
+		return test_decimal_snprintf() == EXIT_SUCCESS &&
+		       test_decimal_parse() == EXIT_SUCCESS ?
+				EXIT_SUCCESS : EXIT_FAILURE;
+
+	fprintf(stderr, "usage: %s [--snprintf | --parse]\n", argv[0]);
+	exit(EXIT_FAILURE);
+}
+#endif /* TEST_PROGRAM_DECIMAL */
@@ -1,6 +1,5 @@
 
 #include "bexP.h"
-#include "strutils.h"
 
 static void free_event(struct libbex_event *ev)
 {
@@ -34,6 +33,7 @@ struct libbex_event *bex_new_event(const char *name)
 	ev->name = strdup(name);
 	if (!ev->name)
 		goto err;
+	ev->namehash = bex_hash_string(ev->name, strlen(ev->name));
 	INIT_LIST_HEAD(&ev->events);
 	return ev;
 err:
@@ -141,6 +141,10 @@ struct libbex_array *bex_event_get_replies(struct libbex_event *ev)
  * @ev: event
  * @fn: callback function
  *
+ * In the threaded mode (see bex_platform_start_threads()) the callback is
+ * called by the connection thread with the platform lock held, it must not
+ * wait for the thread which calls bex_platform_dispatch().
+ *
  * Returns: 0 or <0 on error
  */
 int bex_event_set_reply_callback(struct libbex_event *ev,
@@ -182,6 +186,20 @@ void *bex_event_get_data(struct libbex_event *ev)
 	return ev->data;
 }
 
+/**
+ * bex_event_get_rx_time
+ * @ev: event
+ *
+ * The reply is stamped when received from the socket, before the reply is
+ * parsed, see bex_channel_get_rx_time().
+ *
+ * Returns: CLOCK_MONOTONIC time in nanoseconds of the last reply or 0.
+ */
+uint64_t bex_event_get_rx_time(struct libbex_event *ev)
+{
+	return ev ? ev->rx_time : 0;
+}
+
 /**
  * bex_event_add_reply:
  * @ev: event
@@ -199,6 +217,7 @@ int bex_event_add_reply(struct libbex_event *ev, struct libbex_value *va)
 		ev->reply = bex_new_array(3);
 		if (!ev->reply)
 			return -ENOMEM;
+		bex_array_enable_arena(ev->reply, 1);
 	}
 
 	return bex_array_add(ev->reply, va);
@@ -227,7 +246,8 @@ int bex_event_remove_reply(struct libbex_event *ev, struct libbex_value *va)
  * @ev: event
  * @str: unparsed data
  *
- * Parse @str and fill reply array.
+ * Parse @str and fill reply array. The values not found in @str are not
+ * modified. The generated values are kept until bex_event_reset_reply().
  *
  * Returns: 0 on success or negative number in case of error.
  */
@@ -253,36 +273,16 @@ void bex_event_reset_reply(struct libbex_event *ev)
 }
 
 
-int bex_is_event_string(const char *str, char **name)
+/*
+ * Like bex_event_update_reply(), but use already tokenized data, @idx is the
+ * object token.
+ */
+int bex_event_update_reply_from_tokens(struct libbex_event *ev,
+				struct libbex_parser *ps, size_t idx)
 {
-	const char *p = (char *) str, *n;
-
-	*name = NULL;
-
-	p = skip_space(p);
-	if (*p != '{')
-		return 0;
-
-	p = skip_space(++p);
-	if (strncmp(p, "\"event\"", 7) != 0)
-		return 0;
-	p += 7;
-
-	p = skip_space(p);
-	if (*p != ':')
-		return 0;
-
-	p = skip_space(++p);
-	if (*p != '"')
-		return 0;
-
-	n = ++p;
-	while (*p && *p != '"')
-		p++;
-
-	if (!*p)
-		return 0;
+	if (!ev || !ps)
+		return -EINVAL;
 
-	*name = strndup(n, p - n);
-	return *name ? 1 : 0;
+	DBG(EVENT, bex_debugobj(ev, "updating reply from tokens"));
+	return bex_array_fill_from_tokens(ev->reply, ps, idx);
 }
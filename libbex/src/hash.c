@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2018 Karel Zak <karel.zak.007@gmail.com>
+ *
+ * This file may be redistributed under the terms of the
+ * GNU Lesser General Public License.
+ */
+
+/*
+ * Private open-addressing hash table (uint64_t key -> pointer) with linear
+ * probing. The table size is always power of 2 and the load factor is kept
+ * below 1/2. Removed entries are not marked as deleted, the next entries in
+ * the same cluster are shifted back, so lookups never walk over tombstones.
+ */
+#include "bexP.h"
+
+#define BEX_HASH_MINSIZE	16
+
+static inline size_t hash_slot(const struct libbex_hash *h, uint64_t key)
+{
+	/* Fibonacci hashing, the keys are usually small sequential numbers */
+	return (size_t) ((key * 0x9E3779B97F4A7C15ULL) >> 32) & (h->size - 1);
+}
+
+/**
+ * bex_hash_string:
+ * @str: string (does not have to be zero terminated)
+ * @len: length of the string
+ *
+ * Returns: 64-bit FNV-1a hash of the string.
+ */
+uint64_t bex_hash_string(const char *str, size_t len)
+{
+	uint64_t x = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		x ^= (unsigned char) str[i];
+		x *= 0x100000001b3ULL;
+	}
+	return x;
+}
+
+void bex_init_hash(struct libbex_hash *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+void bex_deinit_hash(struct libbex_hash *h)
+{
+	free(h->ents);
+	memset(h, 0, sizeof(*h));
+}
+
+/* Removes all entries, the memory is kept for reuse. */
+void bex_reset_hash(struct libbex_hash *h)
+{
+	if (h->ents)
+		memset(h->ents, 0, h->size * sizeof(struct libbex_hash_entry));
+	h->count = 0;
+}
+
+static int hash_resize(struct libbex_hash *h, size_t newsz)
+{
+	struct libbex_hash_entry *old = h->ents;
+	size_t i, oldsz = h->size;
+
+	h->ents = calloc(newsz, sizeof(struct libbex_hash_entry));
+	if (!h->ents) {
+		h->ents = old;
+		return -ENOMEM;
+	}
+	h->size = newsz;
+	h->count = 0;
+
+	for (i = 0; i < oldsz; i++) {
+		if (old[i].data)
+			bex_hash_insert(h, old[i].key, old[i].data);
+	}
+	free(old);
+	return 0;
+}
+
+/**
+ * bex_hash_insert:
+ * @h: hash
+ * @key: key
+ * @data: non-NULL pointer
+ *
+ * Adds @data to the hash, the current data for the @key are replaced.
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_hash_insert(struct libbex_hash *h, uint64_t key, void *data)
+{
+	size_t i;
+
+	if (!data)
+		return -EINVAL;
+	if ((h->count + 1) * 2 > h->size) {
+		int rc = hash_resize(h, h->size ? h->size * 2 : BEX_HASH_MINSIZE);
+		if (rc)
+			return rc;
+	}
+
+	for (i = hash_slot(h, key); h->ents[i].data; i = (i + 1) & (h->size - 1)) {
+		if (h->ents[i].key == key) {
+			h->ents[i].data = data;
+			return 0;
+		}
+	}
+
+	h->ents[i].key = key;
+	h->ents[i].data = data;
+	h->count++;
+	return 0;
+}
+
+/**
+ * bex_hash_lookup:
+ * @h: hash
+ * @key: key
+ *
+ * Returns: data or NULL.
+ */
+void *bex_hash_lookup(const struct libbex_hash *h, uint64_t key)
+{
+	size_t i;
+
+	if (!h->count)
+		return NULL;
+
+	for (i = hash_slot(h, key); h->ents[i].data; i = (i + 1) & (h->size - 1)) {
+		if (h->ents[i].key == key)
+			return h->ents[i].data;
+	}
+	return NULL;
+}
+
+/**
+ * bex_hash_remove:
+ * @h: hash
+ * @key: key
+ *
+ * Returns: removed data or NULL if the @key is not in the hash.
+ */
+void *bex_hash_remove(struct libbex_hash *h, uint64_t key)
+{
+	size_t i, j, mask = h->size - 1;
+	void *data;
+
+	if (!h->count)
+		return NULL;
+
+	for (i = hash_slot(h, key); h->ents[i].data; i = (i + 1) & mask) {
+		if (h->ents[i].key == key)
+			break;
+	}
+	data = h->ents[i].data;
+	if (!data)
+		return NULL;
+
+	/* backward shift deletion */
+	for (j = (i + 1) & mask; h->ents[j].data; j = (j + 1) & mask) {
+		size_t k = hash_slot(h, h->ents[j].key);
+
+		/* move the entry if its home slot is not in (i, j] */
+		if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		h->ents[i] = h->ents[j];
+		i = j;
+	}
+	h->ents[i].data = NULL;
+	h->ents[i].key = 0;
+	h->count--;
+	return data;
+}
+
+#ifdef TEST_PROGRAM_HASH
+#define NKEYS	4096
+
+/* the hash has to agree with @model (key -> data) */
+static int check_hash(const struct libbex_hash *h, void **model, size_t count)
+{
+	size_t i;
+
+	if (h->count != count) {
+		fprintf(stderr, "count %zu, expected %zu\n", h->count, count);
+		return -1;
+	}
+	if (h->size & (h->size - 1) || h->count * 2 > h->size) {
+		fprintf(stderr, "bad size %zu for %zu entries\n", h->size, h->count);
+		return -1;
+	}
+	for (i = 0; i < NKEYS; i++) {
+		if (bex_hash_lookup(h, i) != model[i]) {
+			fprintf(stderr, "key %zu: lookup mismatch\n", i);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int test_hash_grow(void)
+{
+	static void *model[NKEYS];
+	struct libbex_hash h;
+	size_t i, size = 0;
+	int rc = EXIT_SUCCESS;
+
+	bex_init_hash(&h);
+	for (i = 0; i < NKEYS; i++) {
+		model[i] = &model[i];
+		if (bex_hash_insert(&h, i, model[i]) != 0) {
+			rc = EXIT_FAILURE;
+			break;
+		}
+		if (h.size != size) {
+			if (check_hash(&h, model, i + 1) != 0) {
+				rc = EXIT_FAILURE;
+				break;
+			}
+			size = h.size;
+		}
+	}
+	if (rc == EXIT_SUCCESS && check_hash(&h, model, NKEYS) != 0)
+		rc = EXIT_FAILURE;
+
+	/* replace */
+	if (rc == EXIT_SUCCESS) {
+		bex_hash_insert(&h, 7, &model[8]);
+		model[7] = &model[8];
+		if (check_hash(&h, model, NKEYS) != 0)
+			rc = EXIT_FAILURE;
+	}
+
+	bex_reset_hash(&h);
+	if (rc == EXIT_SUCCESS && (h.count || bex_hash_lookup(&h, 7)))
+		rc = EXIT_FAILURE;
+
+	bex_deinit_hash(&h);
+	return rc;
+}
+
+static int test_hash_random(void)
+{
+	static void *model[NKEYS];
+	struct libbex_hash h;
+	size_t count = 0;
+	int i, rc = EXIT_SUCCESS;
+
+	bex_init_hash(&h);
+	memset(model, 0, sizeof(model));
+	srand(42);
+
+	/* small key space, so the clusters are often removed from the middle */
+	for (i = 0; i < 200000 && rc == EXIT_SUCCESS; i++) {
+		size_t key = rand() % (i < 100000 ? 256 : NKEYS);
+
+		if (rand() % 3) {
+			if (!model[key])
+				count++;
+			model[key] = &model[(key + i) % NKEYS];
+			if (bex_hash_insert(&h, key, model[key]) != 0)
+				rc = EXIT_FAILURE;
+		} else {
+			if (bex_hash_remove(&h, key) != model[key]) {
+				fprintf(stderr, "key %zu: remove mismatch\n", key);
+				rc = EXIT_FAILURE;
+			}
+			if (model[key])
+				count--;
+			model[key] = NULL;
+		}
+		if (i % 1000 == 0 && check_hash(&h, model, count) != 0)
+			rc = EXIT_FAILURE;
+	}
+	if (rc == EXIT_SUCCESS && check_hash(&h, model, count) != 0)
+		rc = EXIT_FAILURE;
+
+	bex_deinit_hash(&h);
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 2 && strcmp(argv[1], "--grow") == 0)
+		return test_hash_grow();
+	if (argc == 2 && strcmp(argv[1], "--random") == 0)
+		return test_hash_random();
+	if (argc == 1)
+		return test_hash_grow() == EXIT_SUCCESS &&
+		       test_hash_random() == EXIT_SUCCESS ?
+				EXIT_SUCCESS : EXIT_FAILURE;
+
+	fprintf(stderr, "usage: %s [--grow | --random]\n", argv[0]);
+	exit(EXIT_FAILURE);
+}
+#endif /* TEST_PROGRAM_HASH */
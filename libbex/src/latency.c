@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2018 Karel Zak <karel.zak.007@gmail.com>
+ *
+ * This file may be redistributed under the terms of the
+ * GNU Lesser General Public License.
+ */
+
+/*
+ * Private latency histograms, see bex_channel_get_latency_stats().
+ *
+ * The values (nanoseconds) are counted in log-bucketed histograms: every
+ * power of 2 is split to BEX_LATENCY_SUBBUCKETS linear buckets, so the
+ * relative error is at most 1/16 for the whole range. The update is O(1)
+ * and the histograms are allocated when enabled.
+ */
+#include "bexP.h"
+
+#define BEX_LATENCY_SUBBITS	4
+#define BEX_LATENCY_SUBBUCKETS	(1 << BEX_LATENCY_SUBBITS)
+#define BEX_LATENCY_MAXBITS	40	/* 2^40 ns is ~18 minutes */
+#define BEX_LATENCY_NBUCKETS	((BEX_LATENCY_MAXBITS - BEX_LATENCY_SUBBITS + 1) \
+				 * BEX_LATENCY_SUBBUCKETS)
+
+struct libbex_histogram {
+	uint64_t	count;
+	uint64_t	sum;
+	uint64_t	min;
+	uint64_t	max;
+	uint64_t	buckets[BEX_LATENCY_NBUCKETS];
+};
+
+struct libbex_latency {
+	struct libbex_histogram	hist[BEX_LATENCY_NTYPES];
+	int64_t			clock_offset;	/* CLOCK_REALTIME - CLOCK_MONOTONIC */
+};
+
+struct libbex_latency *bex_new_latency(void)
+{
+	struct libbex_latency *lt = calloc(1, sizeof(*lt));
+
+	if (lt)
+		bex_reset_latency(lt);
+	return lt;
+}
+
+void bex_free_latency(struct libbex_latency *lt)
+{
+	free(lt);
+}
+
+void bex_reset_latency(struct libbex_latency *lt)
+{
+	struct timespec rt;
+	size_t i;
+
+	memset(lt->hist, 0, sizeof(lt->hist));
+	for (i = 0; i < BEX_LATENCY_NTYPES; i++)
+		lt->hist[i].min = UINT64_MAX;
+
+	/* to compare the exchange time with the monotonic receive time */
+	clock_gettime(CLOCK_REALTIME, &rt);
+	lt->clock_offset = (int64_t) ((uint64_t) rt.tv_sec * 1000000000ULL + rt.tv_nsec)
+			 - (int64_t) bex_get_monotonic_ns();
+}
+
+static inline size_t bucket_index(uint64_t x)
+{
+	unsigned int e;
+
+	if (x < BEX_LATENCY_SUBBUCKETS)
+		return x;
+
+	e = 63 - __builtin_clzll(x);
+	if (e >= BEX_LATENCY_MAXBITS)
+		return BEX_LATENCY_NBUCKETS - 1;
+
+	return (e - BEX_LATENCY_SUBBITS + 1) * BEX_LATENCY_SUBBUCKETS
+		+ ((x >> (e - BEX_LATENCY_SUBBITS)) - BEX_LATENCY_SUBBUCKETS);
+}
+
+/* the highest value of the bucket */
+static uint64_t bucket_value(size_t idx)
+{
+	size_t shift;
+
+	if (idx < BEX_LATENCY_SUBBUCKETS)
+		return idx;
+
+	shift = idx / BEX_LATENCY_SUBBUCKETS - 1;
+	return ((uint64_t) (BEX_LATENCY_SUBBUCKETS + idx % BEX_LATENCY_SUBBUCKETS + 1)
+			<< shift) - 1;
+}
+
+void bex_latency_update(struct libbex_latency *lt, int type, uint64_t ns)
+{
+	struct libbex_histogram *h = &lt->hist[type];
+
+	h->buckets[bucket_index(ns)]++;
+	h->count++;
+	h->sum += ns;
+	if (ns < h->min)
+		h->min = ns;
+	if (ns > h->max)
+		h->max = ns;
+}
+
+/* @mts is the exchange time in milliseconds, @rx_time is bex_get_monotonic_ns() */
+void bex_latency_update_exchange(struct libbex_latency *lt, uint64_t mts, uint64_t rx_time)
+{
+	int64_t diff = (int64_t) rx_time + lt->clock_offset - (int64_t) (mts * 1000000ULL);
+
+	/* the exchange clock is ahead */
+	bex_latency_update(lt, BEX_LATENCY_EXCHANGE, diff > 0 ? (uint64_t) diff : 0);
+}
+
+/* @q is in parts per thousand */
+static uint64_t percentile(struct libbex_histogram *h, uint64_t q)
+{
+	uint64_t rank = (h->count * q + 999) / 1000, n = 0;
+	size_t i;
+
+	if (!rank)
+		rank = 1;
+	for (i = 0; i < BEX_LATENCY_NBUCKETS; i++) {
+		n += h->buckets[i];
+		if (n >= rank)
+			return min(bucket_value(i), h->max);
+	}
+	return h->max;
+}
+
+int bex_latency_get_stats(struct libbex_latency *lt, int type,
+			  struct libbex_latency_stats *st)
+{
+	struct libbex_histogram *h;
+
+	if (type < 0 || type >= BEX_LATENCY_NTYPES)
+		return -EINVAL;
+
+	h = &lt->hist[type];
+	memset(st, 0, sizeof(*st));
+	if (!h->count)
+		return 0;
+
+	st->count = h->count;
+	st->min = h->min;
+	st->max = h->max;
+	st->mean = h->sum / h->count;
+	st->p50 = percentile(h, 500);
+	st->p99 = percentile(h, 990);
+	st->p999 = percentile(h, 999);
+	return 0;
+}
@@ -0,0 +1,357 @@
+/*
+ * Copyright (C) 2018 Karel Zak <karel.zak.007@gmail.com>
+ *
+ * This file may be redistributed under the terms of the
+ * GNU Lesser General Public License.
+ */
+
+/**
+ * SECTION: parser
+ * @title: Tokenizer
+ * @short_description: single-pass JSON tokenizer
+ *
+ * The tokenizer scans the whole received frame only once and produces
+ * (offset, length, type) spans. The spans point to the original buffer,
+ * nothing is copied or unescaped.
+ */
+#include "bexP.h"
+
+#define BEX_PARSER_MINTOKENS	64
+
+/**
+ * bex_reset_parser:
+ * @ps: parser
+ *
+ * Forgets tokens from the last frame, allocated memory is kept for reuse.
+ */
+void bex_reset_parser(struct libbex_parser *ps)
+{
+	ps->str = NULL;
+	ps->len = 0;
+	ps->end = 0;
+	ps->ntoks = 0;
+	ps->depth = 0;
+}
+
+/**
+ * bex_deinit_parser:
+ * @ps: parser
+ *
+ * Deallocates parser tokens.
+ */
+void bex_deinit_parser(struct libbex_parser *ps)
+{
+	free(ps->toks);
+	free(ps->bits);
+	memset(ps, 0, sizeof(*ps));
+}
+
+static struct libbex_token *new_token(struct libbex_parser *ps, int type, size_t start)
+{
+	struct libbex_token *tk;
+
+	if (ps->ntoks == ps->nalloc) {
+		size_t newsz = ps->nalloc ? ps->nalloc * 2 : BEX_PARSER_MINTOKENS;
+		void *tmp = realloc(ps->toks, newsz * sizeof(struct libbex_token));
+
+		if (!tmp)
+			return NULL;
+		DBG(PARSE, bex_debugobj(ps, " resize %zu -> %zu", ps->nalloc, newsz));
+		ps->toks = tmp;
+		ps->nalloc = newsz;
+	}
+
+	if (ps->depth)
+		ps->toks[ps->stack[ps->depth - 1]].size++;
+
+	tk = &ps->toks[ps->ntoks++];
+	tk->type = type;
+	tk->start = start;
+	tk->len = 0;
+	tk->size = 0;
+	tk->next = ps->ntoks;
+	return tk;
+}
+
+static inline int is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/* Adds primitive (number, true, ...) from the area between two structural
+ * characters. Returns 1 if added, 0 if there is nothing or <0 on error. */
+static int add_primitive(struct libbex_parser *ps, size_t start, size_t end)
+{
+	struct libbex_token *tk;
+
+	while (start < end && is_space(ps->str[start]))
+		start++;
+	while (end > start && is_space(ps->str[end - 1]))
+		end--;
+	if (start == end)
+		return 0;
+
+	tk = new_token(ps, BEX_TOKEN_PRIMITIVE, start);
+	if (!tk)
+		return -ENOMEM;
+	tk->len = end - start;
+	return 1;
+}
+
+/**
+ * bex_parser_tokenize:
+ * @ps: parser
+ * @str: data (does not have to be zero terminated)
+ * @len: size of the data
+ *
+ * Splits the first JSON value from @str to tokens. The value is usually
+ * object or array, the rest of the @str behind the value is ignored,
+ * see ps->end.
+ *
+ * The data are scanned only once by bex_scan_structurals(), the tokens are
+ * generated from the bitmap of the structural characters.
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_parser_tokenize(struct libbex_parser *ps, const char *str, size_t len)
+{
+	struct libbex_token *tk;
+	size_t w, nwords, pos = 0, string = 0;
+	int rc;
+
+	bex_reset_parser(ps);
+	ps->str = str;
+	ps->len = len;
+
+	nwords = (len + 63) / 64;
+	if (ps->nbits < nwords) {
+		void *tmp = realloc(ps->bits, nwords * sizeof(uint64_t));
+
+		if (!tmp)
+			return -ENOMEM;
+		ps->bits = tmp;
+		ps->nbits = nwords;
+	}
+
+	if (bex_scan_structurals(str, len, ps->bits) != 0)
+		goto err;
+
+	for (w = 0; w < nwords; w++) {
+		uint64_t bits = ps->bits[w];
+
+		while (bits) {
+			size_t i = w * 64 + __builtin_ctzll(bits);
+			char c = str[i];
+
+			bits &= bits - 1;
+
+			if (c == '"') {
+				if (!string) {			/* open */
+					if (add_primitive(ps, pos, i) != 0)
+						goto err;
+					string = i + 1;
+					continue;
+				}
+				tk = new_token(ps, BEX_TOKEN_STRING, string);
+				if (!tk)
+					return -ENOMEM;
+				tk->len = i - string;		/* close */
+				string = 0;
+				pos = i + 1;
+				if (!ps->depth) {
+					ps->end = pos;
+					goto done;
+				}
+				continue;
+			}
+
+			rc = add_primitive(ps, pos, i);
+			if (rc < 0)
+				return rc;
+			pos = i + 1;
+
+			switch (c) {
+			case '{':
+			case '[':
+				if (rc || ps->depth == BEX_PARSER_MAXDEPTH)
+					goto err;
+				tk = new_token(ps, c == '{' ? BEX_TOKEN_OBJECT :
+							      BEX_TOKEN_ARRAY, i);
+				if (!tk)
+					return -ENOMEM;
+				ps->stack[ps->depth++] = ps->ntoks - 1;
+				break;
+			case '}':
+			case ']':
+				if (!ps->depth)
+					goto err;
+				tk = &ps->toks[ps->stack[--ps->depth]];
+				if (tk->type != (c == '}' ? BEX_TOKEN_OBJECT : BEX_TOKEN_ARRAY))
+					goto err;
+				tk->len = i + 1 - tk->start;
+				tk->next = ps->ntoks;
+				if (!ps->depth) {
+					ps->end = pos;
+					goto done;
+				}
+				break;
+			default:			/* ',' or ':' */
+				if (!ps->depth)
+					goto err;
+				break;
+			}
+		}
+	}
+
+	/* primitive without container */
+	if (!ps->depth && !ps->ntoks && add_primitive(ps, pos, len) == 1) {
+		ps->end = ps->toks[0].start + ps->toks[0].len;
+		goto done;
+	}
+err:
+	DBG(PARSE, bex_debugobj(ps, "failed to parse >>>%.*s<<<", (int) len, str));
+	bex_reset_parser(ps);
+	return -EINVAL;
+done:
+	DBG(PARSE, bex_debugobj(ps, "%zu tokens [end=%zu]", ps->ntoks, ps->end));
+	return 0;
+}
+
+/**
+ * bex_parser_get_token:
+ * @ps: parser
+ * @idx: token index
+ *
+ * Returns: token or NULL if @idx out of range.
+ */
+struct libbex_token *bex_parser_get_token(struct libbex_parser *ps, size_t idx)
+{
+	return idx < ps->ntoks ? &ps->toks[idx] : NULL;
+}
+
+/**
+ * bex_parser_get_child:
+ * @ps: parser
+ * @idx: object or array token index
+ * @n: child number
+ *
+ * Note that object children are keys and values, so the value of the
+ * n-th key is child number n * 2 + 1.
+ *
+ * Returns: index of the child token or -1.
+ */
+ssize_t bex_parser_get_child(struct libbex_parser *ps, size_t idx, size_t n)
+{
+	struct libbex_token *tk = bex_parser_get_token(ps, idx);
+	size_t i;
+
+	if (!tk || n >= tk->size)
+		return -1;
+
+	for (i = idx + 1; n > 0; n--)
+		i = ps->toks[i].next;
+	return i;
+}
+
+/**
+ * bex_parser_object_get:
+ * @ps: parser
+ * @idx: object token index
+ * @key: name
+ *
+ * Returns: index of the value token or -1.
+ */
+ssize_t bex_parser_object_get(struct libbex_parser *ps, size_t idx, const char *key)
+{
+	struct libbex_token *tk = bex_parser_get_token(ps, idx);
+	size_t i, n;
+
+	if (!tk || tk->type != BEX_TOKEN_OBJECT)
+		return -1;
+
+	for (n = 0, i = idx + 1; n + 1 < tk->size; n += 2) {
+		struct libbex_token *k = &ps->toks[i];
+
+		if (k->type == BEX_TOKEN_STRING && bex_token_streq(ps, k, key))
+			return k->next;
+		i = ps->toks[k->next].next;
+	}
+	return -1;
+}
+
+/**
+ * bex_token_streq:
+ * @ps: parser
+ * @tk: token
+ * @str: zero terminated string
+ *
+ * Returns: 1 if the token is the same as @str.
+ */
+int bex_token_streq(struct libbex_parser *ps, struct libbex_token *tk, const char *str)
+{
+	size_t len = strlen(str);
+
+	return tk->len == len && memcmp(ps->str + tk->start, str, len) == 0;
+}
+
+/**
+ * bex_token_get_u64:
+ * @ps: parser
+ * @tk: token
+ * @num: returns number
+ *
+ * Unlike strtoumax() this function does not require zero terminated string.
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_token_get_u64(struct libbex_parser *ps, struct libbex_token *tk, uint64_t *num)
+{
+	const char *p = ps->str + tk->start;
+	size_t i;
+	uint64_t x = 0;
+
+	if (tk->type != BEX_TOKEN_PRIMITIVE || !tk->len)
+		return -EINVAL;
+
+	for (i = 0; i < tk->len; i++) {
+		unsigned int d = (unsigned char) p[i] - '0';
+
+		if (d > 9)
+			return -EINVAL;
+		if (x > (UINT64_MAX - d) / 10)
+			return -ERANGE;
+		x = x * 10 + d;
+	}
+
+	*num = x;
+	return 0;
+}
+
+/**
+ * bex_token_get_s64:
+ * @ps: parser
+ * @tk: token
+ * @num: returns number
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_token_get_s64(struct libbex_parser *ps, struct libbex_token *tk, int64_t *num)
+{
+	struct libbex_token x = *tk;
+	uint64_t u;
+	int neg = 0, rc;
+
+	if (x.type == BEX_TOKEN_PRIMITIVE && x.len && ps->str[x.start] == '-') {
+		neg = 1;
+		x.start++;
+		x.len--;
+	}
+	rc = bex_token_get_u64(ps, &x, &u);
+	if (rc)
+		return rc;
+	if (u > (uint64_t) INT64_MAX + neg)
+		return -ERANGE;
+
+	*num = neg ? (int64_t) (0 - u) : (int64_t) u;
+	return 0;
+}
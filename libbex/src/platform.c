@@ -9,6 +9,8 @@ static void free_platform(struct libbex_platform *pl)
 		return;
 
 	DBG(PLAT, bex_debugobj(pl, "free"));
+	bex_platform_stop_threads(pl);
+
 	while (!list_empty(&pl->events)) {
 		struct libbex_event *ev = list_entry(pl->events.next,
 				                  struct libbex_event, events);
@@ -21,12 +23,40 @@ static void free_platform(struct libbex_platform *pl)
 		bex_platform_remove_channel(pl, ch);
 	}
 
+	while (pl->nconns > 0)
+		bex_free_conn(pl->conns[--pl->nconns]);
+	free(pl->conns);
+	free(pl->pollfds);
+	bex_free_capture(pl->capture);
+
+	bex_deinit_hash(&pl->events_names);
+	pthread_mutex_destroy(&pl->lock);
+	pthread_mutex_destroy(&pl->rx_lock);
+	pthread_cond_destroy(&pl->rx_cond);
 	free(pl->uri_path);
 	free(pl->uri_addr);
 	free(pl->uri_prot);
 	free(pl);
 }
 
+/* recursive, the events callbacks may call platform functions */
+static void init_lock(struct libbex_platform *pl)
+{
+	pthread_mutexattr_t attr;
+	pthread_condattr_t cattr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&pl->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	pthread_mutex_init(&pl->rx_lock, NULL);
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&pl->rx_cond, &cattr);
+	pthread_condattr_destroy(&cattr);
+}
+
 /**
  * bex_new_platform:
  * @uri: platform address
@@ -46,6 +76,7 @@ struct libbex_platform *bex_new_platform(const char *uri)
 	if (!pl)
 		goto err;
 	DBG(PLAT, bex_debugobj(pl, "alloc"));
+	init_lock(pl);
 
 	/* libwebsocket modifies URI */
 	if (!(_uri = strdup(uri)))
@@ -53,7 +84,11 @@ struct libbex_platform *bex_new_platform(const char *uri)
 
 	pl->service_timeout = 250;
 	pl->reconnect_timeout = 500;
+	pl->reconnect_max = 30000;
 	pl->connection_attempts = 5;
+	pl->connect_timeout = 10000;
+	pl->max_channels = BEX_CONN_MAXCHANNELS;
+	pl->capture_size = BEX_CAPTURE_SIZE;
 	pl->uri_port = 443;
 
 	if (lws_parse_uri(_uri, &prot, &addr, &pl->uri_port, &p))
@@ -85,6 +120,11 @@ struct libbex_platform *bex_new_platform(const char *uri)
 	pl->refcount = 1;
 	INIT_LIST_HEAD(&pl->events);
 	INIT_LIST_HEAD(&pl->channels);
+	bex_init_hash(&pl->events_names);
+
+	/* the default connection */
+	if (!bex_new_conn(pl))
+		goto err;
 
 	DBG(PLAT, bex_debugobj(pl, "protocol=%s, address=%s, port=%d, path=%s [SSL=%s]",
 				pl->uri_prot, pl->uri_addr,
@@ -104,11 +144,137 @@ int bex_platform_set_timeout(struct libbex_platform *pl, int ms)
 	return 0;
 }
 
+/**
+ * bex_platform_set_reconnect_timeout:
+ * @pl: platform
+ * @ms: the first reconnect delay in milliseconds
+ * @max: maximal delay in milliseconds
+ *
+ * The lost connection is reconnected immediately, the next attempts are
+ * delayed, the delay is doubled after every failed attempt up to @max. The
+ * defaults are 500 and 30000 ms.
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_platform_set_reconnect_timeout(struct libbex_platform *pl,
+				       unsigned int ms, unsigned int max)
+{
+	if (!pl || !ms || max < ms)
+		return -EINVAL;
+	pl->reconnect_timeout = ms;
+	pl->reconnect_max = max;
+	return 0;
+}
+
+/**
+ * bex_platform_get_nreconnects:
+ * @pl: platform
+ *
+ * Returns: number of the successful reconnects of all the connections.
+ */
+unsigned int bex_platform_get_nreconnects(struct libbex_platform *pl)
+{
+	unsigned int n = 0;
+	size_t i;
+
+	for (i = 0; pl && i < pl->nconns; i++)
+		n += pl->conns[i]->nreconnects;
+	return n;
+}
+
 const char *bex_platform_get_address(struct libbex_platform *pl)
 {
 	return pl->uri_addr;
 }
 
+/**
+ * bex_platform_set_max_channels:
+ * @pl: platform
+ * @n: maximal number of channels per connection
+ *
+ * The exchange limits number of the channels per connection. The platform
+ * opens more connections if necessary, the channels are spread over the
+ * connections on subscribe. The default is 25.
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_platform_set_max_channels(struct libbex_platform *pl, unsigned int n)
+{
+	if (!pl || !n)
+		return -EINVAL;
+	pl->max_channels = n;
+	return 0;
+}
+
+/**
+ * bex_platform_set_capture:
+ * @pl: platform
+ * @path: segment files prefix or NULL
+ *
+ * Appends all the received and sent frames to the capture segments
+ * <path>.<N> (the first not existing N is used). The segment starts with
+ * struct libbex_capture_header, every frame is prefixed by struct
+ * libbex_capture_record. The full segment is truncated to the used size and
+ * replaced by the next segment, see bex_platform_set_capture_size(). The next
+ * segment is opened and preallocated in advance by a capture thread, so the
+ * receive path does not wait for the filesystem. If the next segment cannot
+ * be opened, the frames which don't fit the current segment are not
+ * captured.
+ *
+ * The capture cannot be changed while the connection threads are running.
+ * Use NULL @path to stop the capture.
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_platform_set_capture(struct libbex_platform *pl, const char *path)
+{
+	struct libbex_capture *cap = NULL;
+
+	if (!pl)
+		return -EINVAL;
+	if (pl->threaded)
+		return -EBUSY;
+
+	if (path) {
+		cap = bex_new_capture(path, pl->capture_size);
+		if (!cap)
+			return -errno;
+	}
+
+	bex_free_capture(pl->capture);
+	pl->capture = cap;
+	return 0;
+}
+
+/**
+ * bex_platform_set_capture_size:
+ * @pl: platform
+ * @size: segment size in bytes
+ *
+ * Sets maximal size of the capture segments, the default is 64 MiB. The
+ * size is used for the next bex_platform_set_capture().
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_platform_set_capture_size(struct libbex_platform *pl, size_t size)
+{
+	if (!pl || size < 4096)
+		return -EINVAL;
+	pl->capture_size = size;
+	return 0;
+}
+
+/**
+ * bex_platform_get_nconnections:
+ * @pl: platform
+ *
+ * Returns: number of the connections (connected or not).
+ */
+size_t bex_platform_get_nconnections(struct libbex_platform *pl)
+{
+	return pl ? pl->nconns : 0;
+}
+
 /**
  * bex_ref_platform:
  * @pl: platform pointer
@@ -137,6 +303,27 @@ void bex_unref_platform(struct libbex_platform *pl)
 	}
 }
 
+static inline int event_name_eq(struct libbex_event *ev, const char *name, size_t len)
+{
+	return strncmp(ev->name, name, len) == 0 && ev->name[len] == '\0';
+}
+
+/* Slow path, used for hash collisions only */
+static struct libbex_event *lookup_event(struct libbex_platform *pl,
+					 const char *name, size_t len)
+{
+	struct libbex_event *ev;
+	struct libbex_iter itr;
+
+	bex_reset_iter(&itr, BEX_ITER_FORWARD);
+
+	while (bex_platform_next_event(pl, &itr, &ev) == 0) {
+		if (event_name_eq(ev, name, len))
+			return ev;
+	}
+	return NULL;
+}
+
 /**
  * bex_platform_add_event:
  * @pl: tab pointer
@@ -153,8 +340,18 @@ int bex_platform_add_event(struct libbex_platform *pl, struct libbex_event *ev)
 	if (!pl || !ev)
 		return -EINVAL;
 
+	bex_platform_lock(pl);
+
+	/* the first event with the name wins (as for the list walk) */
+	if (!bex_hash_lookup(&pl->events_names, ev->namehash)
+	    && bex_hash_insert(&pl->events_names, ev->namehash, ev) != 0) {
+		bex_platform_unlock(pl);
+		return -ENOMEM;
+	}
+
 	bex_ref_event(ev);
 	list_add_tail(&ev->events, &pl->events);
+	bex_platform_unlock(pl);
 
 	DBG(PLAT, bex_debugobj(pl, "add event: %s [%p]", ev->name, ev));
 	return 0;
@@ -179,9 +376,27 @@ int bex_platform_remove_event(struct libbex_platform *pl, struct libbex_event *e
 
 	DBG(PLAT, bex_debugobj(pl, "removing event %s [%p]", ev->name, ev));
 
+	bex_platform_lock(pl);
 	list_del(&ev->events);
 	INIT_LIST_HEAD(&ev->events);	/* otherwise EV still points to the list */
 
+	if (bex_hash_lookup(&pl->events_names, ev->namehash) == ev) {
+		struct libbex_event *x;
+		struct libbex_iter itr;
+
+		bex_hash_remove(&pl->events_names, ev->namehash);
+
+		/* re-index another event with the same hash */
+		bex_reset_iter(&itr, BEX_ITER_FORWARD);
+		while (bex_platform_next_event(pl, &itr, &x) == 0) {
+			if (x->namehash == ev->namehash) {
+				bex_hash_insert(&pl->events_names, x->namehash, x);
+				break;
+			}
+		}
+	}
+	bex_platform_unlock(pl);
+
 	bex_unref_event(ev);
 	return 0;
 }
@@ -213,32 +428,42 @@ int bex_platform_next_event(struct libbex_platform *pl, struct libbex_iter *itr,
 	return rc;
 }
 
-struct libbex_event *bex_platform_get_event(struct libbex_platform *pl, const char *name)
+/*
+ * Returns event for the name from the received data. The names are hashed
+ * when added to the platform, so nothing is allocated or compared with all
+ * the events.
+ */
+struct libbex_event *bex_platform_get_event_by_span(struct libbex_platform *pl,
+					const char *name, size_t len)
 {
 	struct libbex_event *ev;
-	struct libbex_iter itr;
 
-	bex_reset_iter(&itr, BEX_ITER_FORWARD);
+	ev = bex_hash_lookup(&pl->events_names, bex_hash_string(name, len));
+	if (!ev)
+		return NULL;
+	if (event_name_eq(ev, name, len))
+		return ev;
 
-	while (bex_platform_next_event(pl, &itr, &ev) == 0) {
-		if (strcmp(ev->name, name) == 0)
-			return ev;
-	}
+	DBG(PLAT, bex_debugobj(pl, "event name hash collision"));
+	return lookup_event(pl, name, len);
+}
 
-	return NULL;
+struct libbex_event *bex_platform_get_event(struct libbex_platform *pl, const char *name)
+{
+	if (!pl || !name)
+		return NULL;
+	return bex_platform_get_event_by_span(pl, name, strlen(name));
 }
 
-int bex_platform_send_event(struct libbex_platform *pl, struct libbex_event *ev)
+static int send_event(struct libbex_conn *conn, struct libbex_event *ev)
 {
 	int rc = 0;
 	size_t sz = 0;
 	char *str;
 	FILE *stream;
 
-	if (!ev || !pl)
-		return -EINVAL;
-
-	DBG(PLAT, bex_debugobj(pl, "emitting event %s [%p]", ev->name, ev));
+	DBG(PLAT, bex_debugobj(conn->pl, "#%u: emitting event %s [%p]",
+				conn->idx, ev->name, ev));
 
 	stream = open_memstream(&str, &sz);
 	if (!stream)
@@ -256,183 +481,845 @@ int bex_platform_send_event(struct libbex_platform *pl, struct libbex_event *ev)
 	fputs(" }", stream);
         fclose(stream);
 
-	if (!rc)
-		rc = bex_platform_send(pl, (unsigned char *) str, sz);
+	if (!rc) {
+		DBG(PLAT, bex_debugobj(conn->pl, "sending: [sz=%zu] >>>%s<<<", sz, str));
+		rc = wss_send(conn, (unsigned char *) str, sz);
+	}
 	if (rc)
 		free(str);	/* free on error */
 
 	return rc;
 }
 
-int bex_platform_receive_event(struct libbex_platform *pl, struct libbex_event *ev)
+/* {"event":"conf","status":"OK","flags":N}; the channel messages use the flags now */
+static int conf_callback(struct libbex_platform *pl, struct libbex_event *ev)
 {
-	DBG(PLAT, bex_debugobj(pl, "received event %s [%p]", ev->name, ev));
+	struct libbex_conn *conn = pl->rx_conn ? pl->rx_conn : pl->conns[0];
+	struct libbex_array *ar = bex_event_get_replies(ev);
+	struct libbex_value *status = ar ? bex_array_get(ar, "status") : NULL;
+	struct libbex_value *flags = ar ? bex_array_get(ar, "flags") : NULL;
+	const char *str = status ? bex_value_get_str(status) : NULL;
+	int rc = -EINVAL;
 
-	if (ev->callback)
-		return ev->callback(pl, ev);
+	if (!str || strcmp(str, "OK") != 0 || !flags) {
+		DBG(PLAT, bex_debugobj(pl, "#%u: conf failed", conn->idx));
+		goto done;
+	}
 
-	return 0;
+	conn->conf_flags = bex_value_get_u64(flags);
+	conn->seq = 0;
+	DBG(PLAT, bex_debugobj(pl, "#%u: conf flags %ju", conn->idx, conn->conf_flags));
+	rc = 0;
+done:
+	bex_event_reset_reply(ev);
+	return rc;
 }
 
-int bex_platform_connect(struct libbex_platform *pl)
+/* sends {"event":"conf"} if the connection does not use the required flags */
+static int send_conf(struct libbex_conn *conn)
 {
-	DBG(PLAT, bex_debugobj(pl, "connecting"));
-	return wss_connect(pl);;
-}
+	struct libbex_platform *pl = conn->pl;
+	struct libbex_event *ev;
+	int rc;
 
-int bex_platform_disconnect(struct libbex_platform *pl)
-{
-	DBG(PLAT, bex_debugobj(pl, "connecting"));
-	return wss_disconnect(pl);;
-}
+	if (pl->conf_flags == conn->conf_sent)
+		return 0;
 
-int bex_platform_service(struct libbex_platform *pl)
-{
-	DBG(PLAT, bex_debugobj(pl, "serving"));
-	return wss_service(pl);
-}
+	/* define reply */
+	if (!bex_platform_get_event(pl, "conf")) {
+		ev = bex_new_event("conf");
+		if (!ev)
+			return -ENOMEM;
 
-/*
- * Note that @str has to be mallocated string and will be later freed by
- * platform. Don't call free() for the @str on success!
- */
-int bex_platform_send(struct libbex_platform *pl, unsigned char *str, size_t sz)
-{
-	DBG(PLAT, bex_debugobj(pl, "sending: [sz=%zu] >>>%s<<<", sz, str));
-	return wss_send(pl, str, sz);
+		bex_event_set_reply_callback(ev, conf_callback);
+		bex_event_add_reply(ev, bex_new_value_str("event", NULL));
+		bex_event_add_reply(ev, bex_new_value_str("status", NULL));
+		bex_event_add_reply(ev, bex_new_value_u64("flags", 0));
+		bex_platform_add_event(pl, ev);
+		bex_unref_event(ev);
+	}
+
+	ev = bex_new_event("conf");
+	if (!ev)
+		return -ENOMEM;
+
+	bex_event_add_value(ev, bex_new_value_u64("flags", pl->conf_flags));
+	rc = send_event(conn, ev);
+	if (!rc)
+		conn->conf_sent = pl->conf_flags;
+	bex_unref_event(ev);
+	return rc;
 }
 
-int bex_platform_receive(struct libbex_platform *pl, const char *str)
+/**
+ * bex_platform_set_flags:
+ * @pl: platform
+ * @flags: BEX_CONF_* flags
+ *
+ * Sets the exchange "conf" flags for all the connections; for example
+ * BEX_CONF_SEQ_ALL and BEX_CONF_TIMESTAMP add sequence number and server
+ * timestamp to the channel messages (see bex_channel_get_seq() and
+ * bex_channel_get_timestamp()) and BEX_CONF_BULK_UPDATES allows the exchange
+ * to send more order book updates in one message.
+ *
+ * The flags required by the channels (e.g. BEX_CONF_OB_CHECKSUM for the
+ * order books) are always enabled. The flags are sent to the connected
+ * connections now and to the other connections before the first subscribe
+ * request.
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_platform_set_flags(struct libbex_platform *pl, uint64_t flags)
 {
-	char *name = NULL;
+	struct libbex_channel *ch;
+	struct libbex_iter itr;
+	size_t i;
 	int rc = 0;
-	uint64_t id;
 
-	DBG(PLAT, bex_debugobj(pl, "receive: >>>%s<<<", str));
-
-	if (bex_is_event_string(str, &name)) {
-		struct libbex_event *ev;
+	if (!pl)
+		return -EINVAL;
 
-		DBG(PLAT, bex_debugobj(pl, "received event with name '%s'", name));
+	bex_platform_lock(pl);
+	pl->flags = flags;
+	pl->conf_flags = flags;
 
-		ev = bex_platform_get_event(pl, name);
-		if (ev) {
-			rc = bex_event_update_reply(ev, str);
-			if (!rc)
-				rc = bex_platform_receive_event(pl, ev);
-		} else
-			DBG(PLAT, bex_debugobj(pl, "event unssuported [ignore]"));
+	bex_reset_iter(&itr, BEX_ITER_FORWARD);
+	while (bex_platform_next_channel(pl, &itr, &ch) == 0)
+		pl->conf_flags |= ch->conf_flags;
+	bex_platform_unlock(pl);
 
-	} else if (bex_is_channel_string(str, &id)) {
-		struct libbex_channel *ch;
+	DBG(PLAT, bex_debugobj(pl, "conf flags %ju", pl->conf_flags));
 
-		DBG(PLAT, bex_debugobj(pl, "received data for channel '%ju'", id));
-		ch = bex_platform_get_channel_by_id(pl, id);
-		if (ch) {
-			rc = bex_channel_update_inbuff(ch, str);
-			if (!rc)
-				bex_channel_wakeup(ch);
-		} else
-			DBG(PLAT, bex_debugobj(pl, "unknown channel [ignore]"));
+	for (i = 0; rc == 0 && i < pl->nconns; i++) {
+		if (pl->conns[i]->wss)
+			rc = send_conf(pl->conns[i]);
 	}
-
-	free(name);
 	return rc;
 }
 
 /**
- * bex_platform_add_channel:
- * @pl: tab pointer
- * @ch: channel
+ * bex_platform_set_gap_callback:
+ * @pl: platform
+ * @fn: callback
  *
- * Adds a new channel to platform and increment @ch reference counter. Don't forget to
- * use bex_unref_channel() after bex_platform_add_channel() you want to keep the @ch
- * referenced by the platform only.
+ * The callback is called when a sequence number is missing in the channel
+ * messages (see BEX_CONF_SEQ_ALL). The arguments are the channel of the
+ * message after the gap (or NULL if unknown), the expected and the received
+ * sequence number.
  *
- * Returns: 0 on success or negative number in case of error.
+ * The sequence numbers are per connection, the lost message may belong to
+ * any channel of the connection (see bex_channel_get_connection()), use
+ * bex_platform_resync_channel() to get new snapshot.
+ *
+ * Returns: 0 on success, <0 on error.
  */
-int bex_platform_add_channel(struct libbex_platform *pl, struct libbex_channel *ch)
+int bex_platform_set_gap_callback(struct libbex_platform *pl,
+			int (*fn)(struct libbex_platform *, struct libbex_channel *,
+				  uint64_t, uint64_t))
 {
-	if (!pl || !ch)
+	if (!pl)
 		return -EINVAL;
-
-	bex_ref_channel(ch);
-	list_add_tail(&ch->channels, &pl->channels);
-
-	DBG(PLAT, bex_debugobj(pl, "add channel: %s [%p]", ch->name, ch));
+	pl->gap_callback = fn;
 	return 0;
 }
 
 /**
- * bex_platform_remove_channel:
- * @pl: platform pointer
- * @ev: channel
- *
- * Removes the @ch from the platform and de-increment reference counter of the
- * @ev. The channel with zero reference counter will be deallocated. Don't forget
- * to use bex_ref_channel() before call bex_platform_remove_channel() if you want
- * to use @ch later.
+ * bex_platform_get_ngaps:
+ * @pl: platform
  *
- * Returns: 0 on success or negative number in case of error.
+ * Returns: number of the detected sequence gaps of all the connections.
  */
-int bex_platform_remove_channel(struct libbex_platform *pl, struct libbex_channel *ch)
+unsigned int bex_platform_get_ngaps(struct libbex_platform *pl)
 {
-	if (!pl || !ch)
+	unsigned int n = 0;
+	size_t i;
+
+	for (i = 0; pl && i < pl->nconns; i++) {
+		bex_conn_lock(pl->conns[i]);
+		n += pl->conns[i]->ngaps;
+		bex_conn_unlock(pl->conns[i]);
+	}
+	return n;
+}
+
+int bex_platform_send_event(struct libbex_platform *pl, struct libbex_event *ev)
+{
+	if (!ev || !pl)
 		return -EINVAL;
+	return send_event(pl->conns[0], ev);
+}
 
-	DBG(PLAT, bex_debugobj(pl, "removing channel %s [%p]", ch->name, ch));
+int bex_platform_receive_event(struct libbex_platform *pl, struct libbex_event *ev)
+{
+	DBG(PLAT, bex_debugobj(pl, "received event %s [%p]", ev->name, ev));
 
-	list_del(&ch->channels);
-	INIT_LIST_HEAD(&ch->channels);	/* otherwise @ch still points to the list */
+	if (ev->callback)
+		return ev->callback(pl, ev);
 
-	bex_unref_channel(ch);
 	return 0;
 }
 
+/**
+ * bex_platform_set_connect_callback:
+ * @pl: platform
+ * @fn: callback
+ *
+ * The callback is called when the connection (the second argument is index
+ * of the connection) is established (the last argument is 0), when the
+ * connection attempt failed (-ECONNREFUSED, -ETIMEDOUT, ...) or when
+ * the established connection has been lost (-ECONNRESET).
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_platform_set_connect_callback(struct libbex_platform *pl,
+			int (*fn)(struct libbex_platform *, int, int))
+{
+	if (!pl)
+		return -EINVAL;
+	pl->connect_callback = fn;
+	return 0;
+}
+
+/**
+ * bex_platform_set_connect_timeout:
+ * @pl: platform
+ * @ms: timeout in milliseconds or 0
+ *
+ * Sets timeout for one connection attempt (TCP, TLS and websocket
+ * handshake). The default is 10 seconds, 0 means libwebsockets defaults.
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_platform_set_connect_timeout(struct libbex_platform *pl, unsigned int ms)
+{
+	if (!pl)
+		return -EINVAL;
+	pl->connect_timeout = ms;
+	return 0;
+}
 
 /**
- * bext_platform_next_channel:
+ * bex_platform_request_connect:
  * @pl: platform
- * @itr: iterator
- * @ch: returns the next channel
  *
- * Returns: 0 on success, negative number in case of error or 1 at the end of list.
+ * Starts the connection attempts and returns without waiting. The connections
+ * are established by bex_platform_service() (or bex_platform_service_fd()),
+ * see also bex_platform_set_connect_callback(). It's possible to start
+ * connecting more platforms at once and then service them.
+ *
+ * Returns: 0 on success, <0 on error.
  */
-int bex_platform_next_channel(struct libbex_platform *pl, struct libbex_iter *itr,
-			      struct libbex_channel **ch)
+int bex_platform_request_connect(struct libbex_platform *pl)
 {
-	int rc = 1;
+	size_t i;
+	int rc = 0;
 
-	if (!pl || !itr || !ch)
+	if (!pl)
 		return -EINVAL;
-	*ch = NULL;
 
-	if (!itr->head)
-		BEX_ITER_INIT(itr, &pl->channels);
-	if (itr->p != itr->head) {
-		BEX_ITER_ITERATE(itr, *ch, struct libbex_channel, channels);
-		rc = 0;
+	DBG(PLAT, bex_debugobj(pl, "connect request"));
+	for (i = 0; rc == 0 && i < pl->nconns; i++) {
+		rc = wss_connect(pl->conns[i]);
+		if (rc == -ENOTCONN)
+			rc = 0;		/* retried by service */
 	}
-
 	return rc;
 }
 
-struct libbex_channel *bex_platform_get_channel(struct libbex_platform *pl, const char *name)
+/**
+ * bex_platform_is_connected:
+ * @pl: platform
+ *
+ * Returns: 1 if all the platform connections are established.
+ */
+int bex_platform_is_connected(struct libbex_platform *pl)
+{
+	size_t i;
+
+	if (!pl)
+		return 0;
+	for (i = 0; i < pl->nconns; i++) {
+		if (pl->conns[i]->wss && !wss_is_connected(pl->conns[i]))
+			return 0;
+	}
+	return pl->conns[0]->wss ? 1 : 0;
+}
+
+/*
+ * Starts all connections and services them until established. It fails
+ * if a connection failed more than connection_attempts times.
+ */
+int bex_platform_connect(struct libbex_platform *pl)
+{
+	size_t i;
+	int rc;
+
+	DBG(PLAT, bex_debugobj(pl, "connecting"));
+	for (i = 0; i < pl->nconns; i++)
+		pl->conns[i]->nfailed = 0;
+
+	rc = bex_platform_request_connect(pl);
+
+	while (!rc && !bex_platform_is_connected(pl)) {
+		for (i = 0; i < pl->nconns; i++) {
+			if (pl->conns[i]->nfailed >= pl->connection_attempts)
+				return -ENOTCONN;
+		}
+		rc = bex_platform_service(pl);
+	}
+	return rc;
+}
+
+int bex_platform_disconnect(struct libbex_platform *pl)
+{
+	size_t i;
+	int rc = 0;
+
+	DBG(PLAT, bex_debugobj(pl, "disconnecting"));
+	bex_platform_stop_threads(pl);
+
+	for (i = 0; i < pl->nconns; i++) {
+		int x;
+
+		if (pl->conns[i]->wss && (x = wss_disconnect(pl->conns[i])) != 0)
+			rc = x;
+	}
+	return rc;
+}
+
+/*
+ * Connection thread; wakes up the dispatcher sleeping in bex_platform_service()
+ * after a message is queued or an event is processed. The mutex is used only
+ * if the dispatcher sleeps.
+ */
+void bex_platform_wakeup(struct libbex_platform *pl)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&pl->rx_waiting, __ATOMIC_RELAXED))
+		return;
+	pthread_mutex_lock(&pl->rx_lock);
+	pthread_cond_signal(&pl->rx_cond);
+	pthread_mutex_unlock(&pl->rx_lock);
+}
+
+static int rx_pending(struct libbex_platform *pl)
+{
+	size_t i;
+
+	for (i = 0; i < pl->nconns; i++) {
+		if (pl->conns[i]->ring && bex_ring_peek(pl->conns[i]->ring))
+			return 1;
+	}
+	return 0;
+}
+
+/* sleeps until bex_platform_wakeup() or @ms timeout */
+static void wait_rx(struct libbex_platform *pl, unsigned int ms)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&pl->rx_lock);
+	__atomic_store_n(&pl->rx_waiting, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	/* don't sleep if a message has been queued before rx_waiting is set */
+	if (!rx_pending(pl))
+		pthread_cond_timedwait(&pl->rx_cond, &pl->rx_lock, &ts);
+
+	__atomic_store_n(&pl->rx_waiting, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&pl->rx_lock);
+}
+
+int bex_platform_service(struct libbex_platform *pl)
+{
+	DBG(PLAT, bex_debugobj(pl, "serving"));
+	if (pl->threaded) {
+		/* the connections are serviced by the threads */
+		if (bex_platform_dispatch(pl) == 0)
+			wait_rx(pl, pl->service_timeout);
+		return 0;
+	}
+	if (pl->nconns == 1)
+		return wss_service(pl->conns[0], pl->service_timeout);
+	return wss_service_all(pl, pl->service_timeout);
+}
+
+/**
+ * bex_platform_set_poll_callback:
+ * @pl: platform
+ * @fn: callback
+ *
+ * The callback is called when libwebsockets adds, removes or changes a socket,
+ * the arguments are the file descriptor, the wanted poll events (POLLIN,
+ * POLLOUT) and BEX_POLL_{ADD,DEL,CHANGE}. It's expected to be used to keep
+ * an external epoll set in sync, see also bex_platform_service_fd().
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_platform_set_poll_callback(struct libbex_platform *pl,
+			int (*fn)(struct libbex_platform *, int, int, int))
+{
+	if (!pl)
+		return -EINVAL;
+	pl->poll_callback = fn;
+	return 0;
+}
+
+/**
+ * bex_platform_get_pollfds:
+ * @pl: platform
+ * @fds: array for the sockets or NULL
+ * @nfds: size of the @fds array
+ *
+ * Copies the current sockets and wanted events to @fds. The sockets exist
+ * only after bex_platform_connect().
+ *
+ * Returns: number of the sockets (may be greater than @nfds).
+ */
+int bex_platform_get_pollfds(struct libbex_platform *pl, struct pollfd *fds, size_t nfds)
+{
+	return wss_get_pollfds(pl, fds, nfds);
+}
+
+/**
+ * bex_platform_service_fd:
+ * @pl: platform
+ * @fd: ready socket or -1
+ * @revents: returned poll events
+ *
+ * This is non-blocking alternative to bex_platform_service() for an external
+ * event loop (poll, epoll, ...). Call it when the socket is ready, it
+ * processes only the ready I/O and it never sleeps. It's also necessary to
+ * call it with @fd -1 from time to time (e.g. once per second) to handle
+ * libwebsockets timeouts.
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_platform_service_fd(struct libbex_platform *pl, int fd, short revents)
+{
+	DBG(PLAT, bex_debugobj(pl, "serving fd %d", fd));
+	return wss_service_fd(pl, fd, revents);
+}
+
+/**
+ * bex_platform_start_threads:
+ * @pl: connected platform
+ *
+ * Starts one service thread for every connection. The threads receive and
+ * parse the channels data and queue the rows to per-connection lock-free
+ * rings, the channels callbacks are called later by bex_platform_dispatch()
+ * (or bex_platform_service()) in the caller's thread. The events callbacks
+ * (e.g. "subscribed") and the subscribe callback are called by the
+ * connection threads with the platform lock held, see
+ * bex_event_set_reply_callback(). bex_platform_service() sleeps until a
+ * message is queued, an event is received or the service timeout expires.
+ *
+ * Only the reply struct is queued for the channel rows, so the channels
+ * without reply struct fields (see bex_channel_add_reply_field()) and the
+ * batch callbacks are not supported in the threaded mode. The channels
+ * cannot be removed from the platform while the threads are running.
+ *
+ * Returns: 0 on success, -ENOTSUP for not supported channel, <0 on error.
+ */
+int bex_platform_start_threads(struct libbex_platform *pl)
 {
 	struct libbex_channel *ch;
 	struct libbex_iter itr;
+	size_t i;
+	int rc = 0;
 
-	bex_reset_iter(&itr, BEX_ITER_FORWARD);
+	if (!pl)
+		return -EINVAL;
+	if (pl->threaded)
+		return 0;
 
+	bex_reset_iter(&itr, BEX_ITER_FORWARD);
 	while (bex_platform_next_channel(pl, &itr, &ch) == 0) {
-		if (strcmp(ch->name, name) == 0)
-			return ch;
+		if (ch->batch_callback || !ch->nfields)
+			return -ENOTSUP;
 	}
 
-	return NULL;
+	DBG(PLAT, bex_debugobj(pl, "starting threads"));
+	pl->threaded = 1;
+
+	for (i = 0; rc == 0 && i < pl->nconns; i++) {
+		if (pl->conns[i]->wss)
+			rc = bex_conn_start_thread(pl->conns[i]);
+	}
+	if (rc)
+		bex_platform_stop_threads(pl);
+	return rc;
 }
 
-struct libbex_channel *bex_platform_get_channel_by_id(struct libbex_platform *pl, uint64_t id)
+/**
+ * bex_platform_stop_threads:
+ * @pl: platform
+ *
+ * Stops the connection threads and dispatches the already queued messages.
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_platform_stop_threads(struct libbex_platform *pl)
+{
+	size_t i;
+
+	if (!pl)
+		return -EINVAL;
+	if (!pl->threaded)
+		return 0;
+
+	DBG(PLAT, bex_debugobj(pl, "stopping threads"));
+	for (i = 0; i < pl->nconns; i++)
+		bex_conn_stop_thread(pl->conns[i]);
+
+	bex_platform_dispatch(pl);
+
+	for (i = 0; i < pl->nconns; i++) {
+		bex_free_ring(pl->conns[i]->ring);
+		pl->conns[i]->ring = NULL;
+	}
+	pl->threaded = 0;
+	return 0;
+}
+
+/**
+ * bex_platform_dispatch:
+ * @pl: platform
+ *
+ * Calls the channels callbacks for the messages queued by the connection
+ * threads, see bex_platform_start_threads(). The function never waits.
+ *
+ * Returns: number of the dispatched messages or <0 on error.
+ */
+int bex_platform_dispatch(struct libbex_platform *pl)
+{
+	size_t i;
+	int n = 0;
+
+	if (!pl)
+		return -EINVAL;
+
+	for (i = 0; i < pl->nconns; i++) {
+		struct libbex_ring *r = pl->conns[i]->ring;
+		struct libbex_ring_msg *msg;
+
+		if (!r)
+			continue;
+		while ((msg = bex_ring_peek(r))) {
+			if (!(msg->flags & BEX_MSG_GAP))
+				bex_channel_dispatch(pl, msg);
+			else if (pl->gap_callback)
+				pl->gap_callback(pl, msg->ch,
+						*(uint64_t *) msg->data, msg->seq);
+			bex_ring_release(r);
+			n++;
+		}
+	}
+
+	DBG(PLAT, bex_debugobj(pl, "dispatched %d messages", n));
+	return n;
+}
+
+/*
+ * Note that @str has to be mallocated string and will be later freed by
+ * platform. Don't call free() for the @str on success!
+ */
+int bex_platform_send(struct libbex_platform *pl, unsigned char *str, size_t sz)
+{
+	DBG(PLAT, bex_debugobj(pl, "sending: [sz=%zu] >>>%s<<<", sz, str));
+	return wss_send(pl->conns[0], str, sz);
+}
+
+/* { "event": "name", ... } */
+static int receive_event(struct libbex_platform *pl, struct libbex_parser *ps,
+			 uint64_t rx_time)
+{
+	struct libbex_event *ev;
+	struct libbex_token *tk;
+	ssize_t idx;
+	int rc = 0;
+
+	idx = bex_parser_object_get(ps, 0, "event");
+	if (idx < 0 || ps->toks[idx].type != BEX_TOKEN_STRING) {
+		DBG(PLAT, bex_debugobj(pl, "object without event name [ignore]"));
+		return 0;
+	}
+
+	tk = &ps->toks[idx];
+	DBG(PLAT, bex_debugobj(pl, "received event with name '%.*s'",
+				(int) tk->len, bex_token_ptr(ps, tk)));
+
+	ev = bex_platform_get_event_by_span(pl, bex_token_ptr(ps, tk), tk->len);
+	if (ev) {
+		ev->rx_time = rx_time;
+		rc = bex_event_update_reply_from_tokens(ev, ps, 0);
+		if (!rc)
+			rc = bex_platform_receive_event(pl, ev);
+	} else
+		DBG(PLAT, bex_debugobj(pl, "event unssuported [ignore]"));
+
+	return rc;
+}
+
+/* [ CHANNEL_ID, ... ] */
+/* BEX_CONF_SEQ_ALL; the sequence numbers are per connection */
+static int check_seq(struct libbex_conn *conn, uint64_t seq, uint64_t *expected)
+{
+	*expected = conn->seq + 1;
+	conn->seq = seq;
+	if (*expected == 1 || seq == *expected)
+		return 0;	/* the first message or no gap */
+
+	DBG(PLAT, bex_debugobj(conn->pl, "#%u: sequence gap [expected=%ju, received=%ju]",
+				conn->idx, *expected, seq));
+	conn->ngaps++;
+	return 1;
+}
+
+/* called without the connection lock, the ring may be full */
+static void report_gap(struct libbex_conn *conn, struct libbex_channel *ch,
+		       uint64_t expected, uint64_t seq)
+{
+	struct libbex_platform *pl = conn->pl;
+
+	if (!pl->gap_callback)
+		return;
+
+	if (conn->ring) {
+		struct libbex_ring_msg *msg = bex_conn_reserve_msg(conn);
+
+		if (!msg)
+			return;
+		msg->ch = ch;
+		msg->flags = BEX_MSG_GAP;
+		msg->seq = seq;
+		msg->rx_time = 0;
+		*msg->type = '\0';
+		*(uint64_t *) msg->data = expected;
+		bex_conn_commit_msg(conn);
+	} else
+		pl->gap_callback(pl, ch, expected, seq);
+}
+
+static int receive_channel(struct libbex_conn *conn, struct libbex_parser *ps,
+			   uint64_t rx_time)
+{
+	struct libbex_platform *pl = conn->pl;
+	struct libbex_channel *ch;
+	struct libbex_token *tk;
+	uint64_t id, seq, mts, expected = 0;
+	int gap = 0;
+
+	tk = bex_parser_get_token(ps, 1);
+	if (!tk || bex_token_get_u64(ps, tk, &id) != 0) {
+		DBG(PLAT, bex_debugobj(pl, "array without channel ID [ignore]"));
+		return 0;
+	}
+
+	DBG(PLAT, bex_debugobj(pl, "received data for channel '%ju'", id));
+	bex_channel_parse_trailer(ps, conn->conf_flags, &seq, &mts);
+
+	/*
+	 * The lock is not held while the channel is processed, the processing
+	 * may wait for a free slot in the ring. The channel cannot be removed
+	 * while the threads are running.
+	 */
+	bex_conn_lock(conn);
+	ch = bex_conn_get_channel_by_id(conn, id);
+	if (seq)
+		gap = check_seq(conn, seq, &expected);
+	bex_conn_count_msg(conn, rx_time);
+	bex_conn_unlock(conn);
+
+	if (gap)
+		report_gap(conn, ch, expected, seq);
+	if (!ch) {
+		DBG(PLAT, bex_debugobj(pl, "unknown channel [ignore]"));
+		return 0;
+	}
+	ch->nmsgs++;
+	ch->seq = seq;
+	ch->mts = mts;
+	ch->rx_time = rx_time;
+
+	/* the data are processed directly from the receive buffer */
+	bex_channel_process(ch, ps);
+	return 0;
+}
+
+/*
+ * Processes data received by @conn. The @buf does not have to be zero
+ * terminated and it's not copied, so it's possible to use the libwebsockets
+ * receive buffer.
+ */
+int bex_conn_receive_buffer(struct libbex_conn *conn, const char *buf, size_t len,
+			    uint64_t rx_time)
+{
+	struct libbex_platform *pl = conn->pl;
+	struct libbex_parser *ps = &conn->parser;
+	int rc;
+
+	DBG(PLAT, bex_debugobj(pl, "#%u: receive: >>>%.*s<<<", conn->idx, (int) len, buf));
+
+	if (pl->capture)
+		bex_capture_write(pl->capture, conn->idx, BEX_CAPTURE_RX, rx_time, buf, len);
+
+	/* the only one scan of the data */
+	rc = bex_parser_tokenize(ps, buf, len);
+	if (rc)
+		return rc;
+
+	switch (ps->toks[0].type) {
+	case BEX_TOKEN_OBJECT:
+		/* events callbacks are called by the connection thread */
+		bex_platform_lock(pl);
+		pl->rx_conn = conn;	/* for events callbacks */
+		rc = receive_event(pl, ps, rx_time);
+		pl->rx_conn = NULL;
+		bex_platform_unlock(pl);
+		if (pl->threaded)
+			bex_platform_wakeup(pl);	/* e.g. subscribe reply */
+		break;
+	case BEX_TOKEN_ARRAY:
+		rc = receive_channel(conn, ps, rx_time);
+		break;
+	default:
+		break;
+	}
+
+	bex_reset_parser(ps);	/* don't keep pointer to the buffer */
+	return rc;
+}
+
+/* Processes data as received by the first connection */
+int bex_platform_receive_buffer(struct libbex_platform *pl, const char *buf, size_t len)
+{
+	return bex_conn_receive_buffer(pl->conns[0], buf, len, bex_get_monotonic_ns());
+}
+
+int bex_platform_receive(struct libbex_platform *pl, const char *str)
+{
+	if (!pl || !str)
+		return -EINVAL;
+	return bex_platform_receive_buffer(pl, str, strlen(str));
+}
+
+/* the not assigned channels are indexed by the first connection */
+static inline struct libbex_conn *channel_conn(struct libbex_platform *pl,
+					       struct libbex_channel *ch)
+{
+	return ch->conn ? ch->conn : pl->conns[0];
+}
+
+/* Sets channel ID and keeps the chanId hash in sync */
+static int set_channel_id(struct libbex_platform *pl, struct libbex_channel *ch, uint64_t id)
+{
+	bex_conn_unindex_channel(channel_conn(pl, ch), ch);
+	bex_channel_set_id(ch, id);
+	return bex_conn_index_channel(channel_conn(pl, ch), ch);
+}
+
+/**
+ * bex_platform_add_channel:
+ * @pl: tab pointer
+ * @ch: channel
+ *
+ * Adds a new channel to platform and increment @ch reference counter. Don't forget to
+ * use bex_unref_channel() after bex_platform_add_channel() you want to keep the @ch
+ * referenced by the platform only.
+ *
+ * Returns: 0 on success or negative number in case of error.
+ */
+int bex_platform_add_channel(struct libbex_platform *pl, struct libbex_channel *ch)
+{
+	if (!pl || !ch)
+		return -EINVAL;
+
+	bex_platform_lock(pl);
+	if (bex_conn_index_channel(channel_conn(pl, ch), ch) != 0) {
+		bex_platform_unlock(pl);
+		return -ENOMEM;
+	}
+
+	bex_ref_channel(ch);
+	list_add_tail(&ch->channels, &pl->channels);
+	pl->conf_flags |= ch->conf_flags;
+	bex_platform_unlock(pl);
+
+	DBG(PLAT, bex_debugobj(pl, "add channel: %s [%p]", ch->name, ch));
+	return 0;
+}
+
+/**
+ * bex_platform_remove_channel:
+ * @pl: platform pointer
+ * @ev: channel
+ *
+ * Removes the @ch from the platform and de-increment reference counter of the
+ * @ev. The channel with zero reference counter will be deallocated. Don't forget
+ * to use bex_ref_channel() before call bex_platform_remove_channel() if you want
+ * to use @ch later.
+ *
+ * The channel cannot be removed while the connection threads are running,
+ * because the already queued messages point to the channel.
+ *
+ * Returns: 0 on success or negative number in case of error.
+ */
+int bex_platform_remove_channel(struct libbex_platform *pl, struct libbex_channel *ch)
+{
+	if (!pl || !ch)
+		return -EINVAL;
+	if (pl->threaded)
+		return -EBUSY;
+
+	DBG(PLAT, bex_debugobj(pl, "removing channel %s [%p]", ch->name, ch));
+
+	bex_conn_unindex_channel(channel_conn(pl, ch), ch);
+	bex_platform_unassign_channel(pl, ch);
+	list_del(&ch->channels);
+	INIT_LIST_HEAD(&ch->channels);	/* otherwise @ch still points to the list */
+
+	bex_unref_channel(ch);
+	return 0;
+}
+
+
+/**
+ * bext_platform_next_channel:
+ * @pl: platform
+ * @itr: iterator
+ * @ch: returns the next channel
+ *
+ * Returns: 0 on success, negative number in case of error or 1 at the end of list.
+ */
+int bex_platform_next_channel(struct libbex_platform *pl, struct libbex_iter *itr,
+			      struct libbex_channel **ch)
+{
+	int rc = 1;
+
+	if (!pl || !itr || !ch)
+		return -EINVAL;
+	*ch = NULL;
+
+	if (!itr->head)
+		BEX_ITER_INIT(itr, &pl->channels);
+	if (itr->p != itr->head) {
+		BEX_ITER_ITERATE(itr, *ch, struct libbex_channel, channels);
+		rc = 0;
+	}
+
+	return rc;
+}
+
+struct libbex_channel *bex_platform_get_channel(struct libbex_platform *pl, const char *name)
 {
 	struct libbex_channel *ch;
 	struct libbex_iter itr;
@@ -440,23 +1327,63 @@ struct libbex_channel *bex_platform_get_channel_by_id(struct libbex_platform *pl
 	bex_reset_iter(&itr, BEX_ITER_FORWARD);
 
 	while (bex_platform_next_channel(pl, &itr, &ch) == 0) {
-		if (ch->id == id)
+		if (strcmp(ch->name, name) == 0)
 			return ch;
 	}
 
 	return NULL;
 }
 
+/**
+ * bex_platform_get_channel_by_id:
+ * @pl: platform
+ * @id: channel ID (chanId)
+ *
+ * The channels are indexed by ID when added to the platform and when
+ * subscribed, the function does not walk the list of the channels. Note that
+ * the IDs are unique only within the connection, the first channel with the
+ * ID is returned if the platform uses more connections.
+ *
+ * Returns: channel or NULL.
+ */
+struct libbex_channel *bex_platform_get_channel_by_id(struct libbex_platform *pl, uint64_t id)
+{
+	struct libbex_channel *ch = NULL;
+	size_t i;
+
+	if (!pl)
+		return NULL;
+
+	for (i = 0; !ch && i < pl->nconns; i++)
+		ch = bex_conn_get_channel_by_id(pl->conns[i], id);
+	return ch;
+}
+
+/* calls the subscribe callback, @rc is 0 or negative errno */
+static void subscribe_done(struct libbex_platform *pl, struct libbex_channel *ch, int rc)
+{
+	DBG(PLAT, bex_debugobj(pl, "channel %s subscribe done [rc=%d]", ch->name, rc));
+
+	if (rc)
+		bex_channel_set_status(ch, BEX_CHANNEL_FAILED);
+	if (pl->subscribe_callback)
+		pl->subscribe_callback(pl, ch, rc);
+}
+
 static int subscribed_callback(struct libbex_platform *pl, struct libbex_event *ev)
 {
+	struct libbex_conn *conn = pl->rx_conn ? pl->rx_conn : pl->conns[0];
 	struct libbex_channel *ch;
 	struct libbex_array *ar;
 	struct libbex_value *id;
 	struct libbex_iter itr;
 	int rc = -EINVAL;
 
+	/* only the channels waiting for the reply, the same as error_callback() */
 	bex_reset_iter(&itr, BEX_ITER_FORWARD);
 	while (bex_platform_next_channel(pl, &itr, &ch) == 0) {
+		if (ch->status != BEX_CHANNEL_SUBSCRIBING || ch->conn != conn)
+			continue;
 		if (bex_channel_verify_event(ch, ev))
 			break;
 	}
@@ -470,29 +1397,66 @@ static int subscribed_callback(struct libbex_platform *pl, struct libbex_event *
 	if (!ar)
 		goto done;
 
+	rc = bex_conn_assign_channel(conn, ch);
+	if (rc)
+		goto done;
+
 	id = bex_array_get(ar, "chanId");
-	bex_channel_set_id(ch, bex_value_get_u64(id));
+	rc = set_channel_id(pl, ch, bex_value_get_u64(id));
+	if (rc)
+		goto done;
 
 	bex_channel_set_subscribed(ch, 1);
 	bex_channel_update_heartbeat(ch);
+	subscribe_done(pl, ch, 0);
 	rc = 0;
 done:
 	bex_event_reset_reply(ev);
 	return rc;
 }
 
-int bex_platform_subscribe_channel(struct libbex_platform *pl, struct libbex_channel *ch)
+/* { "event": "error", "msg": "...", "code": 10300, "channel": ..., "symbol": ... } */
+static int error_callback(struct libbex_platform *pl, struct libbex_event *ev)
 {
-	int rc = 0, tries = 0;
+	struct libbex_conn *conn = pl->rx_conn ? pl->rx_conn : pl->conns[0];
+	struct libbex_channel *ch;
+	struct libbex_array *ar = bex_event_get_replies(ev);
+	struct libbex_value *code;
+	struct libbex_iter itr;
 
-	if (!ch || !ch->subscribe || bex_channel_is_subscribed(ch))
-		return -EINVAL;
+	DBG(EVENT, bex_debugobj(ev, "error reply"));
 
-	DBG(PLAT, bex_debugobj(pl, "subscribing channel %s [%p]", ch->name, ch));
+	/* the error does not contain chanId, use channel and symbol */
+	bex_reset_iter(&itr, BEX_ITER_FORWARD);
+	while (bex_platform_next_channel(pl, &itr, &ch) == 0) {
+		if (ch->status != BEX_CHANNEL_SUBSCRIBING || ch->conn != conn)
+			continue;
+		if (bex_channel_verify_event(ch, ev))
+			break;
+	}
+
+	if (ch) {
+		code = ar ? bex_array_get(ar, "code") : NULL;
+
+		bex_platform_unassign_channel(pl, ch);
+		subscribe_done(pl, ch, code && bex_value_get_u64(code) == 10301 ?
+						-EALREADY : -EINVAL);
+	} else
+		DBG(EVENT, bex_debugobj(ev, "unknown error event"));
+
+	bex_event_reset_reply(ev);
+	return 0;
+}
+
+/* define replies */
+static int add_subscribe_events(struct libbex_platform *pl)
+{
+	struct libbex_event *ev;
 
-	/* define reply */
 	if (!bex_platform_get_event(pl, "subscribed")) {
-		struct libbex_event *ev = bex_new_event("subscribed");
+		ev = bex_new_event("subscribed");
+		if (!ev)
+			return -ENOMEM;
 
 		bex_event_set_reply_callback(ev, subscribed_callback);
 		bex_event_add_reply(ev, bex_new_value_str("event", NULL));
@@ -502,44 +1466,277 @@ int bex_platform_subscribe_channel(struct libbex_platform *pl, struct libbex_cha
 		bex_unref_event(ev);
 	}
 
-	/* send request */
-	rc = bex_platform_send_event(pl, ch->subscribe);
+	if (!bex_platform_get_event(pl, "error")) {
+		ev = bex_new_event("error");
+		if (!ev)
+			return -ENOMEM;
+
+		/* "channel", "symbol", etc. are generated if in the reply */
+		bex_event_set_reply_callback(ev, error_callback);
+		bex_event_add_reply(ev, bex_new_value_str("event", NULL));
+		bex_event_add_reply(ev, bex_new_value_str("msg", NULL));
+		bex_event_add_reply(ev, bex_new_value_u64("code", 0));
+		bex_platform_add_event(pl, ev);
+		bex_unref_event(ev);
+	}
+	return 0;
+}
+
+/* the subscribed status is modified by the connection thread in threaded mode */
+static int channel_get_status(struct libbex_platform *pl, struct libbex_channel *ch)
+{
+	int rc;
+
+	bex_platform_lock(pl);
+	rc = bex_channel_get_status(ch);
+	bex_platform_unlock(pl);
+	return rc;
+}
+
+static int channel_is_subscribed(struct libbex_platform *pl, struct libbex_channel *ch)
+{
+	return channel_get_status(pl, ch) == BEX_CHANNEL_SUBSCRIBED;
+}
+
+/**
+ * bex_platform_set_subscribe_callback:
+ * @pl: platform
+ * @fn: callback
+ *
+ * The callback is called for every channel when the subscribe request is
+ * confirmed (the last argument is 0) or when it failed (negative errno;
+ * -EINVAL for error reply, -EALREADY if already subscribed, -ETIMEDOUT).
+ *
+ * The callback is called with the platform lock held; in the threaded mode
+ * by the connection thread for the replies and by the waiting thread for
+ * the timeouts. The lock is recursive, so the callback may call the
+ * platform functions (e.g. subscribe the channel again), but it should not
+ * wait for another thread.
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_platform_set_subscribe_callback(struct libbex_platform *pl,
+			int (*fn)(struct libbex_platform *, struct libbex_channel *, int))
+{
+	if (!pl)
+		return -EINVAL;
+	pl->subscribe_callback = fn;
+	return 0;
+}
+
+/**
+ * bex_platform_request_subscribe:
+ * @pl: platform
+ * @ch: channel
+ *
+ * Sends subscribe request and returns without waiting for the reply. The
+ * replies are matched to the channels by the verify callbacks when received,
+ * see bex_channel_get_status() and bex_platform_set_subscribe_callback().
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_platform_request_subscribe(struct libbex_platform *pl, struct libbex_channel *ch)
+{
+	struct libbex_conn *conn;
+	int rc;
+
+	if (!pl || !ch || !ch->subscribe)
+		return -EINVAL;
+
+	rc = channel_get_status(pl, ch);
+	if (rc == BEX_CHANNEL_SUBSCRIBED || rc == BEX_CHANNEL_SUBSCRIBING)
+		return -EINVAL;
+
+	DBG(PLAT, bex_debugobj(pl, "subscribe request %s [%p]", ch->name, ch));
+
+	rc = add_subscribe_events(pl);
 	if (rc)
-		goto done;
+		return rc;
 
-	/* wait for reply */
-	while (!rc && !bex_channel_is_subscribed(ch) && tries < 10) {
-		rc = bex_platform_service(pl);
-		tries++;
+	bex_platform_lock(pl);
+	conn = bex_platform_assign_channel(pl, ch);
+	if (conn) {
+		bex_channel_set_status(ch, BEX_CHANNEL_SUBSCRIBING);
+		ch->reconnect = 0;
 	}
+	bex_platform_unlock(pl);
+	if (!conn)
+		return -ENOMEM;
 
-done:
-	return  rc ? rc :
-		bex_channel_is_subscribed(ch) ? 0 : -EINVAL;
+	/* a new connection for already connected platform */
+	if (!conn->wss && pl->conns[0]->wss) {
+		rc = wss_connect(conn);
+		if (rc == -ENOTCONN)
+			rc = 0;		/* retried by service */
+		if (!rc && pl->threaded)
+			rc = bex_conn_start_thread(conn);
+	}
+	if (!rc)
+		rc = send_conf(conn);
+	if (!rc)
+		rc = send_event(conn, ch->subscribe);
+	if (rc) {
+		bex_platform_lock(pl);
+		bex_channel_set_status(ch, BEX_CHANNEL_FAILED);
+		bex_platform_unlock(pl);
+	}
+	return rc;
 }
 
-int bex_platform_subscribe_channels(struct libbex_platform *pl)
+/**
+ * bex_platform_request_subscribe_all:
+ * @pl: platform
+ *
+ * Sends subscribe requests for all not subscribed channels at once, see
+ * bex_platform_request_subscribe().
+ *
+ * Returns: 0 on success, <0 if any request failed.
+ */
+int bex_platform_request_subscribe_all(struct libbex_platform *pl)
 {
 	struct libbex_channel *ch;
 	struct libbex_iter itr;
-	int rc = 0;
+	int rc;
 
 	if (!pl)
 		return -EINVAL;
 
-	DBG(PLAT, bex_debugobj(pl, "subscribing all channel"));
+	bex_platform_lock(pl);
+	rc = bex_platform_prepare_connections(pl);
+	bex_platform_unlock(pl);
+	if (rc)
+		return rc;
 
 	bex_reset_iter(&itr, BEX_ITER_FORWARD);
 	while (bex_platform_next_channel(pl, &itr, &ch) == 0) {
-		if (bex_channel_is_subscribed(ch))
+		int x = channel_get_status(pl, ch);
+
+		if (!ch->subscribe || x == BEX_CHANNEL_SUBSCRIBED
+				   || x == BEX_CHANNEL_SUBSCRIBING)
 			continue;
-		rc += bex_platform_subscribe_channel(pl, ch);
+		x = bex_platform_request_subscribe(pl, ch);
+		if (x)
+			rc = x;
 	}
 	return rc;
 }
 
+/* returns number of the requests without reply; @ch or all channels */
+static size_t count_subscribing(struct libbex_platform *pl, struct libbex_channel *ch)
+{
+	struct libbex_iter itr;
+	size_t n = 0;
+
+	bex_platform_lock(pl);
+	if (ch)
+		n = ch->status == BEX_CHANNEL_SUBSCRIBING;
+	else {
+		bex_reset_iter(&itr, BEX_ITER_FORWARD);
+		while (bex_platform_next_channel(pl, &itr, &ch) == 0)
+			n += ch->status == BEX_CHANNEL_SUBSCRIBING;
+	}
+	bex_platform_unlock(pl);
+	return n;
+}
+
+/**
+ * bex_platform_get_nsubscribing:
+ * @pl: platform
+ *
+ * Returns: number of the subscribe requests without reply.
+ */
+size_t bex_platform_get_nsubscribing(struct libbex_platform *pl)
+{
+	return pl ? count_subscribing(pl, NULL) : 0;
+}
+
+static inline long timeval_diff_ms(const struct timeval *a, const struct timeval *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000 + (a->tv_usec - b->tv_usec) / 1000;
+}
+
+/*
+ * Services the platform until all replies (for @ch or for all channels) are
+ * received. The timeout (10 x service timeout) is restarted on every reply,
+ * so the time does not depend on number of the channels.
+ */
+static int wait_subscribe(struct libbex_platform *pl, struct libbex_channel *ch)
+{
+	struct libbex_channel *x;
+	struct libbex_iter itr;
+	struct timeval last, now;
+	size_t pending, n;
+	int rc = 0;
+
+	pending = count_subscribing(pl, ch);
+	gettimeofday(&last, NULL);
+
+	while (!rc && pending) {
+		rc = bex_platform_service(pl);
+
+		n = count_subscribing(pl, ch);
+		gettimeofday(&now, NULL);
+		if (n < pending)
+			last = now;
+		else if (timeval_diff_ms(&now, &last) > 10L * pl->service_timeout)
+			break;
+		pending = n;
+	}
+
+	if (!pending)
+		return rc;
+
+	/* timeout */
+	bex_platform_lock(pl);
+	bex_reset_iter(&itr, BEX_ITER_FORWARD);
+	while (bex_platform_next_channel(pl, &itr, &x) == 0) {
+		if ((!ch || x == ch) && x->status == BEX_CHANNEL_SUBSCRIBING) {
+			bex_platform_unassign_channel(pl, x);
+			subscribe_done(pl, x, -ETIMEDOUT);
+		}
+	}
+	bex_platform_unlock(pl);
+	return rc ? rc : -ETIMEDOUT;
+}
+
+int bex_platform_subscribe_channel(struct libbex_platform *pl, struct libbex_channel *ch)
+{
+	int rc;
+
+	if (!ch || !ch->subscribe || bex_channel_is_subscribed(ch))
+		return -EINVAL;
+
+	DBG(PLAT, bex_debugobj(pl, "subscribing channel %s [%p]", ch->name, ch));
+
+	rc = bex_platform_request_subscribe(pl, ch);
+	if (!rc)
+		rc = wait_subscribe(pl, ch);
+
+	return  rc ? rc :
+		channel_is_subscribed(pl, ch) ? 0 : -EINVAL;
+}
+
+/*
+ * Sends all subscribe requests at once and then waits for the replies.
+ */
+int bex_platform_subscribe_channels(struct libbex_platform *pl)
+{
+	int rc, x;
+
+	if (!pl)
+		return -EINVAL;
+
+	DBG(PLAT, bex_debugobj(pl, "subscribing all channel"));
+
+	rc = bex_platform_request_subscribe_all(pl);
+	x = wait_subscribe(pl, NULL);
+
+	return rc ? rc : x;
+}
+
 static int unsubscribed_callback(struct libbex_platform *pl, struct libbex_event *ev)
 {
+	struct libbex_conn *conn = pl->rx_conn ? pl->rx_conn : pl->conns[0];
 	struct libbex_channel *ch;
 	struct libbex_array *ar = bex_event_get_replies(ev);
 	struct libbex_value *id = ar ? bex_array_get(ar, "chanId") : NULL;
@@ -548,29 +1745,33 @@ static int unsubscribed_callback(struct libbex_platform *pl, struct libbex_event
 	if (!id)
 		return -EINVAL;
 
-	ch = bex_platform_get_channel_by_id(pl, bex_value_get_u64(id));
+	ch = bex_conn_get_channel_by_id(conn, bex_value_get_u64(id));
 	if (!ch) {
 		DBG(EVENT, bex_debugobj(ev, "unknown unsubscribed event"));
 		goto done;
 	}
 
 	bex_channel_set_subscribed(ch, 0);
+	bex_platform_unassign_channel(pl, ch);
 	bex_channel_update_heartbeat(ch);
 	rc = 0;
+
+	if (ch->resubscribe) {
+		/* the channel data are not processed until subscribed again */
+		ch->resubscribe = 0;
+		ch->resync = 1;
+		rc = bex_platform_request_subscribe(pl, ch);
+	}
 done:
 	bex_event_reset_reply(ev);
 	return rc;
 }
 
-int bex_platform_unsubscribe_channel(struct libbex_platform *pl, struct libbex_channel *ch)
+/* sends unsubscribe request, the reply is processed by unsubscribed_callback() */
+static int request_unsubscribe(struct libbex_platform *pl, struct libbex_channel *ch)
 {
-	int rc = 0, tries = 0;
 	struct libbex_event *ev;
-
-	if (!ch || !bex_channel_is_subscribed(ch))
-		return -EINVAL;
-
-	DBG(PLAT, bex_debugobj(pl, "unsubscribing channel %s [%p]", ch->name, ch));
+	int rc;
 
 	/* define reply */
 	if (!bex_platform_get_event(pl, "unsubscribed")) {
@@ -594,19 +1795,73 @@ int bex_platform_unsubscribe_channel(struct libbex_platform *pl, struct libbex_c
 	bex_event_add_value(ev, bex_new_value_u64("chanId", ch->id));
 
 	/* send request */
-	rc = bex_platform_send_event(pl, ev);
+	rc = send_event(channel_conn(pl, ch), ev);
+	bex_unref_event(ev);
+	return rc;
+}
+
+int bex_platform_unsubscribe_channel(struct libbex_platform *pl, struct libbex_channel *ch)
+{
+	struct timeval start, now;
+	int rc = 0;
+
+	if (!ch || !bex_channel_is_subscribed(ch))
+		return -EINVAL;
+
+	DBG(PLAT, bex_debugobj(pl, "unsubscribing channel %s [%p]", ch->name, ch));
+
+	rc = request_unsubscribe(pl, ch);
 	if (rc)
 		goto done;
 
-	/* wait for reply */
-	while (!rc && bex_channel_is_subscribed(ch) && tries < 10) {
+	/* wait for reply, the same timeout as for subscribe */
+	gettimeofday(&start, NULL);
+	while (!rc && channel_is_subscribed(pl, ch)) {
 		rc = bex_platform_service(pl);
-		tries++;
+		gettimeofday(&now, NULL);
+		if (timeval_diff_ms(&now, &start) > 10L * pl->service_timeout)
+			break;
 	}
 
 done:
 	return  rc ? rc :
-		!bex_channel_is_subscribed(ch) ? 0 : -EINVAL;
+		!channel_is_subscribed(pl, ch) ? 0 : -EINVAL;
+}
+
+/**
+ * bex_platform_resync_channel:
+ * @pl: platform
+ * @ch: subscribed channel
+ *
+ * Subscribes the channel again to get a new snapshot (e.g. corrupted order
+ * book or a sequence gap, see bex_platform_set_gap_callback()). The
+ * unsubscribe request is sent now and the subscribe request when
+ * unsubscribed, the next snapshot is marked as resync (see
+ * bex_channel_is_resync()).
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_platform_resync_channel(struct libbex_platform *pl, struct libbex_channel *ch)
+{
+	int rc = 0;
+
+	if (!pl || !ch)
+		return -EINVAL;
+
+	/* the status and the flag are modified by the events callbacks */
+	bex_platform_lock(pl);
+	if (ch->resubscribe)
+		rc = 1;			/* already in progress */
+	else if (ch->status != BEX_CHANNEL_SUBSCRIBED)
+		rc = -EINVAL;
+	else
+		ch->resubscribe = 1;
+	bex_platform_unlock(pl);
+	if (rc)
+		return rc < 0 ? rc : 0;
+
+	DBG(PLAT, bex_debugobj(pl, "resync channel %s [%p]", ch->name, ch));
+	return request_unsubscribe(pl, ch);
 }
 
 int bex_platform_unsubscribe_channels(struct libbex_platform *pl)
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2018 Karel Zak <karel.zak.007@gmail.com>
+ *
+ * This file may be redistributed under the terms of the
+ * GNU Lesser General Public License.
+ */
+
+/*
+ * Private single-producer/single-consumer lock-free ring of the channel
+ * messages. The producer is the connection thread, the consumer is the
+ * thread which calls bex_platform_dispatch(). The slots have fixed size, so
+ * the messages are written in place and nothing is allocated per message.
+ */
+#include "bexP.h"
+
+#define ring_slot(_r, _i)	((struct libbex_ring_msg *) \
+				 ((_r)->slots + ((_i) & ((_r)->size - 1)) * (_r)->slotsz))
+
+struct libbex_ring *bex_new_ring(size_t size)
+{
+	struct libbex_ring *r;
+
+	if (!size || (size & (size - 1)))
+		return NULL;		/* power of 2 */
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return NULL;
+
+	r->size = size;
+	r->slotsz = sizeof(struct libbex_ring_msg) + BEX_RING_DATASZ;
+	r->slots = calloc(size, r->slotsz);
+	if (!r->slots) {
+		free(r);
+		return NULL;
+	}
+
+	DBG(PLAT, bex_debugobj(r, "alloc ring [size=%zu]", size));
+	return r;
+}
+
+void bex_free_ring(struct libbex_ring *r)
+{
+	if (!r)
+		return;
+
+	DBG(PLAT, bex_debugobj(r, "free ring"));
+	free(r->slots);
+	free(r);
+}
+
+/* producer: returns free slot or NULL if the ring is full */
+struct libbex_ring_msg *bex_ring_reserve(struct libbex_ring *r)
+{
+	size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+	if (r->head - tail >= r->size)
+		return NULL;
+	return ring_slot(r, r->head);
+}
+
+/* producer: publishes the reserved slot */
+void bex_ring_commit(struct libbex_ring *r)
+{
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+/* consumer: returns the oldest message or NULL if the ring is empty */
+struct libbex_ring_msg *bex_ring_peek(struct libbex_ring *r)
+{
+	size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+	if (head == r->tail)
+		return NULL;
+	return ring_slot(r, r->tail);
+}
+
+/* consumer: releases the oldest message */
+void bex_ring_release(struct libbex_ring *r)
+{
+	__atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,379 @@
+/*
+ * Copyright (C) 2018 Karel Zak <karel.zak.007@gmail.com>
+ *
+ * This file may be redistributed under the terms of the
+ * GNU Lesser General Public License.
+ */
+
+/**
+ * SECTION: scan
+ * @title: Scanner
+ * @short_description: structural characters scanner
+ *
+ * The scanner classifies the frame in 64-byte blocks and builds a bitmap of
+ * the structural characters ({}[],:) outside of the strings and of the
+ * unescaped quotes. The block classifier is selected at runtime (AVX2, SSE2
+ * or the generic scalar code), the rest is common for all variants.
+ */
+#include "bexP.h"
+
+#if defined(HAVE_IMMINTRIN_H) && (defined(__x86_64__) || defined(__i386__)) \
+    && __GNUC_PREREQ(4, 9)
+# define BEX_SCAN_X86	1
+# include <immintrin.h>
+#endif
+
+/* Classifies 64 bytes, returns structural characters mask */
+typedef uint64_t (*scan_block_fn)(const unsigned char *p,
+				  uint64_t *quotes, uint64_t *backslashes);
+
+static uint64_t scan_block_generic(const unsigned char *p,
+				   uint64_t *quotes, uint64_t *backslashes)
+{
+	uint64_t st = 0, qu = 0, bs = 0;
+	size_t i;
+
+	for (i = 0; i < 64; i++) {
+		switch (p[i]) {
+		case '{':
+		case '}':
+		case '[':
+		case ']':
+		case ',':
+		case ':':
+			st |= 1ULL << i;
+			break;
+		case '"':
+			qu |= 1ULL << i;
+			break;
+		case '\\':
+			bs |= 1ULL << i;
+			break;
+		}
+	}
+
+	*quotes = qu;
+	*backslashes = bs;
+	return st;
+}
+
+#ifdef BEX_SCAN_X86
+static inline __attribute__((target("sse2"), always_inline))
+unsigned int cmpeq_sse2(__m128i x, char c)
+{
+	return (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8(c)));
+}
+
+static __attribute__((target("sse2")))
+uint64_t scan_block_sse2(const unsigned char *p,
+			 uint64_t *quotes, uint64_t *backslashes)
+{
+	uint64_t st = 0, qu = 0, bs = 0;
+	size_t i;
+
+	for (i = 0; i < 64; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *) (p + i));
+		/* '[' ']' and '{' '}' differ in bit 0x20 only */
+		__m128i y = _mm_or_si128(x, _mm_set1_epi8(0x20));
+
+		st |= (uint64_t) (cmpeq_sse2(y, '{') | cmpeq_sse2(y, '}') |
+				  cmpeq_sse2(x, ',') | cmpeq_sse2(x, ':')) << i;
+		qu |= (uint64_t) cmpeq_sse2(x, '"') << i;
+		bs |= (uint64_t) cmpeq_sse2(x, '\\') << i;
+	}
+
+	*quotes = qu;
+	*backslashes = bs;
+	return st;
+}
+
+static inline __attribute__((target("avx2"), always_inline))
+uint32_t cmpeq_avx2(__m256i x, char c)
+{
+	return (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(c)));
+}
+
+static __attribute__((target("avx2")))
+uint64_t scan_block_avx2(const unsigned char *p,
+			 uint64_t *quotes, uint64_t *backslashes)
+{
+	uint64_t st = 0, qu = 0, bs = 0;
+	size_t i;
+
+	for (i = 0; i < 64; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *) (p + i));
+		__m256i y = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+
+		st |= (uint64_t) (cmpeq_avx2(y, '{') | cmpeq_avx2(y, '}') |
+				  cmpeq_avx2(x, ',') | cmpeq_avx2(x, ':')) << i;
+		qu |= (uint64_t) cmpeq_avx2(x, '"') << i;
+		bs |= (uint64_t) cmpeq_avx2(x, '\\') << i;
+	}
+
+	*quotes = qu;
+	*backslashes = bs;
+	return st;
+}
+#endif /* BEX_SCAN_X86 */
+
+#ifdef TEST_PROGRAM_SCAN
+static scan_block_fn test_scan_block;	/* forced classifier */
+#endif
+
+static scan_block_fn get_scan_block(void)
+{
+	static scan_block_fn fn;
+
+#ifdef TEST_PROGRAM_SCAN
+	if (test_scan_block)
+		return test_scan_block;
+#endif
+	if (fn)
+		return fn;
+#ifdef BEX_SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		DBG(PARSE, bex_debug("scan: using AVX2"));
+		fn = scan_block_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		DBG(PARSE, bex_debug("scan: using SSE2"));
+		fn = scan_block_sse2;
+	}
+#endif
+	if (!fn) {
+		DBG(PARSE, bex_debug("scan: using generic code"));
+		fn = scan_block_generic;
+	}
+	return fn;
+}
+
+/* Returns mask of the characters escaped by backslash */
+static uint64_t get_escaped(uint64_t bs, int *carry)
+{
+	uint64_t escaped = 0;
+	int esc = *carry;
+	size_t i;
+
+	if (!bs) {
+		*carry = 0;
+		return esc ? 1 : 0;
+	}
+
+	for (i = 0; i < 64; i++) {
+		if (esc) {
+			escaped |= 1ULL << i;
+			esc = 0;
+		} else if (bs & (1ULL << i))
+			esc = 1;
+	}
+
+	*carry = esc;
+	return escaped;
+}
+
+/* Every bit is XOR of all the previous bits, it marks regions between quotes */
+static inline uint64_t prefix_xor(uint64_t x)
+{
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+/**
+ * bex_scan_structurals:
+ * @str: data
+ * @len: size of the data
+ * @bits: returns bitmap, (@len + 63) / 64 words
+ *
+ * Marks structural characters outside of the strings and all unescaped
+ * quotes in the @bits.
+ *
+ * Returns: 0 on success, -EINVAL for unterminated string.
+ */
+int bex_scan_structurals(const char *str, size_t len, uint64_t *bits)
+{
+	scan_block_fn scan_block = get_scan_block();
+	const unsigned char *p = (const unsigned char *) str;
+	uint64_t instring = 0;
+	int escaped = 0;
+	size_t i;
+
+	for (i = 0; i < len; i += 64) {
+		unsigned char tail[64];
+		uint64_t st, qu, bs;
+
+		if (len - i < 64) {
+			memset(tail, ' ', sizeof(tail));
+			memcpy(tail, p + i, len - i);
+			st = scan_block(tail, &qu, &bs);
+		} else
+			st = scan_block(p + i, &qu, &bs);
+
+		if (bs || escaped)
+			qu &= ~get_escaped(bs, &escaped);
+
+		instring ^= prefix_xor(qu);
+		bits[i / 64] = (st & ~instring) | qu;
+
+		/* broadcast the last bit to the next block */
+		instring = (uint64_t) ((int64_t) instring >> 63);
+	}
+
+	return instring ? -EINVAL : 0;
+}
+
+#ifdef TEST_PROGRAM_SCAN
+static const struct {
+	const char *name;
+	scan_block_fn fn;
+	const char *feature;
+} variants[] = {
+	{ "generic", scan_block_generic, NULL },
+#ifdef BEX_SCAN_X86
+	{ "sse2", scan_block_sse2, "sse2" },
+	{ "avx2", scan_block_avx2, "avx2" },
+#endif
+};
+
+static int variant_supported(size_t v)
+{
+#ifdef BEX_SCAN_X86
+	if (variants[v].feature) {
+		__builtin_cpu_init();
+		return strcmp(variants[v].feature, "avx2") == 0 ?
+			__builtin_cpu_supports("avx2") :
+			__builtin_cpu_supports("sse2");
+	}
+#endif
+	return 1;
+}
+
+/* byte by byte version of bex_scan_structurals() */
+static int scan_reference(const char *str, size_t len, uint64_t *bits)
+{
+	int instring = 0, esc = 0;
+	size_t i;
+
+	memset(bits, 0, ((len + 63) / 64) * sizeof(uint64_t));
+
+	for (i = 0; i < len; i++) {
+		int mark = 0;
+
+		if (esc)
+			esc = 0;
+		else if (str[i] == '\\') {
+			esc = 1;
+			continue;
+		} else if (str[i] == '"') {
+			instring = !instring;
+			mark = 1;
+		}
+		if (!instring && strchr("{}[],:", str[i]))
+			mark = 1;
+		if (mark)
+			bits[i / 64] |= 1ULL << (i % 64);
+	}
+	return instring ? -EINVAL : 0;
+}
+
+static int test_scan_random(void)
+{
+	static const char chars[] = "{}[],:\"\\ a1";
+	char str[512];
+	uint64_t ref[8], bits[8];
+	size_t v, i, len;
+	int round, rc = EXIT_SUCCESS;
+
+	srand(42);
+
+	for (round = 0; round < 20000; round++) {
+		int ref_rc;
+
+		len = rand() % sizeof(str);
+		for (i = 0; i < len; i++)
+			str[i] = chars[rand() % (sizeof(chars) - 1)];
+
+		ref_rc = scan_reference(str, len, ref);
+
+		for (v = 0; v < ARRAY_SIZE(variants); v++) {
+			if (!variant_supported(v))
+				continue;
+			test_scan_block = variants[v].fn;
+			if (bex_scan_structurals(str, len, bits) != ref_rc ||
+			    memcmp(bits, ref, ((len + 63) / 64) * sizeof(uint64_t)) != 0) {
+				fprintf(stderr, "%s: round %d: '%.*s': bitmap mismatch\n",
+					variants[v].name, round, (int) len, str);
+				rc = EXIT_FAILURE;
+			}
+		}
+	}
+	test_scan_block = NULL;
+	return rc;
+}
+
+/* all variants have to produce the same tokens */
+static int test_scan_tokens(void)
+{
+	static const char *tests[] = {
+		"[17470,[[1574,1574.1,-0.25,1557530466000,\"te\"]],12,1557530466123]",
+		"{\"event\":\"subscribed\",\"channel\":\"book\",\"chanId\":10961,"
+		 "\"symbol\":\"tBTCUSD\",\"prec\":\"P0\",\"freq\":\"F0\",\"len\":\"25\"}",
+		"{\"event\":\"info\",\"msg\":\"escaped \\\" quote, [not] {struct}:"
+		 " and a very long string crossing the 64-byte block boundary\\\\\","
+		 "\"code\":20051}",
+		"[0,\"hb\"]",
+		"[]",
+	};
+	struct libbex_parser ref = { .str = NULL }, ps = { .str = NULL };
+	size_t i, v;
+	int rc = EXIT_SUCCESS;
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++) {
+		size_t len = strlen(tests[i]);
+
+		test_scan_block = scan_block_generic;
+		if (bex_parser_tokenize(&ref, tests[i], len) != 0) {
+			fprintf(stderr, "generic: cannot tokenize '%s'\n", tests[i]);
+			rc = EXIT_FAILURE;
+			continue;
+		}
+
+		for (v = 1; v < ARRAY_SIZE(variants); v++) {
+			if (!variant_supported(v))
+				continue;
+			test_scan_block = variants[v].fn;
+			if (bex_parser_tokenize(&ps, tests[i], len) != 0 ||
+			    ps.ntoks != ref.ntoks ||
+			    memcmp(ps.toks, ref.toks, ref.ntoks * sizeof(*ref.toks)) != 0) {
+				fprintf(stderr, "%s: '%s': tokens mismatch\n",
+					variants[v].name, tests[i]);
+				rc = EXIT_FAILURE;
+			}
+		}
+	}
+
+	bex_deinit_parser(&ref);
+	bex_deinit_parser(&ps);
+	test_scan_block = NULL;
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 2 && strcmp(argv[1], "--random") == 0)
+		return test_scan_random();
+	if (argc == 2 && strcmp(argv[1], "--tokens") == 0)
+		return test_scan_tokens();
+	if (argc == 1)
+		return test_scan_random() == EXIT_SUCCESS &&
+		       test_scan_tokens() == EXIT_SUCCESS ?
+				EXIT_SUCCESS : EXIT_FAILURE;
+
+	fprintf(stderr, "usage: %s [--random | --tokens]\n", argv[0]);
+	exit(EXIT_FAILURE);
+}
+#endif /* TEST_PROGRAM_SCAN */
@@ -8,18 +8,24 @@ static const struct libbex_symbol symbols[] = {
 		.right	= "USD",
 		.price	= "%.04Lf",
 		.amount	= "%+6.0Lf",
+		.price_scale = 5,
+		.amount_scale = 8,
 	},{
 		.name	= "BTCUSD",
 		.left	= "BTC",
 		.right	= "USD",
 		.price	= "%.01Lf",
 		.amount	= "%+7.02Lf",
+		.price_scale = 2,
+		.amount_scale = 8,
 	},{
 		.name	= "ETHUSD",
 		.left	= "ETH",
 		.right	= "USD",
 		.price	= "%.02Lf",
 		.amount	= "%+7.02Lf",
+		.price_scale = 3,
+		.amount_scale = 8,
 	}
 
 };
@@ -63,3 +69,25 @@ const char *bex_symbol_get_amount_format(const struct libbex_symbol *sy)
 {
 	return sy ? sy->amount : NULL;
 }
+
+/**
+ * bex_symbol_get_price_scale:
+ * @sy: symbol
+ *
+ * Returns: number of decimal places used for prices or BEX_DECIMAL_DEFAULT_SCALE.
+ */
+unsigned int bex_symbol_get_price_scale(const struct libbex_symbol *sy)
+{
+	return sy ? sy->price_scale : BEX_DECIMAL_DEFAULT_SCALE;
+}
+
+/**
+ * bex_symbol_get_amount_scale:
+ * @sy: symbol
+ *
+ * Returns: number of decimal places used for amounts or BEX_DECIMAL_DEFAULT_SCALE.
+ */
+unsigned int bex_symbol_get_amount_scale(const struct libbex_symbol *sy)
+{
+	return sy ? sy->amount_scale : BEX_DECIMAL_DEFAULT_SCALE;
+}
@@ -6,8 +6,10 @@ void bex_reset_value(struct libbex_value *va)
 {
 	switch (va->type) {
 	case BEX_TYPE_STR:
-		free(va->data.str);
+		if (!va->str_in_arena)
+			free(va->data.str);
 		va->data.str = NULL;
+		va->str_in_arena = 0;
 		break;
 	case BEX_TYPE_U64:
 		va->data.u64 = 0;
@@ -18,6 +20,9 @@ void bex_reset_value(struct libbex_value *va)
 	case BEX_TYPE_FLOAT:
 		va->data.fl = 0;
 		break;
+	case BEX_TYPE_DECIMAL:
+		va->data.dec.num = 0;	/* keep scale */
+		break;
 	}
 }
 
@@ -28,6 +33,8 @@ static void free_value(struct libbex_value *va)
 
 	DBG(VAL, bex_debugobj(va, "   free [name=%s]", va->name));
 	bex_reset_value(va);
+	if (va->in_arena)
+		return;		/* deallocated by arena reset */
 	free(va->name);
 	free(va);
 }
@@ -95,11 +102,29 @@ void bex_unref_value(struct libbex_value *va)
 	}
 }
 
+/* size of the value data in reply struct or batch column */
+size_t bex_value_type_size(int type)
+{
+	switch (type) {
+	case BEX_TYPE_STR:
+		return sizeof(char *);
+	case BEX_TYPE_U64:
+		return sizeof(uint64_t);
+	case BEX_TYPE_S64:
+	case BEX_TYPE_DECIMAL:
+		return sizeof(int64_t);
+	case BEX_TYPE_FLOAT:
+		return sizeof(long double);
+	}
+	return 0;
+}
+
 /**
  * bex_value_set_generated:
  * @va: value pointer
  *
- * Marks value as generated (see bex_reset_event(), etc.)
+ * Marks value as generated (see bex_reset_event(), etc.). The status has to
+ * be set before the value is added to an array.
  *
  * Returns: 0 on success, <0 on error.
  */
@@ -185,6 +210,8 @@ int bex_value_set_float(struct libbex_value *va, long double num)
 
 long double bex_value_get_float(struct libbex_value *va)
 {
+	if (va->type == BEX_TYPE_DECIMAL)
+		return bex_decimal_to_float(va->data.dec.num, va->data.dec.scale);
 	return va->data.fl;
 }
 
@@ -196,38 +223,211 @@ struct libbex_value *bex_new_value_float(const char *name, long double n)
 	return va;
 }
 
+/**
+ * bex_value_set_decimal:
+ * @va: value
+ * @num: mantissa
+ * @scale: number of decimal places
+ *
+ * Sets fixed-point number, the value is @num * 10^-@scale. The @scale is
+ * kept for all next updates, bex_value_set_from_string() converts the
+ * number to this scale.
+ *
+ * Returns: 0 on success, <0 on error.
+ */
+int bex_value_set_decimal(struct libbex_value *va, int64_t num, unsigned int scale)
+{
+	if (scale > BEX_DECIMAL_MAXSCALE)
+		return -ERANGE;
+	bex_reset_value(va);
+	va->data.dec.num = num;
+	va->data.dec.scale = scale;
+	va->type = BEX_TYPE_DECIMAL;
+	return 0;
+}
+
+/**
+ * bex_value_get_decimal:
+ * @va: value
+ *
+ * See also bex_value_get_scale().
+ *
+ * Returns: mantissa of the fixed-point number or 0 if @va is not decimal.
+ */
+int64_t bex_value_get_decimal(struct libbex_value *va)
+{
+	return va->type == BEX_TYPE_DECIMAL ? va->data.dec.num : 0;
+}
+
+/**
+ * bex_value_get_scale:
+ * @va: value
+ *
+ * Returns: number of decimal places of the fixed-point number.
+ */
+unsigned int bex_value_get_scale(struct libbex_value *va)
+{
+	return va->type == BEX_TYPE_DECIMAL ? va->data.dec.scale : 0;
+}
+
+struct libbex_value *bex_new_value_decimal(const char *name, int64_t num, unsigned int scale)
+{
+	struct libbex_value *va = bex_new_value(name);
+	if (va && bex_value_set_decimal(va, num, scale) != 0) {
+		bex_unref_value(va);
+		va = NULL;
+	}
+	return va;
+}
+
+/**
+ * bex_value_snprintf_decimal:
+ * @va: value
+ * @buf: output buffer
+ * @sz: size of the buffer
+ * @fmt: format (e.g. bex_symbol_get_price_format())
+ *
+ * Returns: see bex_decimal_snprintf().
+ */
+int bex_value_snprintf_decimal(struct libbex_value *va, char *buf, size_t sz, const char *fmt)
+{
+	if (!va || va->type != BEX_TYPE_DECIMAL)
+		return -EINVAL;
+	return bex_decimal_snprintf(buf, sz, fmt, va->data.dec.num, va->data.dec.scale);
+}
+
+/*
+ * The @str does not have to be zero terminated (it's usually a span in
+ * the receive buffer), so strtoumax() and friends cannot be used.
+ */
+static int parse_u64(const char *str, size_t sz, uint64_t *num)
+{
+	uint64_t x = 0;
+	size_t i = 0;
+
+	if (sz && *str == '+')
+		i++;
+	if (i == sz)
+		return -EINVAL;
+
+	for (; i < sz; i++) {
+		unsigned int d = (unsigned char) str[i] - '0';
+
+		if (d > 9)
+			return -EINVAL;
+		if (x > (UINT64_MAX - d) / 10)
+			return -ERANGE;
+		x = x * 10 + d;
+	}
+	*num = x;
+	return 0;
+}
+
+static int parse_s64(const char *str, size_t sz, int64_t *num)
+{
+	uint64_t x;
+	int neg = sz && *str == '-';
+	int rc = parse_u64(str + neg, sz - neg, &x);
+
+	if (rc)
+		return rc;
+	if (x > (uint64_t) INT64_MAX + neg)
+		return -ERANGE;
+
+	*num = neg ? (int64_t) (0 - x) : (int64_t) x;
+	return 0;
+}
+
+/**
+ * bex_value_set_from_string:
+ * @va: value
+ * @str: data (does not have to be zero terminated)
+ * @sz: size of the @str
+ *
+ * Converts @str to the value type. The numbers have to be complete, the
+ * value is not modified for garbage like "1.5" or "abc" for integers.
+ * JSON null zeroizes the number.
+ *
+ * Returns: 0 on success, -EINVAL for garbage, -ERANGE on overflow.
+ */
 int bex_value_set_from_string(struct libbex_value *va, const char *str, size_t sz)
 {
-	char *end = NULL;
+	int rc = 0;
 
 	if (!va)
 		return -EINVAL;
 
-	errno = 0;
+	if (va->type != BEX_TYPE_STR && sz == 4 && memcmp(str, "null", 4) == 0) {
+		bex_reset_value(va);
+		return 0;
+	}
 
 	switch (va->type) {
 	case BEX_TYPE_STR:
-		free(va->data.str);
+		bex_reset_value(va);
 		va->data.str = strndup(str, sz);
 		break;
 	case BEX_TYPE_U64:
-		va->data.u64 = strtoumax(str, &end, 10);
-		if (errno || str == end)
-			DBG(VAL, bex_debugobj(va, "strtoumax() failed"));
+	{
+		uint64_t num;
+
+		rc = parse_u64(str, sz, &num);
+		if (!rc)
+			va->data.u64 = num;
 		break;
+	}
 	case BEX_TYPE_S64:
-		va->data.s64 = strtoimax(str, &end, 10);
-		if (errno || str == end)
-			DBG(VAL, bex_debugobj(va, "strtosmax() failed"));
+	{
+		int64_t num;
+
+		rc = parse_s64(str, sz, &num);
+		if (!rc)
+			va->data.s64 = num;
 		break;
+	}
 	case BEX_TYPE_FLOAT:
-		va->data.fl = strtold(str, &end);
-		if (errno || str == end)
-			DBG(VAL, bex_debugobj(va, "strtold() failed"));
+	{
+		int64_t num;
+		unsigned int scale;
+
+		rc = bex_parse_decimal(str, sz, &num, &scale);
+		if (rc == 0) {
+			va->data.fl = bex_decimal_to_float(num, scale);
+			break;
+		}
+		/* out of fixed-point range */
+		if (rc == -ERANGE && sz < 64) {
+			char buf[64], *end = NULL;
+			long double fl;
+
+			memcpy(buf, str, sz);
+			buf[sz] = '\0';
+			errno = 0;
+			fl = strtold(buf, &end);
+			if (!errno && end == buf + sz) {
+				va->data.fl = fl;
+				rc = 0;
+			}
+		}
 		break;
+	}
+	case BEX_TYPE_DECIMAL:
+	{
+		int64_t num;
+		unsigned int scale;
+
+		rc = bex_parse_decimal(str, sz, &num, &scale);
+		if (!rc)
+			rc = bex_decimal_rescale(&num, scale, va->data.dec.scale);
+		if (!rc)
+			va->data.dec.num = num;
+		break;
+	}
 	default:
 		break;
 	}
 
-	return 0;
+	if (rc)
+		DBG(VAL, bex_debugobj(va, "cannot convert '%.*s' [rc=%d]", (int) sz, str, rc));
+	return rc;
 }
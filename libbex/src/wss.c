@@ -9,13 +9,28 @@ struct wss_ctl {
 	struct lws_context	*context;
 	struct lws		*wsi;
 	struct libbex_platform  *pl;
+	struct libbex_conn	*conn;
 
+	pthread_mutex_t		lock;		/* pending_data and free_data */
 	struct list_head	pending_data;
 	struct list_head	free_data;
 	unsigned char		*buf;
 	size_t			bufsz;
 
-	unsigned int		established : 1;
+	char			*rxbuf;		/* fragmented messages */
+	size_t			rxbufsz;
+	size_t			rxlen;
+	uint64_t		rx_time;	/* the first fragment */
+
+	struct pollfd		*pollfds;	/* sockets used by libwebsockets */
+	size_t			npollfds;
+	size_t			pollfdsz;
+
+	struct timeval		deadline;	/* connect timeout */
+
+	unsigned int		established : 1,
+				connecting : 1,	/* waiting for established */
+				closing : 1;	/* wss_disconnect() */
 };
 
 struct wss_iovec {
@@ -27,6 +42,153 @@ struct wss_iovec {
 
 static int wss_write(struct wss_ctl *wss);
 
+static void wss_established(struct wss_ctl *wss, struct lws *wsi)
+{
+	DBG(WSS, bex_debugobj(wss, "connected"));
+	wss->wsi = wsi;
+	wss->established = 1;
+	wss->connecting = 0;
+
+	bex_conn_connected(wss->conn);
+}
+
+/* the not sent data are useless for the next connection */
+static void wss_drop_pending(struct wss_ctl *wss)
+{
+	pthread_mutex_lock(&wss->lock);
+	while (!list_empty(&wss->pending_data)) {
+		struct wss_iovec *io = list_first_entry(&wss->pending_data,
+						struct wss_iovec, vects);
+		free(io->buf);
+		io->buf = NULL;
+		list_del(&io->vects);
+		list_add_tail(&io->vects, &wss->free_data);
+	}
+	pthread_mutex_unlock(&wss->lock);
+}
+
+/* the connection has been closed or failed, libwebsockets destroys @wsi */
+static void wss_closed(struct wss_ctl *wss, struct lws *wsi, int rc)
+{
+	int lost = wss->established && !wss->closing;
+	int failed = wss->connecting && !wss->closing;
+
+	if (wsi && wsi != wss->wsi)
+		return;
+	wss->established = 0;
+	wss->connecting = 0;
+	wss->wsi = NULL;
+	wss->rxlen = 0;
+
+	if (lost) {
+		wss_drop_pending(wss);
+		bex_conn_lost(wss->conn);
+	}
+	else if (failed)
+		bex_conn_failed(wss->conn, rc);
+}
+
+/*
+ * Complete messages are processed directly from the libwebsockets buffer,
+ * only the fragmented messages are collected into rxbuf.
+ */
+static int wss_receive(struct wss_ctl *wss, struct lws *wsi, const char *in, size_t len)
+{
+	int final = lws_is_final_fragment(wsi) && !lws_remaining_packet_payload(wsi);
+	int rc;
+
+	/* arrival of the message, before anything else */
+	if (!wss->rxlen)
+		wss->rx_time = bex_get_monotonic_ns();
+
+	if (final && !wss->rxlen)
+		return bex_conn_receive_buffer(wss->conn, in, len, wss->rx_time);
+
+	if (wss->rxbufsz < wss->rxlen + len) {
+		size_t newsz = ((wss->rxlen + len + 4096) >> 12) << 12;
+		char *tmp = realloc(wss->rxbuf, newsz);
+
+		DBG(WSS, bex_debugobj(wss, " (re)allocated new receive buffer [sz=%zu]", newsz));
+		if (!tmp) {
+			wss->rxlen = 0;
+			return -ENOMEM;
+		}
+		wss->rxbuf = tmp;
+		wss->rxbufsz = newsz;
+	}
+	memcpy(wss->rxbuf + wss->rxlen, in, len);
+	wss->rxlen += len;
+
+	if (!final)
+		return 0;
+
+	rc = bex_conn_receive_buffer(wss->conn, wss->rxbuf, wss->rxlen, wss->rx_time);
+	wss->rxlen = 0;
+	return rc;
+}
+
+/* returns index of @fd in the connection sockets or -1 */
+static ssize_t wss_find_pollfd(struct wss_ctl *wss, int fd)
+{
+	size_t i;
+
+	for (i = 0; i < wss->npollfds; i++) {
+		if (wss->pollfds[i].fd == fd)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Keeps track of the sockets for the external event loop, see
+ * bex_platform_get_pollfds().
+ */
+static int wss_pollfd(struct wss_ctl *wss, int op, const struct lws_pollargs *pa)
+{
+	struct libbex_platform *pl = wss->pl;
+	ssize_t x = wss_find_pollfd(wss, pa->fd);
+	size_t i = x < 0 ? wss->npollfds : (size_t) x;
+
+	switch (op) {
+	case BEX_POLL_ADD:
+		if (i < wss->npollfds)
+			break;
+		if (wss->npollfds == wss->pollfdsz) {
+			size_t newsz = wss->pollfdsz ? wss->pollfdsz * 2 : 4;
+			struct pollfd *tmp = realloc(wss->pollfds, newsz * sizeof(struct pollfd));
+
+			if (!tmp)
+				return -ENOMEM;
+			wss->pollfds = tmp;
+			wss->pollfdsz = newsz;
+		}
+		wss->npollfds++;
+		break;
+	case BEX_POLL_DEL:
+		if (i == wss->npollfds)
+			return 0;
+		wss->pollfds[i] = wss->pollfds[--wss->npollfds];
+		break;
+	case BEX_POLL_CHANGE:
+		if (i == wss->npollfds)
+			return 0;
+		break;
+	}
+
+	if (op != BEX_POLL_DEL) {
+		wss->pollfds[i].fd = pa->fd;
+		wss->pollfds[i].events = pa->events;
+		wss->pollfds[i].revents = 0;
+	}
+
+	DBG(WSS, bex_debugobj(wss, "poll fd %d [op=%d, events=0x%x, nfds=%zu]",
+				pa->fd, op, pa->events, wss->npollfds));
+
+	if (pl->poll_callback)
+		return pl->poll_callback(pl, pa->fd, pa->events, op);
+	return 0;
+}
+
 static int wss_callback(struct lws *wsi,
 			enum lws_callback_reasons reason,
 			void *user, void *in, size_t len)
@@ -38,32 +200,60 @@ static int wss_callback(struct lws *wsi,
 	case LWS_CALLBACK_CLIENT_ESTABLISHED:
 		DBG(WSS, bex_debug("CALLBACK: client extablished"));
 		if (wss)
-			wss->established = 1;
+			wss_established(wss, wsi);
 		lws_callback_on_writable(wsi);
 		break;
 
 	case LWS_CALLBACK_CLIENT_RECEIVE:
 		DBG(WSS, bex_debug("CALLBACK: client incomming data"));
 		if (wss && in)
-			bex_platform_receive(wss->pl, in);
+			wss_receive(wss, wsi, in, len);
 		break;
 
 	case LWS_CALLBACK_CLIENT_WRITEABLE:
 		DBG(WSS, bex_debug("CALLBACK: client writeable"));
-		if (wss)
-			wss_write(wss);
+		if (wss && wss_write(wss) == -EIO)
+			return -1;		/* close the connection */
 		break;
 
 	case LWS_CALLBACK_CLOSED:
+	case LWS_CALLBACK_CLIENT_CLOSED:
 		DBG(WSS, bex_debug("CALLBACK: close"));
 		if (wss)
-			wss->established = 0;
+			wss_closed(wss, wsi, -ECONNRESET);
 		break;
 
 	case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
 		DBG(WSS, bex_debug("CALLBACK: connection error %s", in ? (char *) in : ""));
 		if (wss)
-			wss->established = 0;
+			wss_closed(wss, wsi, -ECONNREFUSED);
+		break;
+
+	case LWS_CALLBACK_ADD_POLL_FD:
+	case LWS_CALLBACK_DEL_POLL_FD:
+	case LWS_CALLBACK_CHANGE_MODE_POLL_FD:
+		/* called for the context, not for the connection */
+		wss = lws_context_user(lws_get_context(wsi));
+		if (wss && in)
+			return wss_pollfd(wss,
+				reason == LWS_CALLBACK_ADD_POLL_FD ? BEX_POLL_ADD :
+				reason == LWS_CALLBACK_DEL_POLL_FD ? BEX_POLL_DEL :
+								     BEX_POLL_CHANGE,
+				(struct lws_pollargs *) in);
+		break;
+
+	case LWS_CALLBACK_EVENT_WAIT_CANCELLED:
+		/* wss_send() from another thread, see wss_cancel_service() */
+		wss = lws_context_user(lws_get_context(wsi));
+		if (wss && wss->established) {
+			int pending;
+
+			pthread_mutex_lock(&wss->lock);
+			pending = !list_empty(&wss->pending_data);
+			pthread_mutex_unlock(&wss->lock);
+			if (pending)
+				lws_callback_on_writable(wss->wsi);
+		}
 		break;
 
 	default:
@@ -73,9 +263,10 @@ static int wss_callback(struct lws *wsi,
 	return 0;
 }
 
-int wss_is_connected(struct libbex_platform *pl)
+int wss_is_connected(struct libbex_conn *conn)
 {
-	return pl && pl->wss && ((struct wss_ctl *) pl->wss)->wsi;
+	return conn && conn->wss && ((struct wss_ctl *) conn->wss)->wsi
+		&& ((struct wss_ctl *) conn->wss)->established;
 }
 
 static const struct lws_protocols __wss_protocols[] =
@@ -88,18 +279,89 @@ static const struct lws_protocols __wss_protocols[] =
 	{ NULL, NULL, 0, 0 } /* end */
 };
 
-int wss_connect(struct libbex_platform *pl)
+/*
+ * Starts one connection attempt, it does not wait. The result is reported by
+ * the callbacks when the context is serviced, see wss_established() and
+ * wss_closed().
+ */
+static int wss_connect_start(struct wss_ctl *wss)
 {
-	struct wss_ctl *wss = NULL;
+	struct libbex_platform *pl = wss->pl;
         struct lws_client_connect_info cinfo;
-	unsigned int try;
 
-	if (!pl)
+	memset(&cinfo, 0, sizeof cinfo);
+	cinfo.context = wss->context;
+	cinfo.ssl_connection = pl->uri_ssl;
+	cinfo.port = pl->uri_port;
+	cinfo.address = pl->uri_addr;
+	cinfo.path = pl->uri_path;
+	cinfo.host = pl->uri_addr;
+	cinfo.origin = pl->uri_addr;
+	cinfo.ietf_version_or_minus_one = -1;
+	cinfo.protocol = "";
+	cinfo.userdata = wss;
+
+	DBG(WSS, bex_debugobj(wss, "connecting... [timeout=%u]", pl->connect_timeout));
+	if (pl->connect_timeout) {
+		struct timeval now, tm = {
+			.tv_sec = pl->connect_timeout / 1000,
+			.tv_usec = (pl->connect_timeout % 1000) * 1000
+		};
+		gettimeofday(&now, NULL);
+		timeradd(&now, &tm, &wss->deadline);
+	}
+	wss->established = 0;
+	wss->connecting = 1;
+	wss->wsi = lws_client_connect_via_info(&cinfo);
+
+	if (!wss->wsi) {
+		DBG(WSS, bex_debugobj(wss, "connect failed"));
+		if (wss->connecting) {
+			wss->connecting = 0;
+			bex_conn_failed(wss->conn, -ENOTCONN);
+		}
+		return -ENOTCONN;
+	}
+	return 0;
+}
+
+/* aborts the connection attempt if the deadline is over */
+static void wss_check_deadline(struct wss_ctl *wss)
+{
+	struct timeval now;
+
+	if (!wss->connecting || !timerisset(&wss->deadline))
+		return;
+
+	gettimeofday(&now, NULL);
+	if (timercmp(&now, &wss->deadline, <))
+		return;
+
+	DBG(WSS, bex_debugobj(wss, "connect timeout"));
+
+	/* libwebsockets closes the wsi later, ignore its callbacks */
+	lws_set_timeout(wss->wsi, PENDING_TIMEOUT_AWAITING_CONNECT_RESPONSE, LWS_TO_KILL_ASYNC);
+	wss->wsi = NULL;
+	wss->connecting = 0;
+	bex_conn_failed(wss->conn, -ETIMEDOUT);
+}
+
+/*
+ * Starts the connection, see bex_platform_request_connect(). The pending
+ * data (e.g. subscribe requests) are sent when established.
+ */
+int wss_connect(struct libbex_conn *conn)
+{
+	struct libbex_platform *pl;
+	struct wss_ctl *wss = NULL;
+
+	if (!conn)
 		return -EINVAL;
 
-	DBG(WSS, bex_debug("connect"));
+	DBG(WSS, bex_debug("connect #%u", conn->idx));
 
-	wss = (struct wss_ctl *) pl->wss;
+	pl = conn->pl;
+	wss = (struct wss_ctl *) conn->wss;
 	if (!wss) {
 	        struct lws_context_creation_info info;
 
@@ -111,8 +373,10 @@ int wss_connect(struct libbex_platform *pl)
 			return -ENOMEM;
 		DBG(WSS, bex_debugobj(wss, "alloc"));
 		wss->pl = pl;
+		wss->conn = conn;
 		INIT_LIST_HEAD(&wss->pending_data);
 		INIT_LIST_HEAD(&wss->free_data);
+		pthread_mutex_init(&wss->lock, NULL);
 
 		memset(&info, 0, sizeof info);
 		info.port = CONTEXT_PORT_NO_LISTEN;
@@ -123,6 +387,7 @@ int wss_connect(struct libbex_platform *pl)
 		info.gid = -1;
 		info.uid = -1;
 		info.options = 0;
+		info.user = wss;
 #if defined(LWS_OPENSSL_SUPPORT)
 		info.options |= LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
 #endif
@@ -130,10 +395,12 @@ int wss_connect(struct libbex_platform *pl)
 		wss->context = lws_create_context(&info);
 		if (!wss->context) {
 			DBG(WSS, bex_debugobj(wss, "failed to create a context"));
+			pthread_mutex_destroy(&wss->lock);
+			free(wss);
 			return -EINVAL;
 		}
 
-		pl->wss = (void *) wss;
+		conn->wss = (void *) wss;
 		DBG(WSS, bex_debugobj(wss, "initialize data done"));
 	}
 
@@ -142,45 +409,17 @@ int wss_connect(struct libbex_platform *pl)
 		return 0;
 	}
 
-	memset(&cinfo, 0, sizeof cinfo);
-	cinfo.context = wss->context;
-	cinfo.ssl_connection = pl->uri_ssl;
-	cinfo.port = pl->uri_port;
-	cinfo.address = pl->uri_addr;
-	cinfo.path = pl->uri_path;
-	cinfo.host = pl->uri_addr;
-	cinfo.origin = pl->uri_addr;
-	cinfo.ietf_version_or_minus_one = -1;
-	cinfo.protocol = "";
-	cinfo.userdata = wss;
-
-	for (try = 0; try < pl->connection_attempts; try++) {
-		DBG(WSS, bex_debugobj(wss, "#%u connecting...", try));
-		wss->wsi = lws_client_connect_via_info(&cinfo);
-		if (wss->wsi)
-			break;
-		if (pl->reconnect_timeout) {
-			DBG(WSS, bex_debugobj(wss, "  timeout [%u]", pl->reconnect_timeout));
-			xusleep(pl->reconnect_timeout);
-		}
-	}
-
-	/* wait to fully initialize connection */
-	while (!wss->established)
-		lws_service(wss->context, 50);
-
-	DBG(WSS, bex_debugobj(wss, "... done [%s]", wss->wsi ?  "CONNECTED" : "FAILED"));
-	return wss->wsi ? 0 : -1;
+	return wss_connect_start(wss);
 }
 
-int wss_disconnect(struct libbex_platform *pl)
+int wss_disconnect(struct libbex_conn *conn)
 {
 	struct wss_ctl *wss;
 
-	if (!pl || !pl->wss)
+	if (!conn || !conn->wss)
 		return -EINVAL;
 
-	wss = (struct wss_ctl *) pl->wss;
+	wss = (struct wss_ctl *) conn->wss;
 
 	if (wss->wsi) {
 		DBG(WSS, bex_debugobj(wss, "close connection"));
@@ -188,51 +427,194 @@ int wss_disconnect(struct libbex_platform *pl)
 	}
 
 	DBG(WSS, bex_debugobj(wss, "destroy context"));
+	wss->closing = 1;
 	lws_context_destroy(wss->context);
 
 	DBG(WSS, bex_debugobj(wss, "free"));
+	while (!list_empty(&wss->pending_data)) {
+		struct wss_iovec *io = list_first_entry(&wss->pending_data,
+						struct wss_iovec, vects);
+		list_del(&io->vects);
+		free(io->buf);
+		free(io);
+	}
+	while (!list_empty(&wss->free_data)) {
+		struct wss_iovec *io = list_first_entry(&wss->free_data,
+						struct wss_iovec, vects);
+		list_del(&io->vects);
+		free(io);
+	}
+	free(wss->buf);
+	free(wss->rxbuf);
+	free(wss->pollfds);
+	pthread_mutex_destroy(&wss->lock);
 	free(wss);
-	pl->wss = NULL;
+	conn->wss = NULL;
 	return 0;
 }
 
-int wss_service(struct libbex_platform *pl)
+/*
+ * Reconnects if necessary, returns 1 if there is a connection to service
+ * (established or in progress). The failed attempts are repeated after
+ * exponentially growing delay, the caller is not blocked by the delay.
+ */
+static int wss_check_connection(struct wss_ctl *wss)
+{
+	if (wss->connecting)
+		wss_check_deadline(wss);
+	if (wss->wsi)
+		return 1;
+
+	if (!bex_conn_can_connect(wss->conn)) {
+		DBG(WSS, bex_debugobj(wss, "no connection [waiting for reconnect]"));
+		return 0;
+	}
+	return wss_connect_start(wss) == 0;
+}
+
+
+int wss_service(struct libbex_conn *conn, int timeout)
 {
 	struct wss_ctl *wss;
 
-	if (!pl || !pl->wss)
+	if (!conn || !conn->wss)
 		return -EINVAL;
 
-	wss = (struct wss_ctl *) pl->wss;
+	wss = (struct wss_ctl *) conn->wss;
 
-	DBG(WSS, bex_debugobj(wss, "service [timeout=%d]", pl->service_timeout));
-	if (!wss->established) {
-		wss->wsi = NULL;
-		wss_connect(pl);
-	}
-	if (!wss->wsi)
-		DBG(WSS, bex_debugobj(wss, "no connection"));
-	else
-		lws_service(wss->context, pl->service_timeout);
+	DBG(WSS, bex_debugobj(wss, "service [timeout=%d]", timeout));
+	if (wss_check_connection(wss))
+		lws_service(wss->context, timeout);
+	else if (timeout > 0)
+		xusleep(min(timeout, 50) * 1000);	/* don't spin while waiting for reconnect */
 
 	return 0;
 }
 
-int wss_send(struct libbex_platform *pl, unsigned char *str, size_t sz)
+/*
+ * Services more connections, waits in one poll() for all the sockets.
+ */
+int wss_service_all(struct libbex_platform *pl, int timeout)
+{
+	size_t i, n = 0;
+	int rc;
+
+	for (i = 0; i < pl->nconns; i++) {
+		struct libbex_conn *conn = pl->conns[i];
+		struct wss_ctl *wss = (struct wss_ctl *) conn->wss;
+
+		if (!wss || !wss_check_connection(wss))
+			continue;
+		if (n + wss->npollfds > pl->pollfdsz) {
+			size_t newsz = n + wss->npollfds + 8;
+			struct pollfd *tmp = realloc(pl->pollfds, newsz * sizeof(struct pollfd));
+
+			if (!tmp)
+				return -ENOMEM;
+			pl->pollfds = tmp;
+			pl->pollfdsz = newsz;
+		}
+		if (!wss->npollfds)
+			continue;
+		memcpy(pl->pollfds + n, wss->pollfds, wss->npollfds * sizeof(struct pollfd));
+		n += wss->npollfds;
+	}
+
+	DBG(WSS, bex_debugobj(pl, "service all [timeout=%d, nfds=%zu]", timeout, n));
+	if (!n) {
+		if (timeout > 0)
+			xusleep(min(timeout, 50) * 1000);
+		return 0;
+	}
+
+	rc = poll(pl->pollfds, n, timeout);
+	if (rc < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	for (i = 0; i < n; i++) {
+		if (pl->pollfds[i].revents)
+			wss_service_fd(pl, pl->pollfds[i].fd, pl->pollfds[i].revents);
+	}
+	/* timeouts */
+	return wss_service_fd(pl, -1, 0);
+}
+
+/* returns number of sockets of all connections, copies up to @nfds */
+int wss_get_pollfds(struct libbex_platform *pl, struct pollfd *fds, size_t nfds)
+{
+	size_t i, n = 0;
+
+	if (!pl)
+		return 0;
+
+	for (i = 0; i < pl->nconns; i++) {
+		struct wss_ctl *wss = (struct wss_ctl *) pl->conns[i]->wss;
+
+		if (!wss)
+			continue;
+		if (fds && n < nfds)
+			memcpy(fds + n, wss->pollfds,
+			       min(nfds - n, wss->npollfds) * sizeof(struct pollfd));
+		n += wss->npollfds;
+	}
+	return n;
+}
+
+/* process ready I/O on @fd without waiting, @fd < 0 means timeouts only */
+int wss_service_fd(struct libbex_platform *pl, int fd, short revents)
+{
+	struct lws_pollfd pfd;
+	size_t i;
+
+	if (!pl)
+		return -EINVAL;
+
+	for (i = 0; i < pl->nconns; i++) {
+		struct wss_ctl *wss = (struct wss_ctl *) pl->conns[i]->wss;
+		ssize_t x;
+
+		if (!wss)
+			continue;
+		if (fd < 0) {
+			DBG(WSS, bex_debugobj(wss, "service timeouts"));
+			if (wss_check_connection(wss))
+				lws_service_fd(wss->context, NULL);
+			continue;
+		}
+
+		x = wss_find_pollfd(wss, fd);
+		if (x < 0)
+			continue;
+
+		DBG(WSS, bex_debugobj(wss, "service fd %d [revents=0x%x]", fd, revents));
+		pfd.fd = fd;
+		pfd.events = wss->pollfds[x].events;
+		pfd.revents = revents;
+
+		return lws_service_fd(wss->context, &pfd) < 0 ? -EIO : 0;
+	}
+
+	return fd < 0 ? 0 : -ENOENT;
+}
+
+int wss_send(struct libbex_conn *conn, unsigned char *str, size_t sz)
 {
 	struct wss_ctl *wss;
 	struct wss_iovec *io = NULL;
 
-	if (!pl || !pl->wss)
+	if (!conn || !conn->wss)
 		return -EINVAL;
 
-	wss = (struct wss_ctl *) pl->wss;
+	wss = (struct wss_ctl *) conn->wss;
 	DBG(WSS, bex_debugobj(wss, "add new pending data [sz=%zu]", sz));
 
+	pthread_mutex_lock(&wss->lock);
 	if (list_empty(&wss->free_data)) {
 		io = calloc(1, sizeof(struct wss_iovec));
-		if (!io)
+		if (!io) {
+			pthread_mutex_unlock(&wss->lock);
 			return -ENOMEM;
+		}
 		DBG(WSS, bex_debugobj(wss, "alloc iovec [%p]", io));
 	} else {
 		io = list_first_entry(&wss->free_data, struct wss_iovec, vects);
@@ -245,28 +627,51 @@ int wss_send(struct libbex_platform *pl, unsigned char *str, size_t sz)
 	io->sz = sz;
 	io->buf = str;
 	list_add_tail(&io->vects, &wss->pending_data);
+	pthread_mutex_unlock(&wss->lock);
+
+	/* the connection is serviced by another thread, wake it up */
+	if (conn->ring) {
+		wss_cancel_service(conn);
+		return 0;
+	}
 
-	/* inform libwebsockets that we want to send data */
-	lws_callback_on_writable( wss->wsi );
+	/* inform libwebsockets that we want to send data (or wait for established) */
+	if (wss->established)
+		lws_callback_on_writable( wss->wsi );
 	return 0;
 }
 
+/*
+ * Interrupts lws_service() of the connection thread, the thread asks for
+ * the writeable callback if there are pending data.
+ */
+void wss_cancel_service(struct libbex_conn *conn)
+{
+	struct wss_ctl *wss = conn ? (struct wss_ctl *) conn->wss : NULL;
+
+	if (wss && wss->context)
+		lws_cancel_service(wss->context);
+}
+
 /* write all pending data */
 static int wss_write(struct wss_ctl *wss)
 {
 	struct list_head *pe, *pnext;
+	int rc = 0;
 
 	DBG(WSS, bex_debugobj(wss, "writing pending data... "));
 
+	pthread_mutex_lock(&wss->lock);
 	if (list_empty(&wss->pending_data)) {
 		DBG(WSS, bex_debugobj(wss, " no data pending"));
-		return 0;
+		goto done;
 	}
 
 	list_for_each_safe(pe, pnext, &wss->pending_data) {
 		struct wss_iovec *io = list_entry(pe, struct wss_iovec, vects);
 		size_t sz = wss_count_bufsiz(io->sz);
 		unsigned char *p;
+		int n;
 
 		/* (re)allocate buffer */
 		if (wss->bufsz < sz) {
@@ -274,8 +679,10 @@ static int wss_write(struct wss_ctl *wss)
 			unsigned char *tmp = realloc(wss->buf, newsz);
 
 			DBG(WSS, bex_debugobj(wss, " (re)allocated new write buffer [sz=%zu]", newsz));
-			if (!tmp)
-				return -ENOMEM;
+			if (!tmp) {
+				rc = -ENOMEM;
+				goto done;
+			}
 
 			wss->buf = tmp;
 			wss->bufsz = newsz;
@@ -288,7 +695,18 @@ static int wss_write(struct wss_ctl *wss)
 		memcpy(p, io->buf, io->sz);
 
 		/* send */
-		lws_write(wss->wsi, p, io->sz, LWS_WRITE_TEXT);
+		n = lws_write(wss->wsi, p, io->sz, LWS_WRITE_TEXT);
+		if (n < 0) {
+			DBG(WSS, bex_debugobj(wss, " write failed"));
+			rc = -EIO;
+			goto done;
+		}
+
+		/* capture only what has been really sent */
+		if (n > 0 && wss->pl->capture)
+			bex_capture_write(wss->pl->capture, wss->conn->idx, BEX_CAPTURE_TX,
+					  bex_get_monotonic_ns(), io->buf,
+					  min((size_t) n, io->sz));
 
 		/* deallocate and move to unused */
 		DBG(WSS, bex_debugobj(wss, " remove from pending iovec [%p]", io));
@@ -296,6 +714,7 @@ static int wss_write(struct wss_ctl *wss)
 		list_del(&io->vects);
 		list_add_tail(&io->vects, &wss->free_data);
 	}
-
-	return 0;
+done:
+	pthread_mutex_unlock(&wss->lock);
+	return rc;
 }
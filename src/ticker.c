@@ -16,21 +16,15 @@ static int count;
 
 static int ticker_callback(struct libbex_platform *pl, struct libbex_channel *ch)
 {
-	struct libbex_array *ar = bex_channel_get_replies(ch);
-	struct libbex_value *lp = bex_array_get(ar, "LAST_PRICE");
-	struct libbex_value *hi = bex_array_get(ar, "HIGH");
-	struct libbex_value *lo = bex_array_get(ar, "LOW");
-	struct libbex_value *vo = bex_array_get(ar, "VOLUME");
-	struct libbex_value *dc_perc = bex_array_get(ar, "DAILY_CHANGE_PERC");
-
+	const struct libbex_ticker *tk = bex_channel_get_reply_struct(ch);
 
 	fprintf(stderr, "%s: %.2Lf (%.1Lf%%) high=%.2Lf, low=%.2Lf, 24h_volume=%Lg\n",
 			bex_channel_get_symbolname(ch),
-			bex_value_get_float(lp),
-			bex_value_get_float(dc_perc) * 100,
-			bex_value_get_float(hi),
-			bex_value_get_float(lo),
-			bex_value_get_float(vo));
+			tk->last_price,
+			tk->daily_change_perc * 100,
+			tk->high,
+			tk->low,
+			tk->volume);
 	return 0;
 }
 
@@ -43,6 +37,7 @@ static void __attribute__((__noreturn__)) usage(void)
 	fputs(_("Platform ticker.\n"), stdout);
 
 	fputs(USAGE_OPTIONS, stdout);
+	fputs(_(" -w, --capture <file>       capture raw frames to <file>.<N>\n"), stdout);
 	fputs(_(" -V, --version              print version\n"), stdout);
 	fputs(_(" -h, --help                 this help\n"), stdout);
 
@@ -52,16 +47,17 @@ static void __attribute__((__noreturn__)) usage(void)
 int main(int argc, char **argv)
 {
 	int c, count_max = 0;
-	const char *uri = LIBBEX_DEFAULT_URI;
+	const char *uri = LIBBEX_DEFAULT_URI, *capture = NULL;
 	struct libbex_platform *pl;
 	static const struct option longopts[] = {
 		{ "help",	no_argument,		0, 'h' },
 		{ "version",	no_argument,		0, 'V' },
 		{ "count",	required_argument,	0, 'c' },
+		{ "capture",	required_argument,	0, 'w' },
 		{ NULL, 0, 0, 0 },
 	};
 
-	while ((c = getopt_long(argc, argv, "c:hV", longopts, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "c:hVw:", longopts, NULL)) != -1) {
 
 		switch(c) {
 		case 'c':
@@ -74,6 +70,9 @@ int main(int argc, char **argv)
 		case 'h':
 			usage();
 			break;
+		case 'w':
+			capture = optarg;
+			break;
 		default:
 			errtryhelp(1);
 		}
@@ -85,6 +84,15 @@ int main(int argc, char **argv)
 	if (!pl)
 		err(EXIT_FAILURE, _("failed to create platform instance for %s"), uri);
 
+	if (capture) {
+		int rc = bex_platform_set_capture(pl, capture);
+
+		if (rc) {
+			errno = -rc;
+			err(EXIT_FAILURE, _("failed to capture to %s"), capture);
+		}
+	}
+
 	while (optind < argc) {
 		struct libbex_channel *ch = bex_new_ticker_channel(argv[optind]);
 
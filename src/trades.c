@@ -24,8 +24,7 @@ static long double last_price = 0;
 static int trades_callback(struct libbex_platform *pl, struct libbex_channel *ch)
 {
 	const char *type = bex_channel_get_reply_type(ch);
-	struct libbex_array *ar;
-	struct libbex_value *am, *pr;
+	const struct libbex_trade *tr = bex_channel_get_reply_struct(ch);
 	const struct libbex_symbol *sy;
 	long double price;
 
@@ -41,12 +40,7 @@ static int trades_callback(struct libbex_platform *pl, struct libbex_channel *ch
 	}
 
 	sy = bex_channel_get_symbol(ch);
-
-	ar = bex_channel_get_replies(ch);
-	am = bex_array_get(ar, "AMOUNT");
-	pr = bex_array_get(ar, "PRICE");
-
-	price = bex_value_get_float(pr);
+	price = tr->price;
 
 	if (last_price) {
 		if (last_price < price)
@@ -60,7 +54,7 @@ static int trades_callback(struct libbex_platform *pl, struct libbex_channel *ch
 	       fprintf(stdout, "%s: %.2Lf : %+.8Lf\n",
                        bex_channel_get_symbolname(ch),
                        price,
-                       bex_value_get_float(am));
+                       tr->amount);
 	       return 0;
 	}
 
@@ -74,7 +68,7 @@ static int trades_callback(struct libbex_platform *pl, struct libbex_channel *ch
 	fputc(' ', stdout);
 
 	fprintf(stdout, bex_symbol_get_amount_format(sy),
-			bex_value_get_float(am));
+			tr->amount);
 
 	color_disable();
 
@@ -91,6 +85,7 @@ static void __attribute__((__noreturn__)) usage(void)
 	fputs(_("Platform trades.\n"), stdout);
 
 	fputs(USAGE_OPTIONS, stdout);
+	fputs(_(" -w, --capture <file>       capture raw frames to <file>.<N>\n"), stdout);
 	fputs(_(" -V, --version              print version\n"), stdout);
 	fputs(_(" -h, --help                 this help\n"), stdout);
 
@@ -101,19 +96,20 @@ int main(int argc, char **argv)
 {
 	int c, count_max = 0;
 	int colormode = UL_COLORMODE_AUTO;
-	const char *uri = LIBBEX_DEFAULT_URI;
+	const char *uri = LIBBEX_DEFAULT_URI, *capture = NULL;
 	struct libbex_platform *pl;
 	static const struct option longopts[] = {
 		{ "help",	no_argument,		0, 'h' },
 		{ "version",	no_argument,		0, 'V' },
 		{ "color",      optional_argument,	0, 'L' },
 		{ "count",	required_argument,	0, 'c' },
+		{ "capture",	required_argument,	0, 'w' },
 		{ "ignore-tu",	no_argument,		0, 'u' },
 		{ "ignore-te",	no_argument,		0, 'e' },
 		{ NULL, 0, 0, 0 },
 	};
 
-	while ((c = getopt_long(argc, argv, "c:hVue", longopts, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "c:hVuew:", longopts, NULL)) != -1) {
 
 		switch(c) {
 		case 'c':
@@ -126,6 +122,9 @@ int main(int argc, char **argv)
 		case 'h':
 			usage();
 			break;
+		case 'w':
+			capture = optarg;
+			break;
 		case 'u':
 			tu = 0;
 			break;
@@ -149,6 +148,15 @@ int main(int argc, char **argv)
 	if (!pl)
 		err(EXIT_FAILURE, _("failed to create platform instance for %s"), uri);
 
+	if (capture) {
+		int rc = bex_platform_set_capture(pl, capture);
+
+		if (rc) {
+			errno = -rc;
+			err(EXIT_FAILURE, _("failed to capture to %s"), capture);
+		}
+	}
+
 	while (optind < argc) {
 		struct libbex_channel *ch = bex_new_trades_channel(argv[optind]);
 